@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../db.h"
+#include "../sdbcsv.h"
+
+/*
+ *  bench_csv
+ *
+ *  Measures the throughput of the CSV scanner/parser used by sdbsc -I on
+ *  a generated in memory CSV file.
+ *
+ *  usage:  bench_csv [megabytes]
+ */
+
+#define DEF_MB      256
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count_row(void *arg, const student_t *s, int line_no)
+{
+    long *sums = (long *)arg;
+    (void)line_no;
+
+    if (s == NULL) {
+        sums[1]++;
+        return;
+    }
+    sums[0] += s->gpa;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t target = (size_t)((argc > 1) ? atoi(argv[1]) : DEF_MB) * 1024 * 1024;
+    char *csv = malloc(target + 128);
+    size_t len = 0;
+    long sums[2] = {0, 0};
+    int rows = 0;
+
+    if (csv == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    len += (size_t)sprintf(csv, "id,fname,lname,gpa\n");
+    for (int i = 0; len < target; i++) {
+        len += (size_t)sprintf(csv + len, "%d,first%d,lastname%d,%d.%02d\n",
+                               i % MAX_STD_ID + 1, i % 977, i % 4093,
+                               i % 5, i % 100);
+        rows++;
+    }
+
+    double t0 = now_sec();
+    int parsed = csv_parse(csv, len, count_row, sums);
+    double t = now_sec() - t0;
+
+    printf("%d rows, %.1f MB\n", rows, len / (1024.0 * 1024.0));
+    printf("  parsed %d rows (%ld bad) in %.3f s\n", parsed, sums[1], t);
+    printf("  %.1f MB/s  %.0f rows/s\n", len / (1024.0 * 1024.0) / t, parsed / t);
+
+    free(csv);
+    return (parsed == rows && sums[1] == 0) ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../db.h"
+#include "../sdbsc.h"
+#include "../sdbfmt.h"
+
+/*
+ *  bench_fmt
+ *
+ *  Checks that fmt_student_row() produces the same bytes as printf with
+ *  STUDENT_PRINT_FMT_STRING and then compares the speed of both when
+ *  formatting a full table worth of rows into memory.
+ *
+ *  usage:  bench_fmt [rows]
+ */
+
+#define DEF_ROWS    (MAX_STD_ID * 20)
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_student(student_t *s, int i)
+{
+    static const char *fnames[] = {"john", "jane", "a", "maximilianalexander", ""};
+    static const char *lnames[] = {"doe", "smith-jones", "x",
+                                   "abcdefghijklmnopqrstuvwxyzabcdef"};
+
+    memset(s, 0, sizeof(*s));
+    s->id = (i % MAX_STD_ID) + 1;
+    memcpy(s->fname, fnames[i % 5], strlen(fnames[i % 5]));
+    memcpy(s->lname, lnames[i % 4], strlen(lnames[i % 4]));  //may fill all 32
+    s->gpa = i % (MAX_STD_GPA + 1);
+}
+
+static int verify(void)
+{
+    char fast[STUDENT_ROW_MAX + 1];
+    char slow[STUDENT_ROW_MAX + 1];
+    student_t s;
+    int bad = 0;
+
+    for (int i = -1000; i < 200000; i++) {
+        make_student(&s, i < 0 ? -i : i);
+        s.gpa = i;
+        if (i % 7 == 0)
+            s.id = -i;
+        size_t n = fmt_student_row(fast, &s);
+        float gpa = s.gpa / 100.0;
+        int m = snprintf(slow, sizeof(slow), STUDENT_PRINT_FMT_STRING,
+                         s.id, s.fname, s.lname, gpa);
+        if ((size_t)m != n || memcmp(fast, slow, n) != 0) {
+            if (bad++ < 5)
+                printf("MISMATCH gpa=%d\n  fast: %.*s  printf: %s", i, (int)n, fast, slow);
+        }
+    }
+
+    fmt_student_hdr(fast);
+    snprintf(slow, sizeof(slow), STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    if (memcmp(fast, slow, strlen(slow)) != 0) {
+        printf("MISMATCH in header\n");
+        bad++;
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[])
+{
+    int rows = (argc > 1) ? atoi(argv[1]) : DEF_ROWS;
+    student_t *tbl = malloc(sizeof(student_t) * MAX_STD_ID);
+    char *out = malloc((size_t)STUDENT_ROW_MAX * MAX_STD_ID);
+    double t0, t_printf, t_fast;
+    size_t sink = 0;
+
+    if (tbl == NULL || out == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    if (verify() != 0) {
+        printf("formatter output differs from printf\n");
+        return 1;
+    }
+    printf("formatter output matches printf for all checked rows\n");
+
+    for (int i = 0; i < MAX_STD_ID; i++)
+        make_student(&tbl[i], i);
+
+    t0 = now_sec();
+    for (int i = 0; i < rows; i++) {
+        student_t *s = &tbl[i % MAX_STD_ID];
+        float gpa = s->gpa / 100.0;
+        if (i % MAX_STD_ID == 0)
+            sink = 0;
+        sink += snprintf(out + sink, STUDENT_ROW_MAX, STUDENT_PRINT_FMT_STRING,
+                         s->id, s->fname, s->lname, gpa);
+    }
+    t_printf = now_sec() - t0;
+
+    t0 = now_sec();
+    for (int i = 0; i < rows; i++) {
+        if (i % MAX_STD_ID == 0)
+            sink = 0;
+        sink += fmt_student_row(out + sink, &tbl[i % MAX_STD_ID]);
+    }
+    t_fast = now_sec() - t0;
+
+    printf("%d rows\n", rows);
+    printf("  printf:        %8.3f s  %10.0f rows/s\n", t_printf, rows / t_printf);
+    printf("  sdbfmt:        %8.3f s  %10.0f rows/s\n", t_fast, rows / t_fast);
+    printf("  speedup:       %8.2fx\n", t_printf / t_fast);
+
+    free(tbl);
+    free(out);
+    return (int)(sink == 0);
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../db.h"
+#include "../sdbsc.h"
+#include "../sdblookup.h"
+
+/*
+ *  bench_lookup
+ *
+ *  Measures lookups by id per second from 1 up to max_threads reader
+ *  threads while one writer keeps updating records.  The lookup service
+ *  (seqlock reads of an in memory table) is compared with the simple
+ *  frontend: a global mutex around pread() of the database file.
+ *
+ *  usage:  bench_lookup [max_threads] [ms_per_run]
+ */
+
+#define DEF_MS          500
+#define MAX_THREADS     256
+
+typedef struct run {
+    lookup_svc_t    *svc;           //NULL for the mutex + pread frontend
+    int             db_fd;
+    pthread_mutex_t *lock;
+    atomic_bool     stop;
+} run_t;
+
+typedef struct reader {
+    pthread_t       tid;
+    run_t           *run;
+    unsigned int    seed;
+    long            lookups;
+    long            found;
+} reader_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int random_id(unsigned int *seed)
+{
+    // xorshift32, cheap enough not to show up next to the lookup itself
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (int)(*seed % MAX_STD_ID) + 1;
+}
+
+static int locked_get(run_t *run, int id, student_t *s)
+{
+    int rc = SRCH_NOT_FOUND;
+
+    pthread_mutex_lock(run->lock);
+    if (pread(run->db_fd, s, STUDENT_RECORD_SIZE, (off_t)(id - 1) * STUDENT_RECORD_SIZE) ==
+        STUDENT_RECORD_SIZE && s->id == id)
+        rc = NO_ERROR;
+    pthread_mutex_unlock(run->lock);
+    return rc;
+}
+
+static void *reader_main(void *arg)
+{
+    reader_t *r = (reader_t *)arg;
+    run_t *run = r->run;
+    student_t s;
+
+    while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+        for (int i = 0; i < 1024; i++) {
+            int id = random_id(&r->seed);
+            int rc = run->svc ? lookup_get(run->svc, id, &s) : locked_get(run, id, &s);
+            r->found += (rc == NO_ERROR);
+        }
+        r->lookups += 1024;
+    }
+    return NULL;
+}
+
+static void *writer_main(void *arg)
+{
+    run_t *run = (run_t *)arg;
+    unsigned int seed = 0x9e3779b9u;
+    student_t s = {0};
+
+    while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+        int id = random_id(&seed);
+
+        s.id = id;
+        s.gpa = (int)(seed % 500);
+        snprintf(s.fname, sizeof(s.fname), "first%d", id);
+        snprintf(s.lname, sizeof(s.lname), "last%d", id);
+
+        if (run->svc == NULL)
+            pthread_mutex_lock(run->lock);
+        pwrite(run->db_fd, &s, STUDENT_RECORD_SIZE, (off_t)(id - 1) * STUDENT_RECORD_SIZE);
+        if (run->svc == NULL)
+            pthread_mutex_unlock(run->lock);
+        else
+            lookup_publish(run->svc, id, &s);
+    }
+    return NULL;
+}
+
+static double measure(run_t *run, int nthreads, int ms)
+{
+    static reader_t readers[MAX_THREADS];
+    pthread_t writer;
+    long total = 0;
+
+    atomic_store(&run->stop, false);
+    for (int i = 0; i < nthreads; i++) {
+        readers[i] = (reader_t){.run = run, .seed = 2463534242u + i * 7919u};
+        pthread_create(&readers[i].tid, NULL, reader_main, &readers[i]);
+    }
+    pthread_create(&writer, NULL, writer_main, run);
+
+    double t0 = now_sec();
+    usleep(ms * 1000);
+    atomic_store(&run->stop, true);
+    double t1 = now_sec();
+
+    pthread_join(writer, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(readers[i].tid, NULL);
+        total += readers[i].lookups;
+    }
+    return total / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 1) ? atoi(argv[1]) : (int)(ncpu > 0 ? ncpu : 1);
+    int ms = (argc > 2) ? atoi(argv[2]) : DEF_MS;
+    char path[] = "/tmp/bench_lookup.XXXXXX";
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    lookup_svc_t svc;
+    student_t s = {0};
+    double base = 0;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    // half the slots in use so lookups see both hits and misses
+    int db_fd = mkstemp(path);
+    if (db_fd == -1) {
+        printf("cant create %s\n", path);
+        return 1;
+    }
+    unlink(path);
+    for (int id = 1; id <= MAX_STD_ID; id += 2) {
+        s.id = id;
+        s.gpa = id % 500;
+        pwrite(db_fd, &s, STUDENT_RECORD_SIZE, (off_t)(id - 1) * STUDENT_RECORD_SIZE);
+    }
+    if (lookup_open(db_fd, &svc) < 0)
+        return 1;
+
+    printf("lookups by id with 1 writer, %ld cpu(s), %d ms per run\n", ncpu, ms);
+    printf("  threads    seqlock M/s   scaling    mutex+pread M/s\n");
+    for (int n = 1; n <= max_threads; n = (n * 2 > max_threads && n < max_threads) ? max_threads : n * 2) {
+        run_t fast = {.svc = &svc, .db_fd = db_fd, .lock = &lock};
+        run_t slow = {.svc = NULL, .db_fd = db_fd, .lock = &lock};
+        double f = measure(&fast, n, ms);
+        double m = measure(&slow, n, ms);
+
+        if (n == 1)
+            base = f;
+        printf("  %7d    %11.1f   %6.2fx    %15.1f\n", n, f, f / base, m);
+    }
+
+    lookup_close(&svc);
+    close(db_fd);
+    return 0;
+}
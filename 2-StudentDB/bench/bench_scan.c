@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../db.h"
+#include "../sdbcache.h"
+#include "../sdbquery.h"
+
+/*
+ *  bench_scan
+ *
+ *  Compares a gpa filter over the 64 byte student rows with the same
+ *  filter run by the query kernels over the column cache arrays, for a
+ *  full table of MAX_STD_ID students held in memory.
+ *
+ *  usage:  bench_scan [passes]
+ */
+
+#define DEF_PASSES  200
+#define QUERY       "gpa>=350"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int passes = (argc > 1) ? atoi(argv[1]) : DEF_PASSES;
+    student_t *rows = calloc(MAX_STD_ID, sizeof(student_t));
+    colcache_t cc = {0};
+    static uint16_t sel[Q_BLOCK];
+    const char *err_at;
+    query_t q;
+    long row_hits = 0, col_hits = 0;
+
+    cc.nslots = MAX_STD_ID;
+    cc.id = calloc(MAX_STD_ID, sizeof(int32_t));
+    cc.gpa = calloc(MAX_STD_ID, sizeof(int32_t));
+    cc.fname = calloc(MAX_STD_ID, COLCACHE_FNAME_SZ);
+    cc.lname = calloc(MAX_STD_ID, COLCACHE_LNAME_SZ);
+    if (rows == NULL || cc.id == NULL || cc.gpa == NULL || cc.fname == NULL || cc.lname == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    if (query_compile(QUERY, &q, &err_at) != 0) {
+        printf("bad query at %s\n", err_at);
+        return 1;
+    }
+
+    // every slot used, gpa spread over 0..499
+    for (int i = 0; i < MAX_STD_ID; i++) {
+        rows[i].id = i + 1;
+        rows[i].gpa = (i * 7919) % 500;
+        snprintf(rows[i].fname, sizeof(rows[i].fname), "first%d", i % 977);
+        snprintf(rows[i].lname, sizeof(rows[i].lname), "last%d", i % 4093);
+        cc.id[i] = rows[i].id;
+        cc.gpa[i] = rows[i].gpa;
+        memcpy(cc.fname[i], rows[i].fname, COLCACHE_FNAME_SZ);
+        memcpy(cc.lname[i], rows[i].lname, COLCACHE_LNAME_SZ);
+    }
+
+    double t0 = now_sec();
+    for (int p = 0; p < passes; p++) {
+        for (int i = 0; i < MAX_STD_ID; i++)
+            row_hits += rows[i].id != 0 && rows[i].gpa >= 350;
+    }
+    double t1 = now_sec();
+    for (int p = 0; p < passes; p++) {
+        for (int base = 0; base < MAX_STD_ID; base += Q_BLOCK) {
+            int n = (MAX_STD_ID - base < Q_BLOCK) ? MAX_STD_ID - base : Q_BLOCK;
+            col_hits += query_block(&q, &cc, base, n, sel);
+        }
+    }
+    double t2 = now_sec();
+
+    double rows_scanned = (double)MAX_STD_ID * passes;
+    printf("%s over %d students x %d passes\n", QUERY, MAX_STD_ID, passes);
+    printf("  student rows:   %8.1f M students/s  (%ld hits)\n", rows_scanned / (t1 - t0) / 1e6, row_hits);
+    printf("  column cache:   %8.1f M students/s  (%ld hits)\n", rows_scanned / (t2 - t1) / 1e6, col_hits);
+    printf("  speedup:        %8.2fx\n", (t1 - t0) / (t2 - t1));
+    return row_hits == col_hits ? 0 : 1;
+}
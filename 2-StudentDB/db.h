@@ -31,5 +31,11 @@ static const int DELETED_STUDENT_ID = 0;
 
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define SHM_DB_PREFIX "/sdbsc_"              //shared memory copies, see shm_db_name()
+#define DB_MANIFEST_FILE "student.db.manifest"  //layout of a sharded database
+#define DB_PGEN_FILE "student.db.pgen"          //page generations for backups
+#define DB_LOG_FILE "student.db.log"            //replication log of a leader
+#define DB_LSN_FILE "student.db.lsn"            //replication position of a follower
+#define DB_COLCACHE_FILE "student.db.cols"      //column cache for scans
 
 #endif
\ No newline at end of file
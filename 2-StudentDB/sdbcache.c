@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbcache.h"
+
+#define COLCACHE_TMP_FILE   ".tmp_student.db.cols"
+#define COLCACHE_BATCH      1024    //records read per pread() while building
+
+//file offsets of the arrays
+typedef struct colcache_layout {
+    size_t id, gpa, fname, lname, total;
+} colcache_layout_t;
+
+static size_t cc_align(size_t off)
+{
+    return (off + 63) & ~(size_t)63;
+}
+
+static colcache_layout_t cc_layout(int nslots)
+{
+    colcache_layout_t l;
+
+    l.id = sizeof(colcache_hdr_t);
+    l.gpa = cc_align(l.id + (size_t)nslots * sizeof(int32_t));
+    l.fname = cc_align(l.gpa + (size_t)nslots * sizeof(int32_t));
+    l.lname = cc_align(l.fname + (size_t)nslots * COLCACHE_FNAME_SZ);
+    l.total = cc_align(l.lname + (size_t)nslots * COLCACHE_LNAME_SZ);
+    return l;
+}
+
+static void cc_bind(colcache_t *cc, void *mem, size_t len, int nslots)
+{
+    colcache_layout_t l = cc_layout(nslots);
+    char *base = (char *)mem;
+
+    cc->map = mem;
+    cc->map_len = len;
+    cc->nslots = nslots;
+    cc->id = (int32_t *)(base + l.id);
+    cc->gpa = (int32_t *)(base + l.gpa);
+    cc->fname = (char (*)[COLCACHE_FNAME_SZ])(base + l.fname);
+    cc->lname = (char (*)[COLCACHE_LNAME_SZ])(base + l.lname);
+}
+
+/*
+ *  cc_map_current
+ *      fd:     open cache file
+ *      db_st:  fstat() of the database
+ *      cc:     receives the mapping
+ *
+ *  returns:  NO_ERROR       the file was built from this database, mapped
+ *            ERR_DB_FILE    stale, damaged or unmappable
+ */
+static int cc_map_current(int fd, const struct stat *db_st, colcache_t *cc)
+{
+    colcache_layout_t l = cc_layout(MAX_STD_ID);
+    colcache_hdr_t hdr;
+    struct stat st;
+    void *mem;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size != l.total ||
+        pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, COLCACHE_MAGIC, sizeof(COLCACHE_MAGIC)) != 0 ||
+        hdr.nslots != MAX_STD_ID || hdr.rec_size != (uint32_t)STUDENT_RECORD_SIZE ||
+        hdr.db_ino != (uint64_t)db_st->st_ino || hdr.db_size != (uint64_t)db_st->st_size)
+        return ERR_DB_FILE;
+
+    mem = mmap(NULL, l.total, PROT_READ, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        return ERR_DB_FILE;
+    cc_bind(cc, mem, l.total, MAX_STD_ID);
+    return NO_ERROR;
+}
+
+/*
+ *  cc_fill
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      cc:            zero filled arrays to transpose the table into
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database read issue
+ */
+static int cc_fill(const int fds[], int nfds, int slots_per_fd, colcache_t *cc)
+{
+    student_t *batch = malloc(sizeof(student_t) * COLCACHE_BATCH);
+    int rc = ERR_DB_FILE;
+
+    if (batch == NULL)
+        return ERR_DB_FILE;
+
+    for (int f = 0; f < nfds; f++) {
+        int end = (f == nfds - 1) ? cc->nslots : (f + 1) * slots_per_fd;
+        if (end > cc->nslots)
+            end = cc->nslots;
+
+        for (int slot = f * slots_per_fd; slot < end; slot += COLCACHE_BATCH) {
+            ssize_t got = pread(fds[f], batch, sizeof(student_t) * COLCACHE_BATCH,
+                                (off_t)slot * STUDENT_RECORD_SIZE);
+            if (got == -1)
+                goto done;
+            int n = (int)(got / STUDENT_RECORD_SIZE);
+            if (n > end - slot)
+                n = end - slot;
+            if (n == 0)
+                break;
+
+            for (int i = 0; i < n; i++) {
+                cc->id[slot + i] = batch[i].id;
+                cc->gpa[slot + i] = batch[i].gpa;
+                memcpy(cc->fname[slot + i], batch[i].fname, COLCACHE_FNAME_SZ);
+                memcpy(cc->lname[slot + i], batch[i].lname, COLCACHE_LNAME_SZ);
+            }
+        }
+    }
+    rc = NO_ERROR;
+
+done:
+    free(batch);
+    return rc;
+}
+
+/*
+ *  cc_build_file
+ *      db_fd:  linux file descriptor of the database, flock()ed by caller
+ *      db_st:  fstat() of the database
+ *      cc:     receives the mapping of the new file
+ *
+ *  Transposes the table into a temporary file and renames it over
+ *  DB_COLCACHE_FILE.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or cache file I/O issue
+ */
+static int cc_build_file(int db_fd, const struct stat *db_st, colcache_t *cc)
+{
+    colcache_layout_t l = cc_layout(MAX_STD_ID);
+    colcache_hdr_t *hdr;
+    void *mem;
+    int fd;
+
+    fd = open(COLCACHE_TMP_FILE, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+        return ERR_DB_FILE;
+    if (ftruncate(fd, (off_t)l.total) == -1 ||
+        (mem = mmap(NULL, l.total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        unlink(COLCACHE_TMP_FILE);
+        return ERR_DB_FILE;
+    }
+    close(fd);
+
+    cc_bind(cc, mem, l.total, MAX_STD_ID);
+    if (cc_fill(&db_fd, 1, MAX_STD_ID, cc) != NO_ERROR) {
+        munmap(mem, l.total);
+        unlink(COLCACHE_TMP_FILE);
+        return ERR_DB_FILE;
+    }
+
+    hdr = (colcache_hdr_t *)mem;
+    memcpy(hdr->magic, COLCACHE_MAGIC, sizeof(COLCACHE_MAGIC));
+    hdr->nslots = MAX_STD_ID;
+    hdr->rec_size = (uint32_t)STUDENT_RECORD_SIZE;
+    hdr->db_ino = (uint64_t)db_st->st_ino;
+    hdr->db_size = (uint64_t)db_st->st_size;
+
+    if (rename(COLCACHE_TMP_FILE, DB_COLCACHE_FILE) == -1) {
+        munmap(mem, l.total);
+        unlink(COLCACHE_TMP_FILE);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  colcache_open
+ *      db_fd:  linux file descriptor of the database
+ *      cc:     receives the column arrays
+ *
+ *  Maps DB_COLCACHE_FILE if it was built from this database, otherwise
+ *  builds it first.  If the file cannot be written (read only directory)
+ *  the arrays are built on the heap for this process only.
+ *
+ *  returns:  NO_ERROR       arrays ready, release with colcache_close()
+ *            ERR_DB_FILE    database read issue
+ */
+int colcache_open(int db_fd, colcache_t *cc)
+{
+    colcache_layout_t l = cc_layout(MAX_STD_ID);
+    struct stat db_st;
+    int fd, rc;
+
+    memset(cc, 0, sizeof(*cc));
+    if (fstat(db_fd, &db_st) == -1)
+        return ERR_DB_FILE;
+
+    fd = open(DB_COLCACHE_FILE, O_RDONLY);
+    if (fd != -1) {
+        rc = cc_map_current(fd, &db_st, cc);
+        close(fd);
+        if (rc == NO_ERROR)
+            return NO_ERROR;
+    }
+
+    // build it, unless another process did while we waited for the lock
+    if (flock(db_fd, LOCK_EX) == -1)
+        return ERR_DB_FILE;
+    fstat(db_fd, &db_st);
+    fd = open(DB_COLCACHE_FILE, O_RDONLY);
+    rc = (fd != -1) ? cc_map_current(fd, &db_st, cc) : ERR_DB_FILE;
+    if (fd != -1)
+        close(fd);
+    if (rc != NO_ERROR)
+        rc = cc_build_file(db_fd, &db_st, cc);
+    if (rc != NO_ERROR) {
+        void *mem = calloc(1, l.total);
+        if (mem != NULL) {
+            cc_bind(cc, mem, l.total, MAX_STD_ID);
+            cc->on_heap = true;
+            rc = cc_fill(&db_fd, 1, MAX_STD_ID, cc);
+            if (rc != NO_ERROR)
+                colcache_close(cc);
+        }
+    }
+    flock(db_fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  colcache_open_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      cc:            receives the column arrays
+ *
+ *  colcache_open() for a database that may be split over several files,
+ *  as a sharded one is.  DB_COLCACHE_FILE is checked against a single
+ *  database file, so for more than one file the arrays are built on the
+ *  heap for this process only.
+ *
+ *  returns:  NO_ERROR       arrays ready, release with colcache_close()
+ *            ERR_DB_FILE    database read issue
+ */
+int colcache_open_ranges(const int fds[], int nfds, int slots_per_fd, colcache_t *cc)
+{
+    colcache_layout_t l = cc_layout(MAX_STD_ID);
+    void *mem;
+    int rc;
+
+    if (nfds == 1)
+        return colcache_open(fds[0], cc);
+
+    memset(cc, 0, sizeof(*cc));
+    mem = calloc(1, l.total);
+    if (mem == NULL)
+        return ERR_DB_FILE;
+    cc_bind(cc, mem, l.total, MAX_STD_ID);
+    cc->on_heap = true;
+    rc = cc_fill(fds, nfds, slots_per_fd, cc);
+    if (rc != NO_ERROR)
+        colcache_close(cc);
+    return rc;
+}
+
+/*
+ *  colcache_close
+ *      cc:  arrays returned by colcache_open()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void colcache_close(colcache_t *cc)
+{
+    if (cc->on_heap)
+        free(cc->map);
+    else if (cc->map != NULL)
+        munmap(cc->map, cc->map_len);
+    memset(cc, 0, sizeof(*cc));
+}
+
+/*
+ *  colcache_get
+ *      cc:    column arrays
+ *      slot:  slot to read, id - 1
+ *      s:     receives the student
+ *
+ *  returns:  nothing, this is a void function
+ */
+void colcache_get(const colcache_t *cc, int slot, student_t *s)
+{
+    s->id = cc->id[slot];
+    s->gpa = cc->gpa[slot];
+    memcpy(s->fname, cc->fname[slot], COLCACHE_FNAME_SZ);
+    memcpy(s->lname, cc->lname[slot], COLCACHE_LNAME_SZ);
+}
+
+/*
+ *  colcache_patch
+ *      db_fd:  linux file descriptor of the database
+ *      slot:   slot that was just written, id - 1
+ *
+ *  Copies the slot from the database into the four arrays of the cache
+ *  file.  It is called after the database write and reads the record back
+ *  under the lock, so concurrent changes to the same slot leave the cache
+ *  with whatever the database holds.  A cache that cannot be patched, or
+ *  does not belong to this database, is removed and rebuilt by the next
+ *  scan.  Does nothing if no cache has been built.
+ *
+ *  returns:  NO_ERROR       cache patched, removed or not present
+ *            ERR_DB_FILE    a broken cache file could not be removed
+ */
+int colcache_patch(int db_fd, int slot)
+{
+    colcache_layout_t l = cc_layout(MAX_STD_ID);
+    colcache_hdr_t hdr;
+    student_t s = {0};
+    struct stat db_st;
+    int fd, rc = ERR_DB_FILE;
+
+    if (access(DB_COLCACHE_FILE, F_OK) != 0)
+        return NO_ERROR;
+    if (slot < 0 || slot >= MAX_STD_ID || flock(db_fd, LOCK_EX) == -1)
+        return colcache_invalidate();
+
+    fd = open(DB_COLCACHE_FILE, O_RDWR);
+    if (fd == -1) {
+        flock(db_fd, LOCK_UN);
+        return NO_ERROR;
+    }
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+        memcmp(hdr.magic, COLCACHE_MAGIC, sizeof(COLCACHE_MAGIC)) == 0 &&
+        hdr.nslots == MAX_STD_ID &&
+        pread(db_fd, &s, sizeof(s), (off_t)slot * STUDENT_RECORD_SIZE) != -1 &&
+        fstat(db_fd, &db_st) != -1 &&
+        hdr.db_ino == (uint64_t)db_st.st_ino && hdr.db_size <= (uint64_t)db_st.st_size) {
+        hdr.db_size = (uint64_t)db_st.st_size;
+        if (pwrite(fd, &s.id, sizeof(int32_t), (off_t)(l.id + (size_t)slot * sizeof(int32_t))) == (ssize_t)sizeof(int32_t) &&
+            pwrite(fd, &s.gpa, sizeof(int32_t), (off_t)(l.gpa + (size_t)slot * sizeof(int32_t))) == (ssize_t)sizeof(int32_t) &&
+            pwrite(fd, s.fname, COLCACHE_FNAME_SZ, (off_t)(l.fname + (size_t)slot * COLCACHE_FNAME_SZ)) == (ssize_t)COLCACHE_FNAME_SZ &&
+            pwrite(fd, s.lname, COLCACHE_LNAME_SZ, (off_t)(l.lname + (size_t)slot * COLCACHE_LNAME_SZ)) == (ssize_t)COLCACHE_LNAME_SZ &&
+            pwrite(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr))
+            rc = NO_ERROR;
+    }
+    close(fd);
+    if (rc != NO_ERROR)
+        rc = colcache_invalidate();
+    flock(db_fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  colcache_invalidate
+ *
+ *  Removes the cache file, the next scan builds a new one.  Used by every
+ *  operation that rewrites the table instead of single slots.
+ *
+ *  returns:  NO_ERROR       removed or not present
+ *            ERR_DB_FILE    the file could not be removed
+ */
+int colcache_invalidate(void)
+{
+    if (unlink(DB_COLCACHE_FILE) == -1 && errno != ENOENT)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
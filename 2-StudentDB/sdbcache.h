@@ -0,0 +1,56 @@
+#ifndef __SDBCACHE_H__
+    #define __SDBCACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h" //get student record type
+
+//Structure of arrays copy of the student table for scans.  The table is
+//transposed into one array per field, indexed by slot (id - 1):
+//
+//      id[nslots]  gpa[nslots]  fname[nslots][24]  lname[nslots][32]
+//
+//so a scan that only tests gpa reads 4 bytes per student instead of a whole
+//64 byte record.  The arrays live in DB_COLCACHE_FILE and are mapped read
+//only by the scans.  The file is built on the first scan that needs it, add,
+//delete and update patch their slot in place, and operations that rewrite
+//the table remove the file so the next scan builds it again.  The database
+//inode and size are kept in the header as a sanity check.
+//
+//Building and patching hold flock() on the database file, so a change made
+//while a build is running waits and then patches the new file.
+#define COLCACHE_MAGIC      "SDBCOLC"
+#define COLCACHE_FNAME_SZ   sizeof(((student_t *)0)->fname)
+#define COLCACHE_LNAME_SZ   sizeof(((student_t *)0)->lname)
+
+typedef struct colcache_hdr {
+    char     magic[8];                  //COLCACHE_MAGIC
+    uint32_t nslots;
+    uint32_t rec_size;                  //sizeof(student_t)
+    uint64_t db_ino;                    //database the arrays were built from
+    uint64_t db_size;
+    char     pad[32];                   //arrays start 64 byte aligned
+} colcache_hdr_t;
+
+typedef struct colcache {
+    void        *map;                   //file mapping or heap copy
+    size_t      map_len;
+    bool        on_heap;                //file could not be written
+    int         nslots;
+    int32_t     *id;
+    int32_t     *gpa;
+    char        (*fname)[COLCACHE_FNAME_SZ];
+    char        (*lname)[COLCACHE_LNAME_SZ];
+} colcache_t;
+
+//prototypes for the column cache, see sdbcache.c for documentation
+int colcache_open(int db_fd, colcache_t *cc);
+int colcache_open_ranges(const int fds[], int nfds, int slots_per_fd, colcache_t *cc);
+void colcache_close(colcache_t *cc);
+void colcache_get(const colcache_t *cc, int slot, student_t *s);
+int colcache_patch(int db_fd, int slot);
+int colcache_invalidate(void);
+
+#endif
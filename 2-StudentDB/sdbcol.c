@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbcol.h"
+
+#define COL_SCAN_BATCH  1024    //records read per pread() while exporting
+
+//buffered writer for one column block
+typedef struct col_writer {
+    int      fd;
+    uint64_t pos;                       //file offset of the next flush
+    size_t   len;                       //bytes buffered
+    char     buf[COL_BUFF_SZ];
+} col_writer_t;
+
+static uint64_t col_align(uint64_t off)
+{
+    return (off + COL_ALIGN - 1) & ~(uint64_t)(COL_ALIGN - 1);
+}
+
+static int col_flush(col_writer_t *w)
+{
+    if (w->len > 0 && pwrite(w->fd, w->buf, w->len, (off_t)w->pos) != (ssize_t)w->len)
+        return ERR_DB_FILE;
+    w->pos += w->len;
+    w->len = 0;
+    return NO_ERROR;
+}
+
+static int col_put(col_writer_t *w, const void *data, size_t n)
+{
+    if (COL_BUFF_SZ - w->len < n && col_flush(w) != NO_ERROR)
+        return ERR_DB_FILE;
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+    return NO_ERROR;
+}
+
+/*
+ *  scan_db
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      batch:         COL_SCAN_BATCH records of scratch space
+ *      visit:         called for every student in id order, NULL to only count
+ *      arg:           passed to visit
+ *      fbytes:        receives the total length of all first names
+ *      lbytes:        receives the total length of all last names
+ *
+ *  returns:  <number>       number of students visited
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int scan_db(const int fds[], int nfds, int slots_per_fd, student_t *batch,
+                   int (*visit)(void *, const student_t *), void *arg,
+                   uint64_t *fbytes, uint64_t *lbytes)
+{
+    int count = 0;
+
+    *fbytes = 0;
+    *lbytes = 0;
+    for (int f = 0; f < nfds; f++) {
+        int first = f * slots_per_fd;
+        int end = first + slots_per_fd < MAX_STD_ID ? first + slots_per_fd : MAX_STD_ID;
+
+        for (int slot = first; slot < end; slot += COL_SCAN_BATCH) {
+            int want = end - slot < COL_SCAN_BATCH ? end - slot : COL_SCAN_BATCH;
+            ssize_t got = pread(fds[f], batch, (size_t)want * STUDENT_RECORD_SIZE,
+                                (off_t)slot * STUDENT_RECORD_SIZE);
+            if (got == -1)
+                return ERR_DB_FILE;
+            int n = (int)(got / STUDENT_RECORD_SIZE);
+
+            for (int i = 0; i < n; i++) {
+                if (memcmp(&batch[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                    continue;
+                *fbytes += strnlen(batch[i].fname, sizeof(batch[i].fname));
+                *lbytes += strnlen(batch[i].lname, sizeof(batch[i].lname));
+                if (visit != NULL && visit(arg, &batch[i]) != NO_ERROR)
+                    return ERR_DB_FILE;
+                count++;
+            }
+            if (n < want)
+                break;      //end of this file
+        }
+    }
+    return count;
+}
+
+//state of the second export pass
+typedef struct col_export {
+    col_writer_t w[COL_NCOLS];
+    uint32_t     fname_end;             //running end offsets of the names
+    uint32_t     lname_end;
+} col_export_t;
+
+static int export_row(void *arg, const student_t *s)
+{
+    col_export_t *ex = (col_export_t *)arg;
+    size_t flen = strnlen(s->fname, sizeof(s->fname));
+    size_t llen = strnlen(s->lname, sizeof(s->lname));
+
+    ex->fname_end += (uint32_t)flen;
+    ex->lname_end += (uint32_t)llen;
+
+    if (col_put(&ex->w[COL_ID], &s->id, sizeof(int32_t)) != NO_ERROR ||
+        col_put(&ex->w[COL_GPA], &s->gpa, sizeof(int32_t)) != NO_ERROR ||
+        col_put(&ex->w[COL_FNAME_IDX], &ex->fname_end, sizeof(uint32_t)) != NO_ERROR ||
+        col_put(&ex->w[COL_FNAME], s->fname, flen) != NO_ERROR ||
+        col_put(&ex->w[COL_LNAME_IDX], &ex->lname_end, sizeof(uint32_t)) != NO_ERROR ||
+        col_put(&ex->w[COL_LNAME], s->lname, llen) != NO_ERROR)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  export_columns
+ *      fd:        linux file descriptor of the database
+ *      col_file:  path of the columnar snapshot to write
+ *
+ *  Writes a columnar snapshot of the table, see sdbcol.h for the layout.
+ *  The database is read twice.  The first pass only counts the students
+ *  and name bytes so that every block offset is known up front, the second
+ *  pass streams each record into six buffered column writers that flush
+ *  with pwrite() at their own offsets.  Memory use is bounded by the column
+ *  buffers no matter how big the table is.  The snapshot is written to a
+ *  temporary file and renamed over col_file when complete.
+ *
+ *  returns:  <number>       number of students exported
+ *            ERR_DB_FILE    database or column file I/O issue
+ *
+ *  console:  M_COL_EXPORTED   on success
+ *            M_ERR_DB_READ    error reading the database, or the database
+ *                             changed between the two passes
+ *            M_ERR_COL_WRITE  error writing the column file
+ */
+int export_columns(int fd, const char *col_file)
+{
+    return export_columns_ranges(&fd, 1, MAX_STD_ID, col_file);
+}
+
+/*
+ *  export_columns_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      col_file:      path of the columnar snapshot to write
+ *
+ *  Same as export_columns() for a database split over several files, as a
+ *  sharded one is.  The files are scanned in order, so the rows are still
+ *  in id order.
+ *
+ *  returns:  same as export_columns()
+ *
+ *  console:  same as export_columns()
+ */
+int export_columns_ranges(const int fds[], int nfds, int slots_per_fd, const char *col_file)
+{
+    student_t *batch = malloc(sizeof(student_t) * COL_SCAN_BATCH);
+    col_export_t *ex = calloc(1, sizeof(col_export_t));
+    char tmp_file[4096];
+    col_hdr_t hdr = {0};
+    uint64_t fbytes, lbytes, fbytes2, lbytes2;
+    int rc = ERR_DB_FILE;
+    int count, out_fd = -1;
+
+    if (batch == NULL || ex == NULL) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    count = scan_db(fds, nfds, slots_per_fd, batch, NULL, NULL, &fbytes, &lbytes);
+    if (count < 0) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    memcpy(hdr.magic, COL_MAGIC, sizeof(COL_MAGIC));
+    hdr.version = COL_VERSION;
+    hdr.nrecs = (uint32_t)count;
+    hdr.len[COL_ID] = (uint64_t)count * sizeof(int32_t);
+    hdr.len[COL_GPA] = (uint64_t)count * sizeof(int32_t);
+    hdr.len[COL_FNAME_IDX] = ((uint64_t)count + 1) * sizeof(uint32_t);
+    hdr.len[COL_FNAME] = fbytes;
+    hdr.len[COL_LNAME_IDX] = ((uint64_t)count + 1) * sizeof(uint32_t);
+    hdr.len[COL_LNAME] = lbytes;
+    hdr.off[0] = col_align(sizeof(col_hdr_t));
+    for (int c = 1; c < COL_NCOLS; c++)
+        hdr.off[c] = col_align(hdr.off[c - 1] + hdr.len[c - 1]);
+
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", col_file);
+    out_fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (out_fd == -1) {
+        printf(M_ERR_COL_WRITE, col_file);
+        goto done;
+    }
+
+    for (int c = 0; c < COL_NCOLS; c++) {
+        ex->w[c].fd = out_fd;
+        ex->w[c].pos = hdr.off[c];
+    }
+    // both name index blocks start with the offset of the first name
+    col_put(&ex->w[COL_FNAME_IDX], &ex->fname_end, sizeof(uint32_t));
+    col_put(&ex->w[COL_LNAME_IDX], &ex->lname_end, sizeof(uint32_t));
+
+    int count2 = scan_db(fds, nfds, slots_per_fd, batch, export_row, ex, &fbytes2, &lbytes2);
+    if (count2 != count || fbytes2 != fbytes || lbytes2 != lbytes) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    for (int c = 0; c < COL_NCOLS; c++) {
+        if (col_flush(&ex->w[c]) != NO_ERROR) {
+            printf(M_ERR_COL_WRITE, col_file);
+            goto done;
+        }
+    }
+    if (pwrite(out_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        ftruncate(out_fd, (off_t)(hdr.off[COL_LNAME] + hdr.len[COL_LNAME])) == -1 ||
+        close(out_fd) == -1) {
+        out_fd = -1;
+        printf(M_ERR_COL_WRITE, col_file);
+        goto done;
+    }
+    out_fd = -1;
+
+    if (rename(tmp_file, col_file) == -1) {
+        printf(M_ERR_COL_WRITE, col_file);
+        goto done;
+    }
+
+    printf(M_COL_EXPORTED, count, col_file);
+    rc = count;
+
+done:
+    if (out_fd != -1) {
+        close(out_fd);
+        unlink(tmp_file);
+    }
+    free(batch);
+    free(ex);
+    return rc;
+}
+
+/*
+ *  col_open
+ *      cf:        reader view to fill in
+ *      col_file:  path of a snapshot written by export_columns()
+ *
+ *  Maps the snapshot read only and checks that every block lies inside the
+ *  file.  Pages are only read when a column is touched, so a consumer that
+ *  only looks at gpa[] never reads the name blocks.
+ *
+ *  returns:  NO_ERROR       snapshot mapped into cf
+ *            ERR_DB_FILE    file missing, unreadable or not a snapshot
+ */
+int col_open(col_file_t *cf, const char *col_file)
+{
+    struct stat st;
+    int fd;
+
+    memset(cf, 0, sizeof(*cf));
+    fd = open(col_file, O_RDONLY);
+    if (fd == -1)
+        return ERR_DB_FILE;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(col_hdr_t)) {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    cf->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cf->map == MAP_FAILED) {
+        cf->map = NULL;
+        return ERR_DB_FILE;
+    }
+    cf->map_len = (size_t)st.st_size;
+    cf->hdr = (const col_hdr_t *)cf->map;
+
+    const col_hdr_t *h = cf->hdr;
+    bool ok = memcmp(h->magic, COL_MAGIC, sizeof(COL_MAGIC)) == 0 &&
+              h->version == COL_VERSION &&
+              h->len[COL_ID] == (uint64_t)h->nrecs * sizeof(int32_t) &&
+              h->len[COL_GPA] == (uint64_t)h->nrecs * sizeof(int32_t) &&
+              h->len[COL_FNAME_IDX] == ((uint64_t)h->nrecs + 1) * sizeof(uint32_t) &&
+              h->len[COL_LNAME_IDX] == ((uint64_t)h->nrecs + 1) * sizeof(uint32_t);
+    for (int c = 0; ok && c < COL_NCOLS; c++)
+        ok = h->off[c] % COL_ALIGN == 0 && h->off[c] + h->len[c] <= cf->map_len;
+    if (!ok) {
+        col_close(cf);
+        return ERR_DB_FILE;
+    }
+
+    const char *base = (const char *)cf->map;
+    cf->nrecs = h->nrecs;
+    cf->id = (const int32_t *)(base + h->off[COL_ID]);
+    cf->gpa = (const int32_t *)(base + h->off[COL_GPA]);
+    cf->fname_idx = (const uint32_t *)(base + h->off[COL_FNAME_IDX]);
+    cf->fname = base + h->off[COL_FNAME];
+    cf->lname_idx = (const uint32_t *)(base + h->off[COL_LNAME_IDX]);
+    cf->lname = base + h->off[COL_LNAME];
+    return NO_ERROR;
+}
+
+/*
+ *  col_close
+ *      cf:  reader view returned by col_open()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void col_close(col_file_t *cf)
+{
+    if (cf->map != NULL)
+        munmap(cf->map, cf->map_len);
+    memset(cf, 0, sizeof(*cf));
+}
+
+/*
+ *  col_fname / col_lname
+ *      cf:   reader view
+ *      row:  row number, 0 .. nrecs - 1
+ *      len:  receives the length of the name
+ *
+ *  returns:  pointer to the name bytes inside the mapping, not null
+ *            terminated
+ */
+const char *col_fname(const col_file_t *cf, uint32_t row, size_t *len)
+{
+    *len = cf->fname_idx[row + 1] - cf->fname_idx[row];
+    return cf->fname + cf->fname_idx[row];
+}
+
+const char *col_lname(const col_file_t *cf, uint32_t row, size_t *len)
+{
+    *len = cf->lname_idx[row + 1] - cf->lname_idx[row];
+    return cf->lname + cf->lname_idx[row];
+}
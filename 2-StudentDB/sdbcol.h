@@ -0,0 +1,68 @@
+#ifndef __SDBCOL_H__
+    #define __SDBCOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h" //get student record type
+
+//Columnar snapshot of the student table for analytics.  Layout:
+//
+//      col_hdr_t
+//      id[n]               int32_t
+//      gpa[n]              int32_t, same integer encoding as student_t
+//      fname_idx[n + 1]    uint32_t, name i is fname[fname_idx[i]..fname_idx[i+1])
+//      fname[]             name bytes, not null terminated
+//      lname_idx[n + 1]    uint32_t
+//      lname[]             name bytes
+//
+//Every block starts on a COL_ALIGN boundary and its file offset is stored
+//in the header, so a consumer can mmap only the columns it needs.  Rows are
+//in id order.  All values are in host byte order.
+#define COL_MAGIC       "SDBCOL1"
+#define COL_VERSION     1
+#define COL_ALIGN       64
+#define COL_BUFF_SZ     (1024*64)   //write buffer per column while exporting
+
+//column blocks, index into col_hdr_t.off[] and col_hdr_t.len[]
+typedef enum {
+    COL_ID,
+    COL_GPA,
+    COL_FNAME_IDX,
+    COL_FNAME,
+    COL_LNAME_IDX,
+    COL_LNAME,
+    COL_NCOLS
+} col_block_t;
+
+typedef struct col_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nrecs;
+    uint64_t off[COL_NCOLS];            //file offset of each block
+    uint64_t len[COL_NCOLS];            //size in bytes of each block
+} col_hdr_t;
+
+//reader view of a mapped columnar file
+typedef struct col_file {
+    void            *map;
+    size_t          map_len;
+    const col_hdr_t *hdr;
+    uint32_t        nrecs;
+    const int32_t   *id;
+    const int32_t   *gpa;
+    const uint32_t  *fname_idx;
+    const char      *fname;
+    const uint32_t  *lname_idx;
+    const char      *lname;
+} col_file_t;
+
+//prototypes for the columnar export and reader, see sdbcol.c
+int export_columns(int fd, const char *col_file);
+int export_columns_ranges(const int fds[], int nfds, int slots_per_fd, const char *col_file);
+int col_open(col_file_t *cf, const char *col_file);
+void col_close(col_file_t *cf);
+const char *col_fname(const col_file_t *cf, uint32_t row, size_t *len);
+const char *col_lname(const col_file_t *cf, uint32_t row, size_t *len);
+
+#endif
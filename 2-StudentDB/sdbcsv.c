@@ -0,0 +1,217 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbcsv.h"
+
+/*
+ *  delim_mask64
+ *      p:  64 readable bytes
+ *
+ *  returns:  bit i set when p[i] is a ',' or a '\n'
+ */
+static inline uint64_t delim_mask64(const char *p)
+{
+    uint64_t mask = 0;
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, nl));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(hit) << (16 * i);
+    }
+#else
+    for (int i = 0; i < 64; i++) {
+        if (p[i] == ',' || p[i] == '\n')
+            mask |= (uint64_t)1 << i;
+    }
+#endif
+    return mask;
+}
+
+/*
+ *  trim_field
+ *      f, len:  field span, adjusted in place
+ *
+ *  Drops surrounding blanks, a trailing '\r' and one pair of double quotes.
+ */
+static void trim_field(const char **f, size_t *len)
+{
+    const char *s = *f;
+    size_t n = *len;
+
+    while (n > 0 && (s[n - 1] == '\r' || s[n - 1] == ' ' || s[n - 1] == '\t'))
+        n--;
+    while (n > 0 && (*s == ' ' || *s == '\t')) {
+        s++;
+        n--;
+    }
+    if (n >= 2 && s[0] == '"' && s[n - 1] == '"') {
+        s++;
+        n -= 2;
+    }
+    *f = s;
+    *len = n;
+}
+
+/*
+ *  parse_uint
+ *      f, len:  field span
+ *      out:     parsed value
+ *
+ *  returns:  true if the field is 1 to 9 decimal digits
+ */
+static bool parse_uint(const char *f, size_t len, int *out)
+{
+    int v = 0;
+
+    if (len == 0 || len > 9)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned d = (unsigned char)f[i] - '0';
+        if (d > 9)
+            return false;
+        v = v * 10 + (int)d;
+    }
+    *out = v;
+    return true;
+}
+
+/*
+ *  parse_gpa
+ *      f, len:  field span, either "345" or "3.45" / "3.4" / "3."
+ *      out:     gpa as the stored integer (gpa * 100 for the decimal form)
+ *
+ *  returns:  true if the field is a valid number
+ */
+static bool parse_gpa(const char *f, size_t len, int *out)
+{
+    const char *dot = memchr(f, '.', len);
+    int whole, frac = 0;
+
+    if (dot == NULL)
+        return parse_uint(f, len, out);
+
+    size_t wlen = (size_t)(dot - f);
+    size_t flen = len - wlen - 1;
+    if (!parse_uint(f, wlen, &whole) || flen > 2)
+        return false;
+    if (flen > 0 && !parse_uint(dot + 1, flen, &frac))
+        return false;
+    if (flen == 1)
+        frac *= 10;
+    *out = whole * 100 + frac;
+    return true;
+}
+
+/*
+ *  emit_row
+ *      f, len:   the field spans of one line
+ *      nf:       number of fields found on the line
+ *      line_no:  1 based line number
+ *
+ *  Converts one line to a student_t and hands it to the callback.  Blank
+ *  lines are ignored.  A first line that does not start with a number is
+ *  taken as the header and ignored.
+ *
+ *  returns:  1 if a data line was reported, 0 if the line was ignored
+ */
+static int emit_row(const char **f, size_t *len, int nf, int line_no,
+                    csv_row_fn fn, void *arg)
+{
+    student_t s = {0};
+    int id, gpa;
+
+    for (int i = 0; i < nf && i < CSV_FIELDS; i++)
+        trim_field(&f[i], &len[i]);
+
+    if (nf == 1 && len[0] == 0)
+        return 0;
+
+    if (nf != CSV_FIELDS || !parse_uint(f[0], len[0], &id) ||
+        !parse_gpa(f[3], len[3], &gpa) || len[1] == 0 || len[2] == 0) {
+        if (line_no == 1 && nf >= 1 && (len[0] == 0 || f[0][0] < '0' || f[0][0] > '9'))
+            return 0;
+        fn(arg, NULL, line_no);
+        return 1;
+    }
+
+    s.id = id;
+    s.gpa = gpa;
+    memcpy(s.fname, f[1], len[1] < sizeof(s.fname) - 1 ? len[1] : sizeof(s.fname) - 1);
+    memcpy(s.lname, f[2], len[2] < sizeof(s.lname) - 1 ? len[2] : sizeof(s.lname) - 1);
+    fn(arg, &s, line_no);
+    return 1;
+}
+
+/*
+ *  csv_parse
+ *      buf, len:  the CSV text, does not need to be null terminated
+ *      fn:        called once per data line
+ *      arg:       passed through to fn
+ *
+ *  Single pass over the text.  Every 64 byte block is turned into a bit mask
+ *  of delimiter positions with delim_mask64() and the set bits are walked
+ *  with count-trailing-zeros, so the bytes inside fields are never looked at
+ *  one by one.  Fields are not copied until the line is converted.
+ *
+ *  returns:  number of data lines reported to fn
+ */
+int csv_parse(const char *buf, size_t len, csv_row_fn fn, void *arg)
+{
+    const char *f[CSV_FIELDS];
+    size_t flen[CSV_FIELDS];
+    char tail[64];
+    size_t field_start = 0;
+    int nf = 0;
+    int line_no = 1;
+    int rows = 0;
+
+    for (size_t blk = 0; blk < len; blk += 64) {
+        uint64_t mask;
+
+        if (len - blk >= 64) {
+            mask = delim_mask64(buf + blk);
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, buf + blk, len - blk);
+            mask = delim_mask64(tail);
+        }
+
+        while (mask != 0) {
+            size_t at = blk + (size_t)__builtin_ctzll(mask);
+            mask &= mask - 1;
+
+            if (nf < CSV_FIELDS) {
+                f[nf] = buf + field_start;
+                flen[nf] = at - field_start;
+            }
+            nf++;
+            field_start = at + 1;
+
+            if (buf[at] == '\n') {
+                rows += emit_row(f, flen, nf, line_no, fn, arg);
+                nf = 0;
+                line_no++;
+            }
+        }
+    }
+
+    // last line without a trailing newline
+    if (field_start < len || nf > 0) {
+        if (nf < CSV_FIELDS) {
+            f[nf] = buf + field_start;
+            flen[nf] = len - field_start;
+        }
+        nf++;
+        rows += emit_row(f, flen, nf, line_no, fn, arg);
+    }
+    return rows;
+}
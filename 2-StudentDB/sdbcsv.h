@@ -0,0 +1,30 @@
+#ifndef __SDBCSV_H__
+    #define __SDBCSV_H__
+
+#include <stddef.h>
+
+#include "db.h" //get student record type
+
+//Bulk CSV import.  Each line is id,fname,lname,gpa where gpa is either the
+//3 digit integer used by -a (345) or a decimal with up to 2 places (3.45).
+//An optional header line is skipped.  The delimiter/newline scanner looks
+//at 64 bytes per step using SSE2 compares when the compiler targets it.
+#define CSV_FIELDS      4
+#define CSV_CHUNK_SLOTS 1024        //records per pwrite() when writing back
+
+//called for every data line, s is NULL if the line could not be parsed
+typedef void (*csv_row_fn)(void *arg, const student_t *s, int line_no);
+
+//state of an import while rows are applied to the in memory table, see
+//import_csv() in sdbsc.c
+typedef struct csv_import {
+    student_t   *tbl;               //whole table, slot = id - 1
+    unsigned char *dirty;           //one flag per CSV_CHUNK_SLOTS slots
+    int         imported;
+    int         rejected;
+} csv_import_t;
+
+//prototypes for the parser, see sdbcsv.c for documentation
+int csv_parse(const char *buf, size_t len, csv_row_fn fn, void *arg);
+
+#endif
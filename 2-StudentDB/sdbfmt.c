@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbfmt.h"
+
+//column widths taken from STUDENT_PRINT_FMT_STRING "%-6d %-24.24s %-32.32s %-3.2f\n"
+#define COL_ID_W        6
+#define COL_FNAME_W     24
+#define COL_LNAME_W     32
+
+//gpa values whose magnitude is at most this are formatted by hand.  Inside
+//this range gpa/100.0 stored in a float is always close enough to the exact
+//decimal value that %.2f rounds back to the same two digits.  Anything larger
+//can only come from a corrupt record, so it falls back to snprintf().
+#define FAST_GPA_LIMIT  99999
+
+/*
+ *  put_padded
+ *      dst:    where to copy to
+ *      str:    source string, may not be null terminated
+ *      max:    maximum number of characters to take from str (the precision)
+ *      width:  minimum field width, padded on the right with spaces
+ *
+ *  Equivalent of the %-<width>.<max>s conversion.
+ *
+ *  returns:  pointer just past the last byte written
+ */
+static char *put_padded(char *dst, const char *str, size_t max, size_t width)
+{
+    size_t n = strnlen(str, max);
+
+    memcpy(dst, str, n);
+    if (n < width) {
+        memset(dst + n, ' ', width - n);
+        n = width;
+    }
+    return dst + n;
+}
+
+/*
+ *  put_int
+ *      dst:    where to write the digits
+ *      val:    value to format
+ *
+ *  Equivalent of the %d conversion.
+ *
+ *  returns:  pointer just past the last byte written
+ */
+static char *put_int(char *dst, int val)
+{
+    char digits[12];
+    int  n = 0;
+    unsigned int u = (val < 0) ? 0u - (unsigned int)val : (unsigned int)val;
+
+    do {
+        digits[n++] = (char)('0' + (u % 10));
+        u /= 10;
+    } while (u != 0);
+
+    if (val < 0)
+        *dst++ = '-';
+    while (n > 0)
+        *dst++ = digits[--n];
+    return dst;
+}
+
+/*
+ *  fmt_student_row
+ *      dst:  buffer of at least STUDENT_ROW_MAX bytes
+ *      s:    student to format
+ *
+ *  Formats one student exactly like
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname,
+ *                    s->gpa / 100.0);
+ *
+ *  The output is not null terminated.
+ *
+ *  returns:  number of bytes written to dst
+ */
+size_t fmt_student_row(char *dst, const student_t *s)
+{
+    char *p = dst;
+    char *id_start = p;
+    int  gpa = s->gpa;
+
+    if (gpa > FAST_GPA_LIMIT || gpa < -FAST_GPA_LIMIT) {
+        float fgpa = s->gpa / 100.0;
+        return (size_t)snprintf(dst, STUDENT_ROW_MAX, STUDENT_PRINT_FMT_STRING,
+                                s->id, s->fname, s->lname, fgpa);
+    }
+
+    p = put_int(p, s->id);
+    if (p - id_start < COL_ID_W) {
+        memset(p, ' ', COL_ID_W - (p - id_start));
+        p = id_start + COL_ID_W;
+    }
+    *p++ = ' ';
+    p = put_padded(p, s->fname, COL_FNAME_W, COL_FNAME_W);
+    *p++ = ' ';
+    p = put_padded(p, s->lname, COL_LNAME_W, COL_LNAME_W);
+    *p++ = ' ';
+
+    // fixed 2 decimals, always at least 4 characters so the width of 3
+    // never adds padding
+    if (gpa < 0) {
+        *p++ = '-';
+        gpa = -gpa;
+    }
+    p = put_int(p, gpa / 100);
+    *p++ = '.';
+    *p++ = (char)('0' + (gpa % 100) / 10);
+    *p++ = (char)('0' + gpa % 10);
+    *p++ = '\n';
+
+    return (size_t)(p - dst);
+}
+
+/*
+ *  fmt_student_hdr
+ *      dst:  buffer of at least STUDENT_ROW_MAX bytes
+ *
+ *  Formats the table header exactly like
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+ *
+ *  returns:  number of bytes written to dst
+ */
+size_t fmt_student_hdr(char *dst)
+{
+    char *p = dst;
+
+    p = put_padded(p, "ID", COL_ID_W, COL_ID_W);
+    *p++ = ' ';
+    p = put_padded(p, "FIRST_NAME", COL_FNAME_W, COL_FNAME_W);
+    *p++ = ' ';
+    p = put_padded(p, "LAST_NAME", COL_LNAME_W, COL_LNAME_W);
+    *p++ = ' ';
+    p = put_padded(p, "GPA", 3, 3);
+    *p++ = '\n';
+
+    return (size_t)(p - dst);
+}
+
+/*
+ *  ob_init
+ *      ob:   output buffer to initialize
+ *      fd:   file descriptor the buffer is flushed to
+ *
+ *  Because the buffer bypasses stdio, anything already sitting in the stdout
+ *  buffer is flushed first so the output stays in order.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void ob_init(out_buff_t *ob, int fd)
+{
+    fflush(stdout);
+    ob->fd = fd;
+    ob->len = 0;
+}
+
+/*
+ *  ob_flush
+ *      ob:   output buffer to flush
+ *
+ *  Writes all buffered bytes to ob->fd, retrying on short writes.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the write() failed
+ */
+int ob_flush(out_buff_t *ob)
+{
+    size_t off = 0;
+
+    while (off < ob->len) {
+        ssize_t n = write(ob->fd, ob->buf + off, ob->len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ob->len = 0;
+            return ERR_DB_FILE;
+        }
+        off += (size_t)n;
+    }
+    ob->len = 0;
+    return NO_ERROR;
+}
+
+/*
+ *  ob_write_student
+ *      ob:   output buffer
+ *      s:    student to append
+ *
+ *  Appends one formatted row, flushing first if the row might not fit.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a flush failed
+ */
+int ob_write_student(out_buff_t *ob, const student_t *s)
+{
+    if (OUT_BUFF_SZ - ob->len < STUDENT_ROW_MAX) {
+        if (ob_flush(ob) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    ob->len += fmt_student_row(ob->buf + ob->len, s);
+    return NO_ERROR;
+}
+
+/*
+ *  ob_write_hdr
+ *      ob:   output buffer
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a flush failed
+ */
+int ob_write_hdr(out_buff_t *ob)
+{
+    if (OUT_BUFF_SZ - ob->len < STUDENT_ROW_MAX) {
+        if (ob_flush(ob) != NO_ERROR)
+            return ERR_DB_FILE;
+    }
+    ob->len += fmt_student_hdr(ob->buf + ob->len);
+    return NO_ERROR;
+}
+
+/*
+ *  ob_write_str
+ *      ob:   output buffer
+ *      str:  null terminated string to append
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a flush failed
+ */
+int ob_write_str(out_buff_t *ob, const char *str)
+{
+    return ob_write_mem(ob, str, strlen(str));
+}
+
+/*
+ *  ob_write_mem
+ *      ob:    output buffer
+ *      data:  bytes to append
+ *      n:     number of bytes
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a flush failed
+ */
+int ob_write_mem(out_buff_t *ob, const char *data, size_t n)
+{
+    while (n > 0) {
+        size_t room = OUT_BUFF_SZ - ob->len;
+        if (room == 0) {
+            if (ob_flush(ob) != NO_ERROR)
+                return ERR_DB_FILE;
+            continue;
+        }
+        if (room > n)
+            room = n;
+        memcpy(ob->buf + ob->len, data, room);
+        ob->len += room;
+        data += room;
+        n -= room;
+    }
+    return NO_ERROR;
+}
@@ -0,0 +1,32 @@
+#ifndef __SDBFMT_H__
+    #define __SDBFMT_H__
+
+#include <stddef.h>
+
+#include "db.h" //get student record type
+
+//Specialized writer for student rows.  It produces exactly the same bytes as
+//printf(STUDENT_PRINT_FMT_STRING, ...) but formats the integer id and the
+//fixed 2 decimal gpa by hand and copies the padded name columns directly into
+//a large output buffer that is flushed with write().  This avoids the printf
+//format interpreter and the float conversion for every row of print_db().
+#define OUT_BUFF_SZ         (1024*64)   //64K output buffer
+#define STUDENT_ROW_MAX     128         //longest possible formatted row
+
+typedef struct out_buff {
+    int     fd;                         //where flushed bytes go
+    size_t  len;                        //bytes currently buffered
+    char    buf[OUT_BUFF_SZ];
+} out_buff_t;
+
+//prototypes for the formatter, see sdbfmt.c for documentation
+size_t fmt_student_row(char *dst, const student_t *s);
+size_t fmt_student_hdr(char *dst);
+void ob_init(out_buff_t *ob, int fd);
+int ob_flush(out_buff_t *ob);
+int ob_write_student(out_buff_t *ob, const student_t *s);
+int ob_write_hdr(out_buff_t *ob);
+int ob_write_str(out_buff_t *ob, const char *str);
+int ob_write_mem(out_buff_t *ob, const char *data, size_t n);
+
+#endif
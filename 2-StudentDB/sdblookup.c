@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdblookup.h"
+
+/*
+ *  lookup_open
+ *      db_fd:   linux file descriptor of the database file
+ *      svc:     service to set up
+ *
+ *  Maps private memory for MAX_STD_ID slots and loads the database file into
+ *  it.  The descriptor is kept for lookup_reload(), the caller still owns it.
+ *
+ *  returns:  <number>       number of student records loaded
+ *            ERR_DB_FILE    database file could not be read or no memory
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ *            M_ERR_LOOKUP   error allocating the table
+ */
+int lookup_open(int db_fd, lookup_svc_t *svc)
+{
+    size_t len = tbl_map_size(MAX_STD_ID);
+    void *mem;
+    int count;
+
+    // anonymous memory comes back zeroed, every slot starts out empty
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        printf(M_ERR_LOOKUP);
+        return ERR_DB_FILE;
+    }
+
+    svc->tbl.fd = -1;
+    tbl_bind(&svc->tbl, mem, MAX_STD_ID);
+    svc->tbl.hdr->magic = SHM_DB_MAGIC;
+    svc->tbl.hdr->version = SHM_DB_VERSION;
+    svc->tbl.hdr->nslots = MAX_STD_ID;
+    svc->tbl.hdr->rec_size = STUDENT_RECORD_SIZE;
+    svc->db_fd = db_fd;
+    pthread_mutex_init(&svc->wlock, NULL);
+
+    count = tbl_load_db(&svc->tbl, db_fd);
+    if (count < 0) {
+        printf(M_ERR_DB_READ);
+        lookup_close(svc);
+        return ERR_DB_FILE;
+    }
+    return count;
+}
+
+/*
+ *  lookup_close
+ *      svc:     service returned by lookup_open()
+ *
+ *  No reader or writer may be using the service any more.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void lookup_close(lookup_svc_t *svc)
+{
+    if (svc->tbl.hdr != NULL)
+        munmap(svc->tbl.hdr, svc->tbl.map_len);
+    svc->tbl.hdr = NULL;
+    pthread_mutex_destroy(&svc->wlock);
+}
+
+/*
+ *  lookup_get
+ *      svc:     service returned by lookup_open()
+ *      id:      the student id we are looking for
+ *      *s:      where the located student is copied
+ *
+ *  Reader path, safe to call from any number of threads at once.  Never
+ *  takes a lock, a copy torn by a concurrent publish of the same slot is
+ *  simply made again.  If a publish holds the slot for longer than the
+ *  table lets a reader wait, the record is read from the database file
+ *  (pread() does not share a file offset between threads).
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            SRCH_NOT_FOUND id out of range or slot empty
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int lookup_get(const lookup_svc_t *svc, int id, student_t *s)
+{
+    int rc = tbl_get_student(&svc->tbl, id, s);
+
+    if (rc != ERR_DB_FILE)
+        return rc;
+
+    ssize_t n = pread(svc->db_fd, s, STUDENT_RECORD_SIZE, (off_t)(id - 1) * STUDENT_RECORD_SIZE);
+    if (n == -1)
+        return ERR_DB_FILE;
+    if (n != STUDENT_RECORD_SIZE || s->id != id)
+        return SRCH_NOT_FOUND;
+    return NO_ERROR;
+}
+
+/*
+ *  lookup_publish
+ *      svc:     service returned by lookup_open()
+ *      id:      student id that changed in the database file
+ *      *s:      new contents of the record, EMPTY_STUDENT_RECORD after a delete
+ *
+ *  Writer path.  Makes a change that is already in the database file
+ *  visible to readers.
+ *
+ *  returns:  NO_ERROR       change published
+ *            ERR_DB_OP      id out of range
+ */
+int lookup_publish(lookup_svc_t *svc, int id, const student_t *s)
+{
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return ERR_DB_OP;
+
+    pthread_mutex_lock(&svc->wlock);
+    tbl_put_student(&svc->tbl, id, s);
+    pthread_mutex_unlock(&svc->wlock);
+    return NO_ERROR;
+}
+
+/*
+ *  lookup_reload
+ *      svc:     service returned by lookup_open()
+ *
+ *  Writer path for changes that rewrite the whole table (-x, -I, -R ...).
+ *  Only slots that differ from the database file are republished, readers
+ *  keep getting answers while it runs.
+ *
+ *  returns:  <number>       number of student records in the table
+ *            ERR_DB_FILE    database file could not be read
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ */
+int lookup_reload(lookup_svc_t *svc)
+{
+    int count;
+
+    pthread_mutex_lock(&svc->wlock);
+    count = tbl_load_db(&svc->tbl, svc->db_fd);
+    pthread_mutex_unlock(&svc->wlock);
+
+    if (count < 0) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    return count;
+}
@@ -0,0 +1,32 @@
+#ifndef __SDBLOOKUP_H__
+    #define __SDBLOOKUP_H__
+
+#include <pthread.h>
+
+#include "db.h"     //get student record type
+#include "sdbshm.h" //seqlock protected student table
+
+//In process lookup service for multi-threaded frontends.  The whole table is
+//loaded once into private memory with the same layout as the shared memory
+//copy (sdbshm.h), and lookups by id go through the lock free reader side of
+//its seqlock: no system call, no lock and no store to shared memory, so any
+//number of reader threads can run without touching each other's cache lines.
+//
+//Writers are serialized with a mutex that readers never take.  A writer
+//changes the database file first (add_student() etc.) and then publishes the
+//new record with lookup_publish(), a reader that races the publish retries
+//its copy of that one slot and never waits on the mutex.
+typedef struct lookup_svc {
+    stu_table_t     tbl;                //private copy of the table
+    int             db_fd;              //database the table was loaded from
+    pthread_mutex_t wlock;              //one writer at a time
+} lookup_svc_t;
+
+//prototypes for the lookup service, see sdblookup.c for documentation
+int lookup_open(int db_fd, lookup_svc_t *svc);
+void lookup_close(lookup_svc_t *svc);
+int lookup_get(const lookup_svc_t *svc, int id, student_t *s);
+int lookup_publish(lookup_svc_t *svc, int id, const student_t *s);
+int lookup_reload(lookup_svc_t *svc);
+
+#endif
@@ -0,0 +1,606 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshm.h"
+#include "sdbpgen.h"
+#include "sdbcache.h"
+#include "sdbshard.h"
+#include "sdbrepl.h"
+
+#define PGEN_GENS_OFF   sizeof(pgen_hdr_t)      //generation array in the sidecar
+#define BK_TMP_FILE     ".backup.tmp"
+
+//sidecar used by pgen_mark(), opened on the first call
+static int pgen_fd = -1;
+static int pgen_state = 0;  //0 = not tried yet, 1 = open, -1 = failed
+
+static uint64_t pgen_new_lineage(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
+static size_t pgen_align(size_t off)
+{
+    return (off + PGEN_PAGE_SIZE - 1) & ~(size_t)(PGEN_PAGE_SIZE - 1);
+}
+
+/*
+ *  pgen_init_file
+ *      fd:       open sidecar, locked exclusively by the caller
+ *      lineage:  history the generations belong to
+ *      epoch:    first epoch to stamp pages with
+ *
+ *  Rewrites the sidecar with every page at generation 0.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    sidecar I/O issue
+ */
+static int pgen_init_file(int fd, uint64_t lineage, uint64_t epoch)
+{
+    pgen_hdr_t hdr = {0};
+
+    memcpy(hdr.magic, PGEN_MAGIC, sizeof(PGEN_MAGIC));
+    hdr.lineage = lineage;
+    hdr.epoch = epoch;
+    hdr.page_size = PGEN_PAGE_SIZE;
+    hdr.npages = PGEN_NPAGES;
+
+    if (ftruncate(fd, 0) == -1 ||
+        ftruncate(fd, (off_t)(PGEN_GENS_OFF + PGEN_NPAGES * sizeof(uint64_t))) == -1 ||
+        pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  pgen_open
+ *
+ *  Opens the sidecar, creating it with a new lineage when it is missing or
+ *  not usable.  A new lineage makes the next backup in every directory a
+ *  full one, because the pages changed before it existed are unknown.
+ *
+ *  returns:  <fd>   file descriptor of the sidecar
+ *            -1     sidecar cannot be opened or created
+ */
+static int pgen_open(void)
+{
+    pgen_hdr_t hdr;
+    int fd;
+
+    fd = open(DB_PGEN_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+        return -1;
+    if (flock(fd, LOCK_EX) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, PGEN_MAGIC, sizeof(PGEN_MAGIC)) != 0 ||
+        hdr.page_size != PGEN_PAGE_SIZE || hdr.npages != PGEN_NPAGES) {
+        if (pgen_init_file(fd, pgen_new_lineage(), 1) != NO_ERROR) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    flock(fd, LOCK_UN);
+    return fd;
+}
+
+/*
+ *  pgen_mark
+ *      off:  offset of the first byte written to the database file
+ *      len:  number of bytes written
+ *
+ *  Stamps every page touched by the write with the current epoch.  It must
+ *  be called after the database write.  The epoch is read under a shared
+ *  lock for every call, a concurrent backup holds the lock exclusively, so
+ *  a change is either seen by that backup or stamped with the epoch after
+ *  it and picked up by the next one.
+ *
+ *  returns:  NO_ERROR       pages stamped
+ *            ERR_DB_FILE    sidecar I/O issue
+ */
+int pgen_mark(off_t off, size_t len)
+{
+    static uint64_t gens[PGEN_NPAGES];
+    uint64_t epoch;
+    size_t first, last;
+    int rc = NO_ERROR;
+
+    if (pgen_state == 0) {
+        pgen_fd = pgen_open();
+        pgen_state = (pgen_fd == -1) ? -1 : 1;
+    }
+    if (pgen_state < 0)
+        return ERR_DB_FILE;
+
+    if (len == 0 || off < 0)
+        return NO_ERROR;
+    first = (size_t)off / PGEN_PAGE_SIZE;
+    last = ((size_t)off + len - 1) / PGEN_PAGE_SIZE;
+    if (last >= PGEN_NPAGES)
+        last = PGEN_NPAGES - 1;
+    if (first > last)
+        return NO_ERROR;
+
+    if (flock(pgen_fd, LOCK_SH) == -1)
+        return ERR_DB_FILE;
+    if (pread(pgen_fd, &epoch, sizeof(epoch), offsetof(pgen_hdr_t, epoch)) != (ssize_t)sizeof(epoch)) {
+        rc = ERR_DB_FILE;
+    } else {
+        size_t n = last - first + 1;
+        for (size_t i = 0; i < n; i++)
+            gens[i] = epoch;
+        if (pwrite(pgen_fd, gens, n * sizeof(uint64_t),
+                   (off_t)(PGEN_GENS_OFF + first * sizeof(uint64_t))) != (ssize_t)(n * sizeof(uint64_t)))
+            rc = ERR_DB_FILE;
+    }
+    flock(pgen_fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  bk_last_seq
+ *      dir:  backup directory
+ *
+ *  returns:  highest sequence number of a backup file in dir, 0 if there
+ *            is none
+ */
+static unsigned bk_last_seq(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    unsigned last = 0;
+
+    if (d == NULL)
+        return 0;
+    while ((de = readdir(d)) != NULL) {
+        unsigned seq;
+        int end = 0;
+        if (sscanf(de->d_name, "backup-%6u.sdbbk%n", &seq, &end) == 1 &&
+            de->d_name[end] == '\0' && end > 0 && seq > last)
+            last = seq;
+    }
+    closedir(d);
+    return last;
+}
+
+/*
+ *  bk_open
+ *      dir:  backup directory
+ *      seq:  sequence number of the backup
+ *      hdr:  receives the backup header
+ *
+ *  returns:  <fd>   backup file opened read only, header validated
+ *            -1     missing or not a backup file
+ */
+static int bk_open(const char *dir, unsigned seq, bk_hdr_t *hdr)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/" BK_FILE_FMT, dir, seq);
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (pread(fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+        memcmp(hdr->magic, BK_MAGIC, sizeof(BK_MAGIC)) != 0 ||
+        hdr->page_size != PGEN_PAGE_SIZE || hdr->seq != seq) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool page_is_zero(const char *page)
+{
+    return page[0] == 0 && memcmp(page, page + 1, PGEN_PAGE_SIZE - 1) == 0;
+}
+
+/*
+ *  ranges_pread / ranges_pwrite
+ *      fds, nfds, slots_per_fd:  database files, see shard_range_fd()
+ *      buf:                      data to read or write
+ *      len:                      number of bytes
+ *      off:                      byte offset in the database layout
+ *
+ *  Reads or writes len bytes, every part through the file whose range it
+ *  falls in.  Bytes past the end of a file read as zero.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int ranges_pread(const int fds[], int nfds, int slots_per_fd, char *buf, size_t len, uint64_t off)
+{
+    while (len > 0) {
+        uint64_t end;
+        int i = shard_range_fd(nfds, slots_per_fd, off, &end);
+        size_t n = (end - off < len) ? (size_t)(end - off) : len;
+        ssize_t got = pread(fds[i], buf, n, (off_t)off);
+        if (got == -1)
+            return ERR_DB_FILE;
+        memset(buf + got, 0, n - (size_t)got);
+        buf += n;
+        off += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+static int ranges_pwrite(const int fds[], int nfds, int slots_per_fd, const char *buf, size_t len, uint64_t off)
+{
+    while (len > 0) {
+        uint64_t end;
+        int i = shard_range_fd(nfds, slots_per_fd, off, &end);
+        size_t n = (end - off < len) ? (size_t)(end - off) : len;
+        if (pwrite(fds[i], buf, n, (off_t)off) != (ssize_t)n)
+            return ERR_DB_FILE;
+        buf += n;
+        off += n;
+        len -= n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  backup_db
+ *      fd:   linux file descriptor of the database
+ *      dir:  backup directory, created if it does not exist
+ *
+ *  Appends the next backup to the chain in dir.  When dir has no backup of
+ *  the current lineage yet every page is written, otherwise only the pages
+ *  stamped after the epoch of the last backup in dir.  Each page costs one
+ *  pread() from the database, pages of zeros only take an index entry.
+ *  The file is written under a temporary name and renamed when complete,
+ *  then the sidecar moves on to the next epoch.
+ *
+ *  returns:  <number>       number of pages in the backup
+ *            ERR_DB_FILE    database, sidecar or backup I/O issue
+ *
+ *  console:  M_BACKUP_FULL    on success, first backup of a chain
+ *            M_BACKUP_INCR    on success, incremental backup
+ *            M_ERR_BACKUP     backup could not be written
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int backup_db(int fd, const char *dir)
+{
+    return backup_db_ranges(&fd, 1, MAX_STD_ID, dir);
+}
+
+/*
+ *  backup_db_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      dir:           backup directory, created if it does not exist
+ *
+ *  Same as backup_db() for a database split over several files, as a
+ *  sharded one is.  The files share one sidecar, every file only writes
+ *  inside its own range so a page offset still names one place in the
+ *  table.  A page that straddles two ranges is read from both files, the
+ *  backup looks exactly like one of the unsharded table.
+ *
+ *  returns:  same as backup_db()
+ *
+ *  console:  same as backup_db()
+ */
+int backup_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *dir)
+{
+    static char page[PGEN_PAGE_SIZE];
+    char tmp_path[PATH_MAX], path[PATH_MAX];
+    uint64_t *gens = NULL;
+    uint32_t *idx = NULL;
+    pgen_hdr_t ph;
+    bk_hdr_t last = {0}, bh = {0};
+    uint64_t db_size;
+    unsigned last_seq;
+    size_t np, n = 0, ndata = 0, data_off;
+    bool full;
+    int pfd, out_fd = -1, rc = ERR_DB_FILE;
+
+    if (mkdir(dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 && errno != EEXIST) {
+        printf(M_ERR_BACKUP, dir);
+        return ERR_DB_FILE;
+    }
+
+    pfd = pgen_open();
+    if (pfd == -1 || flock(pfd, LOCK_EX) == -1) {
+        printf(M_ERR_BACKUP, dir);
+        if (pfd != -1)
+            close(pfd);
+        return ERR_DB_FILE;
+    }
+
+    gens = malloc(PGEN_NPAGES * sizeof(uint64_t));
+    if (gens == NULL || shard_ranges_size(fds, nfds, slots_per_fd, &db_size) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+    np = ((size_t)db_size + PGEN_PAGE_SIZE - 1) / PGEN_PAGE_SIZE;
+    idx = malloc((np > 0 ? np : 1) * sizeof(uint32_t));
+    if (idx == NULL ||
+        pread(pfd, &ph, sizeof(ph), 0) != (ssize_t)sizeof(ph) ||
+        pread(pfd, gens, PGEN_NPAGES * sizeof(uint64_t), PGEN_GENS_OFF) !=
+            (ssize_t)(PGEN_NPAGES * sizeof(uint64_t))) {
+        printf(M_ERR_BACKUP, dir);
+        goto done;
+    }
+
+    last_seq = bk_last_seq(dir);
+    full = true;
+    if (last_seq > 0) {
+        int lfd = bk_open(dir, last_seq, &last);
+        if (lfd != -1) {
+            close(lfd);
+            full = last.lineage != ph.lineage || last.epoch >= ph.epoch;
+        }
+    }
+
+    // pages past the generation array cannot be tracked, always take them
+    for (size_t p = 0; p < np; p++) {
+        if (full || p >= PGEN_NPAGES || gens[p] > last.epoch)
+            idx[n++] = (uint32_t)p;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s/" BK_TMP_FILE, dir);
+    out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (out_fd == -1) {
+        printf(M_ERR_BACKUP, dir);
+        goto done;
+    }
+
+    data_off = pgen_align(sizeof(bk_hdr_t) + n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        if (ranges_pread(fds, nfds, slots_per_fd, page, PGEN_PAGE_SIZE,
+                         (uint64_t)idx[i] * PGEN_PAGE_SIZE) != NO_ERROR) {
+            printf(M_ERR_DB_READ);
+            goto done;
+        }
+        if (page_is_zero(page)) {
+            idx[i] |= BK_ZERO_PAGE;
+            continue;
+        }
+        if (pwrite(out_fd, page, PGEN_PAGE_SIZE, (off_t)(data_off + ndata * PGEN_PAGE_SIZE)) != PGEN_PAGE_SIZE) {
+            printf(M_ERR_BACKUP, dir);
+            goto done;
+        }
+        ndata++;
+    }
+
+    memcpy(bh.magic, BK_MAGIC, sizeof(BK_MAGIC));
+    bh.lineage = ph.lineage;
+    bh.epoch = ph.epoch;
+    bh.db_size = db_size;
+    bh.seq = last_seq + 1;
+    bh.full = full;
+    bh.npages = (uint32_t)n;
+    bh.page_size = PGEN_PAGE_SIZE;
+    if (pwrite(out_fd, idx, n * sizeof(uint32_t), sizeof(bh)) != (ssize_t)(n * sizeof(uint32_t)) ||
+        pwrite(out_fd, &bh, sizeof(bh), 0) != (ssize_t)sizeof(bh) ||
+        fsync(out_fd) == -1) {
+        printf(M_ERR_BACKUP, dir);
+        goto done;
+    }
+    close(out_fd);
+    out_fd = -1;
+
+    snprintf(path, sizeof(path), "%s/" BK_FILE_FMT, dir, bh.seq);
+    if (rename(tmp_path, path) == -1) {
+        printf(M_ERR_BACKUP, dir);
+        unlink(tmp_path);
+        goto done;
+    }
+
+    // later changes belong to the next backup
+    ph.epoch++;
+    if (pwrite(pfd, &ph.epoch, sizeof(ph.epoch), offsetof(pgen_hdr_t, epoch)) != (ssize_t)sizeof(ph.epoch)) {
+        printf(M_ERR_BACKUP, dir);
+        goto done;
+    }
+
+    if (full)
+        printf(M_BACKUP_FULL, bh.seq, (int)n, dir);
+    else
+        printf(M_BACKUP_INCR, bh.seq, (int)n, dir);
+    rc = (int)n;
+
+done:
+    if (out_fd != -1) {
+        close(out_fd);
+        unlink(tmp_path);
+    }
+    flock(pfd, LOCK_UN);
+    close(pfd);
+    free(gens);
+    free(idx);
+    return rc;
+}
+
+/*
+ *  bk_apply
+ *      fds, nfds, slots_per_fd:  database files, see shard_range_fd()
+ *      bfd:                      backup file, opened with bk_open()
+ *      bh:                       header of the backup
+ *
+ *  Writes the pages of one backup into the database and sizes the files to
+ *  the size the database had when the backup was taken.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or backup I/O issue
+ */
+static int bk_apply(const int fds[], int nfds, int slots_per_fd, int bfd, const bk_hdr_t *bh)
+{
+    static const char zeros[PGEN_PAGE_SIZE];
+    static char page[PGEN_PAGE_SIZE];
+    size_t data_off = pgen_align(sizeof(bk_hdr_t) + bh->npages * sizeof(uint32_t));
+    size_t ndata = 0;
+    uint32_t *idx;
+    int rc = ERR_DB_FILE;
+
+    idx = malloc((bh->npages > 0 ? bh->npages : 1) * sizeof(uint32_t));
+    if (idx == NULL ||
+        pread(bfd, idx, bh->npages * sizeof(uint32_t), sizeof(bk_hdr_t)) !=
+            (ssize_t)(bh->npages * sizeof(uint32_t)))
+        goto done;
+
+    for (uint32_t i = 0; i < bh->npages; i++) {
+        uint64_t off = (uint64_t)(idx[i] & ~BK_ZERO_PAGE) * PGEN_PAGE_SIZE;
+        const char *src = zeros;
+        size_t len;
+
+        if (!(idx[i] & BK_ZERO_PAGE)) {
+            if (pread(bfd, page, PGEN_PAGE_SIZE, (off_t)(data_off + ndata * PGEN_PAGE_SIZE)) != PGEN_PAGE_SIZE)
+                goto done;
+            ndata++;
+            src = page;
+        }
+        if (off >= bh->db_size)
+            continue;
+        len = (bh->db_size - off < PGEN_PAGE_SIZE) ? (size_t)(bh->db_size - off) : PGEN_PAGE_SIZE;
+        if (ranges_pwrite(fds, nfds, slots_per_fd, src, len, off) != NO_ERROR)
+            goto done;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        if (ftruncate(fds[i], (off_t)bh->db_size) == -1)
+            goto done;
+    }
+    rc = NO_ERROR;
+
+done:
+    free(idx);
+    return rc;
+}
+
+/*
+ *  restore_db
+ *      fd:   linux file descriptor of the database
+ *      dir:  backup directory
+ *
+ *  Rebuilds the database from the newest chain in dir: the last full
+ *  backup followed by every incremental backup after it.  The whole chain
+ *  is checked before the database is touched.  Afterwards the sidecar
+ *  continues the lineage of the chain, so the next backup to dir is
+ *  incremental again.  A published shared memory copy and the replication
+ *  log are refreshed.
+ *
+ *  returns:  <number>       number of backups replayed
+ *            ERR_DB_FILE    database, sidecar or backup I/O issue
+ *
+ *  console:  M_RESTORED        on success
+ *            M_ERR_RESTORE     dir holds no complete chain
+ *            M_ERR_DB_WRITE    error writing the database file
+ */
+int restore_db(int fd, const char *dir)
+{
+    return restore_db_ranges(&fd, 1, MAX_STD_ID, dir);
+}
+
+/*
+ *  restore_db_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      dir:           backup directory
+ *
+ *  Same as restore_db() for a database split over several files, as a
+ *  sharded one is.  Every page is written through the files whose ranges
+ *  it covers, so a chain taken before the database was sharded restores
+ *  into the shards as well.
+ *
+ *  returns:  same as restore_db()
+ *
+ *  console:  same as restore_db()
+ */
+int restore_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *dir)
+{
+    unsigned top = bk_last_seq(dir);
+    unsigned first = top;
+    bk_hdr_t bh;
+    uint64_t lineage;
+    int bfd, pfd, rc = ERR_DB_FILE;
+
+    // walk back to the full backup the chain starts from
+    bfd = (top > 0) ? bk_open(dir, top, &bh) : -1;
+    if (bfd == -1) {
+        printf(M_ERR_RESTORE, dir);
+        return ERR_DB_FILE;
+    }
+    close(bfd);
+    lineage = bh.lineage;
+    while (!bh.full) {
+        if (--first == 0 || (bfd = bk_open(dir, first, &bh)) == -1 || bh.lineage != lineage) {
+            printf(M_ERR_RESTORE, dir);
+            return ERR_DB_FILE;
+        }
+        close(bfd);
+    }
+
+    pfd = pgen_open();
+    if (pfd == -1 || flock(pfd, LOCK_EX) == -1) {
+        printf(M_ERR_DB_WRITE);
+        if (pfd != -1)
+            close(pfd);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        if (ftruncate(fds[i], 0) == -1) {
+            printf(M_ERR_DB_WRITE);
+            goto done;
+        }
+    }
+    if (colcache_invalidate() != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        goto done;
+    }
+    for (unsigned seq = first; seq <= top; seq++) {
+        bfd = bk_open(dir, seq, &bh);
+        if (bfd == -1 || bh.lineage != lineage || bk_apply(fds, nfds, slots_per_fd, bfd, &bh) != NO_ERROR) {
+            if (bfd != -1)
+                close(bfd);
+            printf(M_ERR_DB_WRITE);
+            goto done;
+        }
+        close(bfd);
+    }
+
+    // the database now matches the last backup, continue its lineage
+    if (pgen_init_file(pfd, lineage, bh.epoch + 1) != NO_ERROR) {
+        printf(M_ERR_DB_WRITE);
+        goto done;
+    }
+
+    printf(M_RESTORED, (int)(top - first + 1), dir);
+    rc = (int)(top - first + 1);
+
+    if (shm_db_exists() && shm_db_publish_ranges(fds, nfds, slots_per_fd) < 0)
+        printf(M_ERR_SHM);
+    // followers start over from the restored table
+    if (repl_log_reset_ranges(fds, nfds, slots_per_fd) != NO_ERROR)
+        printf(M_ERR_REPL_LOG);
+
+done:
+    flock(pfd, LOCK_UN);
+    close(pfd);
+    return rc;
+}
@@ -0,0 +1,58 @@
+#ifndef __SDBPGEN_H__
+    #define __SDBPGEN_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "db.h" //get student record type
+
+//Page generations for incremental backups.  The database file is split into
+//PGEN_PAGE_SIZE pages and the sidecar DB_PGEN_FILE keeps one generation number
+//per page.  Every change to the database stamps the pages it wrote with the
+//current epoch from the sidecar header.  A backup stores only the pages whose
+//generation is newer than the epoch of the previous backup in the same
+//directory and then starts a new epoch, so its I/O follows the number of
+//pages changed instead of the size of the database.  A sharded database
+//keeps the same sidecar, its shard files never overlap in the layout.
+//
+//A backup directory holds a chain of files named BK_FILE_FMT.  The chain
+//starts with a full backup and every later file holds the changed pages
+//plus the size of the database at that time.  Pages that are all zero are
+//only listed in the index, their contents are not stored.
+#define PGEN_MAGIC          "SDBPGEN"
+#define PGEN_PAGE_SIZE      4096
+#define PGEN_NPAGES         ((MAX_STD_ID * sizeof(student_t) + PGEN_PAGE_SIZE - 1) / PGEN_PAGE_SIZE)
+
+#define BK_MAGIC            "SDBBKP1"
+#define BK_FILE_FMT         "backup-%06u.sdbbk"
+#define BK_ZERO_PAGE        0x80000000u     //index flag, page is all zero
+
+typedef struct pgen_hdr {
+    char     magic[8];                  //PGEN_MAGIC
+    uint64_t lineage;                   //identifies one history of the db
+    uint64_t epoch;                     //generation stamped on changed pages
+    uint32_t page_size;
+    uint32_t npages;                    //entries in the generation array
+    char     pad[32];                   //generations start at offset 64
+} pgen_hdr_t;
+
+typedef struct bk_hdr {
+    char     magic[8];                  //BK_MAGIC
+    uint64_t lineage;                   //must match along the whole chain
+    uint64_t epoch;                     //covers pages with generation <= epoch
+    uint64_t db_size;                   //database size when taken
+    uint32_t seq;                       //position in the directory, from 1
+    uint32_t full;                      //1 if every page is included
+    uint32_t npages;                    //entries in the page index
+    uint32_t page_size;
+    char     pad[16];                   //page index starts at offset 64
+} bk_hdr_t;
+
+//prototypes for page generations, see sdbpgen.c for documentation
+int pgen_mark(off_t off, size_t len);
+int backup_db(int fd, const char *dir);
+int backup_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *dir);
+int restore_db(int fd, const char *dir);
+int restore_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *dir);
+
+#endif
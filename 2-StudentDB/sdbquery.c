@@ -0,0 +1,549 @@
+#define _GNU_SOURCE     //memmem()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbfmt.h"
+#include "sdbcache.h"
+#include "sdbquery.h"
+
+//kernel costs, terms are sorted on these before the scan starts
+#define COST_INT        0
+#define COST_PREFIX     1
+#define COST_CONTAINS   2
+
+//Integer kernels, one per field and operator so the compare is a constant
+//in the loop.  They only read the id[] or gpa[] array of the column cache.
+//The selection vector is rewritten in place without a branch, every entry
+//is copied and the write index only moves when it passes.
+#define INT_KERNEL(name, field, cmp)                                            \
+static int name(const q_term_t *t, const colcache_t *cc, int base,              \
+                uint16_t *sel, int n)                                           \
+{                                                                               \
+    const int32_t *col = cc->field + base;                                      \
+    int32_t v = t->ival;                                                        \
+    int k = 0;                                                                  \
+    for (int i = 0; i < n; i++) {                                               \
+        uint16_t r = sel[i];                                                    \
+        sel[k] = r;                                                             \
+        k += (col[r] cmp v);                                                    \
+    }                                                                           \
+    return k;                                                                   \
+}
+
+INT_KERNEL(k_id_eq, id, ==)
+INT_KERNEL(k_id_ne, id, !=)
+INT_KERNEL(k_id_lt, id, <)
+INT_KERNEL(k_id_le, id, <=)
+INT_KERNEL(k_id_gt, id, >)
+INT_KERNEL(k_id_ge, id, >=)
+INT_KERNEL(k_gpa_eq, gpa, ==)
+INT_KERNEL(k_gpa_ne, gpa, !=)
+INT_KERNEL(k_gpa_lt, gpa, <)
+INT_KERNEL(k_gpa_le, gpa, <=)
+INT_KERNEL(k_gpa_gt, gpa, >)
+INT_KERNEL(k_gpa_ge, gpa, >=)
+
+//operators in the order they are matched, longest first
+static const struct {
+    const char  *op;
+    q_kernel_t  id;                     //NULL if not valid on integers
+    q_kernel_t  gpa;
+} q_ops[] = {
+    {"==", k_id_eq, k_gpa_eq},
+    {"!=", k_id_ne, k_gpa_ne},
+    {"<=", k_id_le, k_gpa_le},
+    {">=", k_id_ge, k_gpa_ge},
+    {"^=", NULL,    NULL},
+    {"*=", NULL,    NULL},
+    {"=",  k_id_eq, k_gpa_eq},
+    {"<",  k_id_lt, k_gpa_lt},
+    {">",  k_id_gt, k_gpa_gt},
+};
+
+//first name of slot base in the name array the term tests, the names of
+//the following slots are t->size bytes apart
+static inline const char *str_column(const q_term_t *t, const colcache_t *cc, int base)
+{
+    return (t->off == offsetof(student_t, fname)) ? cc->fname[base] : cc->lname[base];
+}
+
+/*
+ *  str_match
+ *
+ *  Compares the first t->vlen bytes of the field with the value.  For an
+ *  equality term vlen includes the terminating zero.  The first 8 bytes are
+ *  compared as one masked word, which settles almost every record, the
+ *  rest only for values longer than that.
+ */
+static inline int str_match(const q_term_t *t, const char *f)
+{
+    uint64_t w;
+
+    memcpy(&w, f, sizeof(w));
+    if ((w & t->mask) != t->word)
+        return 0;
+    return t->vlen <= sizeof(w) || memcmp(f + sizeof(w), t->val + sizeof(w), t->vlen - sizeof(w)) == 0;
+}
+
+static int k_str_match(const q_term_t *t, const colcache_t *cc, int base, uint16_t *sel, int n)
+{
+    const char *col = str_column(t, cc, base);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t r = sel[i];
+        sel[k] = r;
+        k += str_match(t, col + (size_t)r * t->size);
+    }
+    return k;
+}
+
+static int k_str_nomatch(const q_term_t *t, const colcache_t *cc, int base, uint16_t *sel, int n)
+{
+    const char *col = str_column(t, cc, base);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t r = sel[i];
+        sel[k] = r;
+        k += !str_match(t, col + (size_t)r * t->size);
+    }
+    return k;
+}
+
+static int k_str_contains(const q_term_t *t, const colcache_t *cc, int base, uint16_t *sel, int n)
+{
+    const char *col = str_column(t, cc, base);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t r = sel[i];
+        const char *f = col + (size_t)r * t->size;
+        sel[k] = r;
+        k += memmem(f, strnlen(f, t->size), t->val, t->vlen) != NULL;
+    }
+    return k;
+}
+
+static int k_none(const q_term_t *t, const colcache_t *cc, int base, uint16_t *sel, int n)
+{
+    (void)t; (void)cc; (void)base; (void)sel; (void)n;
+    return 0;
+}
+
+static int k_all(const q_term_t *t, const colcache_t *cc, int base, uint16_t *sel, int n)
+{
+    (void)t; (void)cc; (void)base; (void)sel;
+    return n;
+}
+
+static const char *skip_ws(const char *p)
+{
+    while (isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+/*
+ *  parse_int_value
+ *      val:    value text, null terminated
+ *      field:  "id" or "gpa"
+ *      out:    receives the value
+ *
+ *  A gpa can be given like it is stored (345) or like it is printed (3.45).
+ *  Values outside the range a student can have (validate_range()) are
+ *  rejected, so the value always fits the int32_t it is compared as and
+ *  an id narrowed by one stays a valid slot bound.
+ *
+ *  returns:  NO_ERROR on success, ERR_DB_OP if val is not a number or out
+ *            of range
+ */
+static int parse_int_value(const char *val, const char *field, int32_t *out)
+{
+    bool gpa = strcmp(field, "gpa") == 0;
+    long lo = gpa ? MIN_STD_GPA : MIN_STD_ID;
+    long hi = gpa ? MAX_STD_GPA : MAX_STD_ID;
+    char *end;
+
+    if (gpa && strchr(val, '.') != NULL) {
+        double d = strtod(val, &end);
+        if (*end != '\0' || end == val)
+            return ERR_DB_OP;
+        d = d * 100.0 + (d < 0 ? -0.5 : 0.5);
+        if (!(d > lo - 1 && d < hi + 1))        //also false for NaN
+            return ERR_DB_OP;
+        *out = (int32_t)d;
+        return NO_ERROR;
+    }
+
+    long l = strtol(val, &end, 10);
+    if (*end != '\0' || end == val || l < lo || l > hi)
+        return ERR_DB_OP;
+    *out = (int32_t)l;
+    return NO_ERROR;
+}
+
+/*
+ *  compile_str_term
+ *      t:   term with off, size, val and vlen filled in
+ *      op:  one of = != ^= *=
+ *
+ *  Picks the kernel and prepares the masked first word.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void compile_str_term(q_term_t *t, const char *op)
+{
+    unsigned char mbytes[sizeof(uint64_t)] = {0};
+    bool negate = strcmp(op, "!=") == 0;
+
+    if (strcmp(op, "*=") == 0) {
+        t->kernel = k_str_contains;
+        t->cost = COST_CONTAINS;
+        return;
+    }
+
+    // equality also compares the terminator, unless the value fills the field
+    if (op[0] != '^' && t->vlen < t->size)
+        t->vlen++;
+    t->cost = COST_PREFIX;
+    if (t->vlen > t->size) {
+        t->kernel = negate ? k_all : k_none;
+        return;
+    }
+
+    memcpy(&t->word, t->val, sizeof(t->word));
+    memset(mbytes, 0xff, t->vlen < sizeof(mbytes) ? t->vlen : sizeof(mbytes));
+    memcpy(&t->mask, mbytes, sizeof(t->mask));
+    t->word &= t->mask;
+    t->kernel = negate ? k_str_nomatch : k_str_match;
+}
+
+/*
+ *  query_compile
+ *      text:    query text, see sdbquery.h for the syntax
+ *      q:       receives the compiled query
+ *      err_at:  on error, points into text where parsing stopped
+ *
+ *  returns:  NO_ERROR       query compiled
+ *            ERR_DB_OP      syntax error, unknown field, bad operator for
+ *                           the field, or bad value
+ */
+int query_compile(const char *text, query_t *q, const char **err_at)
+{
+    const char *p = skip_ws(text);
+
+    memset(q, 0, sizeof(*q));
+    q->id_lo = MIN_STD_ID;
+    q->id_hi = MAX_STD_ID;
+
+    while (*p != '\0') {
+        char field[8] = {0};
+        const char *start = p;
+        const char *op = NULL;
+        size_t len = 0;
+        size_t oi;
+        q_term_t *t;
+
+        if (q->nterms == Q_MAX_TERMS)
+            goto syntax;
+        t = &q->terms[q->nterms];
+
+        // field
+        while (isalpha((unsigned char)p[len]) && len < sizeof(field) - 1)
+            len++;
+        memcpy(field, p, len);
+        if (strcmp(field, "id") == 0) {
+            t->off = offsetof(student_t, id);
+        } else if (strcmp(field, "gpa") == 0) {
+            t->off = offsetof(student_t, gpa);
+        } else if (strcmp(field, "fname") == 0) {
+            t->off = offsetof(student_t, fname);
+            t->size = sizeof(((student_t *)0)->fname);
+        } else if (strcmp(field, "lname") == 0) {
+            t->off = offsetof(student_t, lname);
+            t->size = sizeof(((student_t *)0)->lname);
+        } else {
+            goto syntax;
+        }
+        p = skip_ws(p + len);
+
+        // operator
+        for (oi = 0; oi < sizeof(q_ops) / sizeof(q_ops[0]); oi++) {
+            size_t olen = strlen(q_ops[oi].op);
+            if (strncmp(p, q_ops[oi].op, olen) == 0) {
+                op = q_ops[oi].op;
+                p = skip_ws(p + olen);
+                break;
+            }
+        }
+        if (op == NULL)
+            goto syntax;
+
+        // value, optionally quoted
+        if (*p == '\'' || *p == '"') {
+            const char *close = strchr(p + 1, *p);
+            if (close == NULL)
+                goto syntax;
+            len = (size_t)(close - p - 1);
+            if (len == 0 || len > Q_MAX_VALUE)
+                goto syntax;
+            memcpy(t->val, p + 1, len);
+            p = close + 1;
+        } else {
+            len = 0;
+            while (p[len] != '\0' && !isspace((unsigned char)p[len]))
+                len++;
+            if (len == 0 || len > Q_MAX_VALUE)
+                goto syntax;
+            memcpy(t->val, p, len);
+            p += len;
+        }
+        t->vlen = len;
+
+        if (t->size == 0) {
+            t->kernel = (t->off == offsetof(student_t, id)) ? q_ops[oi].id : q_ops[oi].gpa;
+            t->cost = COST_INT;
+            if (t->kernel == NULL || parse_int_value(t->val, field, &t->ival) != NO_ERROR)
+                goto syntax;
+
+            // id terms also narrow the range of slots that is read
+            if (t->off == offsetof(student_t, id)) {
+                int v = t->ival;
+                if (t->kernel == k_id_eq || t->kernel == k_id_ge || t->kernel == k_id_gt) {
+                    int lo = (t->kernel == k_id_gt) ? v + 1 : v;
+                    if (lo > q->id_lo)
+                        q->id_lo = lo;
+                }
+                if (t->kernel == k_id_eq || t->kernel == k_id_le || t->kernel == k_id_lt) {
+                    int hi = (t->kernel == k_id_lt) ? v - 1 : v;
+                    if (hi < q->id_hi)
+                        q->id_hi = hi;
+                }
+            }
+        } else {
+            if (strcmp(op, "=") != 0 && strcmp(op, "==") != 0 && strcmp(op, "!=") != 0 &&
+                strcmp(op, "^=") != 0 && strcmp(op, "*=") != 0)
+                goto syntax;
+            compile_str_term(t, op);
+        }
+        q->nterms++;
+
+        // joiner
+        p = skip_ws(p);
+        if (*p == '\0')
+            break;
+        if (strncasecmp(p, "and", 3) == 0 && isspace((unsigned char)p[3])) {
+            p = skip_ws(p + 3);
+        } else if (strncmp(p, "&&", 2) == 0) {
+            p = skip_ws(p + 2);
+        } else {
+            start = p;
+            goto syntax;
+        }
+        if (*p == '\0')
+            goto syntax;
+        continue;
+
+syntax:
+        *err_at = start;
+        return ERR_DB_OP;
+    }
+
+    // cheapest kernels first, insertion sort keeps the written order otherwise
+    for (int i = 1; i < q->nterms; i++) {
+        q_term_t t = q->terms[i];
+        int j = i - 1;
+        while (j >= 0 && q->terms[j].cost > t.cost) {
+            q->terms[j + 1] = q->terms[j];
+            j--;
+        }
+        q->terms[j + 1] = t;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  query_block
+ *      q:     compiled query
+ *      cc:    column cache of the table
+ *      base:  first slot of the block
+ *      n:     number of slots in the block, at most Q_BLOCK
+ *      sel:   receives the matching slots as offsets from base
+ *
+ *  The selection vector starts with the live slots, found from id[] alone,
+ *  and every kernel narrows it in place.
+ *
+ *  returns:  number of matching slots, in slot order
+ */
+int query_block(const query_t *q, const colcache_t *cc, int base, int n, uint16_t *sel)
+{
+    const int32_t *id = cc->id + base;
+    int k = 0;
+
+    for (int i = 0; i < n; i++) {
+        sel[k] = (uint16_t)i;
+        k += id[i] != DELETED_STUDENT_ID;
+    }
+    for (int i = 0; i < q->nterms && k > 0; i++)
+        k = q->terms[i].kernel(&q->terms[i], cc, base, sel, k);
+    return k;
+}
+
+/*
+ *  query_db
+ *      fd:    linux file descriptor of the database
+ *      text:  query text
+ *
+ *  Prints the students matching the query in the same format as print_db().
+ *  The scan runs over the column cache, built on first use, in blocks of
+ *  Q_BLOCK slots limited to the id range the query allows.  Only matching
+ *  students are put back together from the arrays for printing.
+ *
+ *  returns:  <number>       number of matching students
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the query does not compile
+ *
+ *  console:  M_QUERY_NONE     on success if no student matches
+ *            M_ERR_QUERY      the query does not compile
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int query_db(int fd, const char *text)
+{
+    return query_db_ranges(&fd, 1, MAX_STD_ID, text);
+}
+
+/*
+ *  query_db_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      text:          query text
+ *
+ *  Same as query_db() for a database split over several files, as a
+ *  sharded one is, see colcache_open_ranges().
+ *
+ *  returns:  same as query_db()
+ *
+ *  console:  same as query_db()
+ */
+int query_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *text)
+{
+    static uint16_t sel[Q_BLOCK];
+    const char *err_at = text;
+    colcache_t cc;
+    out_buff_t out;
+    student_t s;
+    query_t q;
+    int matches = 0;
+
+    if (query_compile(text, &q, &err_at) != NO_ERROR) {
+        printf(M_ERR_QUERY, err_at);
+        return ERR_DB_OP;
+    }
+    if (colcache_open_ranges(fds, nfds, slots_per_fd, &cc) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    ob_init(&out, STDOUT_FILENO);
+    for (int base = q.id_lo - 1; base < q.id_hi; base += Q_BLOCK) {
+        int n = (q.id_hi - base < Q_BLOCK) ? q.id_hi - base : Q_BLOCK;
+        int k = query_block(&q, &cc, base, n, sel);
+        for (int i = 0; i < k; i++) {
+            if (matches++ == 0)
+                ob_write_hdr(&out);
+            colcache_get(&cc, base + sel[i], &s);
+            ob_write_student(&out, &s);
+        }
+    }
+    colcache_close(&cc);
+    if (ob_flush(&out) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    if (matches == 0)
+        printf(M_QUERY_NONE);
+    return matches;
+}
+
+/*
+ *  query_gpa_stats
+ *      fd:    linux file descriptor of the database
+ *      text:  query text, NULL for every student
+ *
+ *  Prints the number of students and their lowest, highest and average
+ *  gpa.  Without a query the scan reads id[] and gpa[] only, 8 bytes per
+ *  slot, the gpa of the selected students is gathered from gpa[].
+ *
+ *  returns:  <number>       number of students aggregated
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the query does not compile
+ *
+ *  console:  M_GPA_STATS      on success
+ *            M_QUERY_NONE     on success if no student matches
+ *            M_ERR_QUERY      the query does not compile
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int query_gpa_stats(int fd, const char *text)
+{
+    return query_gpa_stats_ranges(&fd, 1, MAX_STD_ID, text);
+}
+
+/*
+ *  query_gpa_stats_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      text:          query text, NULL for every student
+ *
+ *  Same as query_gpa_stats() for a database split over several files, as
+ *  a sharded one is, see colcache_open_ranges().
+ *
+ *  returns:  same as query_gpa_stats()
+ *
+ *  console:  same as query_gpa_stats()
+ */
+int query_gpa_stats_ranges(const int fds[], int nfds, int slots_per_fd, const char *text)
+{
+    static uint16_t sel[Q_BLOCK];
+    const char *err_at = text;
+    colcache_t cc;
+    query_t q;
+    int64_t sum = 0;
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+    int count = 0;
+
+    if (query_compile(text != NULL ? text : "", &q, &err_at) != NO_ERROR) {
+        printf(M_ERR_QUERY, err_at);
+        return ERR_DB_OP;
+    }
+    if (colcache_open_ranges(fds, nfds, slots_per_fd, &cc) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int base = q.id_lo - 1; base < q.id_hi; base += Q_BLOCK) {
+        int n = (q.id_hi - base < Q_BLOCK) ? q.id_hi - base : Q_BLOCK;
+        int k = query_block(&q, &cc, base, n, sel);
+        const int32_t *gpa = cc.gpa + base;
+        for (int i = 0; i < k; i++) {
+            int32_t g = gpa[sel[i]];
+            sum += g;
+            lo = (g < lo) ? g : lo;
+            hi = (g > hi) ? g : hi;
+        }
+        count += k;
+    }
+    colcache_close(&cc);
+
+    if (count == 0) {
+        printf(M_QUERY_NONE);
+        return 0;
+    }
+    printf(M_GPA_STATS, count, lo / 100.0, hi / 100.0, (double)sum / count / 100.0);
+    return count;
+}
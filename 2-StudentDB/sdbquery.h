@@ -0,0 +1,61 @@
+#ifndef __SDBQUERY_H__
+    #define __SDBQUERY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db.h" //get student record type
+#include "sdbcache.h"
+
+//Predicate queries for -q.  A query is a list of terms joined by "and":
+//
+//      field op value [and field op value ...]
+//
+//      id, gpa       =  ==  !=  <  <=  >  >=     (gpa as 350 or 3.50)
+//      fname, lname  =  !=  ^= (starts with)  *= (contains)
+//
+//The query is compiled once into a chain of filter kernels, one per term,
+//ordered so the integer compares on id and gpa run before any kernel that
+//looks at names.  Scans run over the column cache (sdbcache.h) in blocks of
+//Q_BLOCK slots.  Every block starts with a selection vector of its live
+//slots and each kernel narrows the vector in place, reading only the array
+//of its own field, so a name kernel only ever sees the students that passed
+//the cheap tests.  Terms on id also limit the slots scanned.
+#define Q_BLOCK             1024        //records per scan block
+#define Q_MAX_TERMS         16
+#define Q_MAX_VALUE         32          //longest string value
+
+typedef struct q_term q_term_t;
+
+//keeps the entries of sel[0..n) that pass the term, returns the new count
+typedef int (*q_kernel_t)(const q_term_t *t, const colcache_t *cc, int base,
+                          uint16_t *sel, int n);
+
+struct q_term {
+    q_kernel_t  kernel;
+    int         cost;                   //kernels run cheapest first
+    size_t      off;                    //offsetof() the field in student_t
+    size_t      size;                   //sizeof() the field
+    int32_t     ival;                   //value of an id or gpa term
+    uint64_t    word;                   //first 8 bytes of a string value
+    uint64_t    mask;                   //bytes of word that must match
+    size_t      vlen;
+    char        val[Q_MAX_VALUE + 1];
+};
+
+typedef struct query {
+    int         nterms;
+    int         id_lo;                  //ids outside are never read
+    int         id_hi;
+    q_term_t    terms[Q_MAX_TERMS];
+} query_t;
+
+//prototypes for queries, see sdbquery.c for documentation
+int query_compile(const char *text, query_t *q, const char **err_at);
+int query_block(const query_t *q, const colcache_t *cc, int base, int n, uint16_t *sel);
+int query_db(int fd, const char *text);
+int query_db_ranges(const int fds[], int nfds, int slots_per_fd, const char *text);
+int query_gpa_stats(int fd, const char *text);
+int query_gpa_stats_ranges(const int fds[], int nfds, int slots_per_fd, const char *text);
+
+#endif
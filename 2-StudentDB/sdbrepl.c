@@ -0,0 +1,723 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshm.h"
+#include "sdbpgen.h"
+#include "sdbrepl.h"
+#include "sdbcache.h"
+#include "sdbshard.h"
+
+#define DB_LOG_TMP_FILE     ".tmp_student.db.log"
+
+//log used by repl_log_slot(), opened on the first call
+static int repl_log_fd = -1;
+static int repl_state = 0;  //0 = not tried yet, 1 = logging, -1 = no log
+
+//one connected follower, owned by its thread
+typedef struct repl_peer {
+    int     sock;
+    char    addr[INET_ADDRSTRLEN];
+} repl_peer_t;
+
+static uint64_t repl_new_log_id(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
+/*
+ *  log_lock_current
+ *      fd:    cached log fd, -1 to open the log
+ *      how:   LOCK_SH to read the log, LOCK_EX to append to it
+ *      hdr:   receives the log header
+ *
+ *  Locks the current log.  The log is replaced by rename() when a new
+ *  snapshot is written, so after getting the lock the fd is checked
+ *  against the path and reopened if it refers to the old file.  On
+ *  success the lock is held and the caller releases it with flock().
+ *
+ *  returns:  NO_ERROR       log locked
+ *            ERR_DB_FILE    no log, or log I/O issue
+ */
+static int log_lock_current(int *fd, int how, log_hdr_t *hdr)
+{
+    struct stat path_st, fd_st;
+
+    for (;;) {
+        if (*fd == -1) {
+            *fd = open(DB_LOG_FILE, O_RDWR);
+            if (*fd == -1)
+                return ERR_DB_FILE;
+        }
+        if (flock(*fd, how) == -1)
+            return ERR_DB_FILE;
+        if (stat(DB_LOG_FILE, &path_st) == 0 && fstat(*fd, &fd_st) == 0 &&
+            path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev)
+            break;
+
+        // a new snapshot replaced the log while we waited for the lock
+        flock(*fd, LOCK_UN);
+        close(*fd);
+        *fd = -1;
+    }
+
+    if (pread(*fd, hdr, sizeof(*hdr), 0) != (ssize_t)sizeof(*hdr) ||
+        memcmp(hdr->magic, REPL_LOG_MAGIC, sizeof(REPL_LOG_MAGIC)) != 0) {
+        flock(*fd, LOCK_UN);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  log_records
+ *      fd:   locked log fd
+ *
+ *  returns:  number of complete records in the log, a torn record left by
+ *            a crashed writer is not counted and gets overwritten by the
+ *            next append
+ */
+static uint64_t log_records(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(log_hdr_t))
+        return 0;
+    return ((uint64_t)st.st_size - sizeof(log_hdr_t)) / sizeof(log_rec_t);
+}
+
+/*
+ *  log_write_snapshot
+ *      fds, nfds, slots_per_fd:  database files, see shard_range_fd()
+ *      first_lsn:                lsn of the LOG_RESET the new log starts with
+ *      log_id:                   id of the log
+ *
+ *  Writes a new log holding a LOG_RESET followed by a LOG_PUT for every
+ *  student and renames it over DB_LOG_FILE.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or log I/O issue
+ */
+static int log_write_snapshot(const int fds[], int nfds, int slots_per_fd,
+                              uint64_t first_lsn, uint64_t log_id)
+{
+    log_rec_t *out = malloc(sizeof(log_rec_t) * REPL_BATCH);
+    student_t *in = malloc(sizeof(student_t) * REPL_BATCH);
+    log_hdr_t hdr = {0};
+    uint64_t db_size, end;
+    uint64_t lsn = first_lsn;
+    off_t log_off = sizeof(hdr);
+    size_t n = 0;
+    int rc = ERR_DB_FILE;
+    int tmp_fd = -1;
+
+    if (out == NULL || in == NULL ||
+        shard_ranges_size(fds, nfds, slots_per_fd, &db_size) != NO_ERROR)
+        goto done;
+    tmp_fd = open(DB_LOG_TMP_FILE, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (tmp_fd == -1)
+        goto done;
+
+    memcpy(hdr.magic, REPL_LOG_MAGIC, sizeof(REPL_LOG_MAGIC));
+    hdr.first_lsn = first_lsn;
+    hdr.log_id = log_id;
+    if (pwrite(tmp_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+        goto done;
+
+    memset(&out[n], 0, sizeof(log_rec_t));
+    out[n].lsn = lsn++;
+    out[n].op = LOG_RESET;
+    out[n].db_size = db_size;
+    n++;
+
+    for (int f = 0; f < nfds; f++) {
+        uint64_t first = (uint64_t)f * slots_per_fd * STUDENT_RECORD_SIZE;
+        shard_range_fd(nfds, slots_per_fd, first, &end);
+
+        for (uint64_t pos = first; pos < end; pos += sizeof(student_t) * REPL_BATCH) {
+            size_t want = (end - pos < sizeof(student_t) * REPL_BATCH) ? (size_t)(end - pos)
+                                                                       : sizeof(student_t) * REPL_BATCH;
+            ssize_t got = pread(fds[f], in, want, (off_t)pos);
+            if (got == -1)
+                goto done;
+            int k = (int)(got / STUDENT_RECORD_SIZE);
+
+            for (int i = 0; i < k; i++) {
+                if (memcmp(&in[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                    continue;
+                out[n].lsn = lsn++;
+                out[n].op = LOG_PUT;
+                out[n].slot = (uint32_t)(pos / STUDENT_RECORD_SIZE) + (uint32_t)i;
+                out[n].db_size = db_size;
+                out[n].s = in[i];
+                if (++n == REPL_BATCH) {
+                    if (pwrite(tmp_fd, out, n * sizeof(log_rec_t), log_off) != (ssize_t)(n * sizeof(log_rec_t)))
+                        goto done;
+                    log_off += (off_t)(n * sizeof(log_rec_t));
+                    n = 0;
+                }
+            }
+            if ((size_t)got < want)
+                break;      //end of this file
+        }
+    }
+    if (n > 0 && pwrite(tmp_fd, out, n * sizeof(log_rec_t), log_off) != (ssize_t)(n * sizeof(log_rec_t)))
+        goto done;
+
+    if (close(tmp_fd) == -1 || rename(DB_LOG_TMP_FILE, DB_LOG_FILE) == -1) {
+        tmp_fd = -1;
+        goto done;
+    }
+    tmp_fd = -1;
+    rc = NO_ERROR;
+
+done:
+    if (tmp_fd != -1)
+        close(tmp_fd);
+    if (rc != NO_ERROR)
+        unlink(DB_LOG_TMP_FILE);
+    free(out);
+    free(in);
+    return rc;
+}
+
+/*
+ *  repl_log_slot
+ *      db_fd:  linux file descriptor of the database
+ *      slot:   student slot (id - 1) that was just written
+ *
+ *  Appends the current contents of the slot to the log as a LOG_PUT.  It
+ *  is called after the database write, so the record read back is what
+ *  followers have to end up with whatever the operation was (add, delete
+ *  or a partial update).  Does nothing unless a leader created the log.
+ *  db_fd may be the shard file that owns the slot, its size is then only
+ *  a lower bound for the size of the database, see repl_apply().
+ *
+ *  returns:  NO_ERROR       record logged or replication is off
+ *            ERR_DB_FILE    database or log I/O issue
+ */
+int repl_log_slot(int db_fd, int slot)
+{
+    log_rec_t rec = {0};
+    log_hdr_t hdr;
+    struct stat st;
+    uint64_t n;
+    int rc = NO_ERROR;
+
+    if (repl_state == 0)
+        repl_state = (access(DB_LOG_FILE, F_OK) == 0) ? 1 : -1;
+    if (repl_state < 0)
+        return NO_ERROR;
+
+    // the slot is read back under the log lock: when two writers of the
+    // same id race, whichever logs last reads the slot after both writes,
+    // so the log always ends with what the database holds
+    if (log_lock_current(&repl_log_fd, LOCK_EX, &hdr) != NO_ERROR)
+        return ERR_DB_FILE;
+    if (pread(db_fd, &rec.s, sizeof(rec.s), (off_t)slot * STUDENT_RECORD_SIZE) == -1 ||
+        fstat(db_fd, &st) == -1) {
+        flock(repl_log_fd, LOCK_UN);
+        return ERR_DB_FILE;
+    }
+    rec.op = LOG_PUT;
+    rec.slot = (uint32_t)slot;
+    rec.db_size = (uint64_t)st.st_size;
+
+    n = log_records(repl_log_fd);
+    rec.lsn = hdr.first_lsn + n;
+    if (pwrite(repl_log_fd, &rec, sizeof(rec), (off_t)(sizeof(hdr) + n * sizeof(rec))) != (ssize_t)sizeof(rec))
+        rc = ERR_DB_FILE;
+    flock(repl_log_fd, LOCK_UN);
+    return rc;
+}
+
+/*
+ *  repl_log_reset
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Replaces the log with a snapshot of the database.  Used after
+ *  operations that rewrite the whole table, the snapshot continues the
+ *  lsn sequence and keeps the log id, so connected followers move over
+ *  to it without noticing more than a LOG_RESET.  Does nothing unless a
+ *  leader created the log.
+ *
+ *  returns:  NO_ERROR       log replaced or replication is off
+ *            ERR_DB_FILE    database or log I/O issue
+ */
+int repl_log_reset(int db_fd)
+{
+    return repl_log_reset_ranges(&db_fd, 1, MAX_STD_ID);
+}
+
+/*
+ *  repl_log_reset_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *
+ *  Same as repl_log_reset() for a database split over several files, as a
+ *  sharded one is.
+ *
+ *  returns:  same as repl_log_reset()
+ */
+int repl_log_reset_ranges(const int fds[], int nfds, int slots_per_fd)
+{
+    log_hdr_t hdr;
+    int fd = -1;
+    int rc;
+
+    if (access(DB_LOG_FILE, F_OK) != 0)
+        return NO_ERROR;
+    if (log_lock_current(&fd, LOCK_EX, &hdr) != NO_ERROR) {
+        if (fd != -1)
+            close(fd);
+        return ERR_DB_FILE;
+    }
+
+    // writers queued on the old log see the rename and move to the new one
+    rc = log_write_snapshot(fds, nfds, slots_per_fd, hdr.first_lsn + log_records(fd), hdr.log_id);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return rc;
+}
+
+static int send_all(int sock, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= (size_t)n;
+    }
+    return NO_ERROR;
+}
+
+static int recv_all(int sock, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ERR_DB_FILE;
+        p += n;
+        len -= (size_t)n;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  repl_serve_follower
+ *      arg:  repl_peer_t of the follower, freed here
+ *
+ *  Thread body for one follower.  Reads the follower hello, answers with
+ *  the lsn streaming starts from and then sends log records in batches of
+ *  REPL_BATCH read with one pread() each.  When the follower is caught up
+ *  the log is polled every REPL_POLL_MS and a heartbeat goes out right
+ *  after each burst of records and every REPL_HEARTBEAT_MS while idle.
+ *  The thread ends when the follower disconnects.
+ *
+ *  returns:  NULL
+ */
+static void *repl_serve_follower(void *arg)
+{
+    repl_peer_t *peer = (repl_peer_t *)arg;
+    log_rec_t *recs = malloc(sizeof(log_rec_t) * REPL_BATCH);
+    repl_hello_t hello;
+    log_hdr_t hdr;
+    uint64_t next, last = 0;
+    int idle_ms = REPL_HEARTBEAT_MS;
+    int log_fd = -1;
+
+    if (recs == NULL || recv_all(peer->sock, &hello, sizeof(hello)) != NO_ERROR ||
+        memcmp(hello.magic, REPL_HELLO_MAGIC, sizeof(REPL_HELLO_MAGIC)) != 0 ||
+        log_lock_current(&log_fd, LOCK_SH, &hdr) != NO_ERROR)
+        goto done;
+
+    // resume inside this log if possible, otherwise start from its snapshot
+    last = hdr.first_lsn + log_records(log_fd) - 1;
+    next = hello.next_lsn;
+    if (hello.log_id != hdr.log_id || next < hdr.first_lsn || next > last + 1)
+        next = hdr.first_lsn;
+    flock(log_fd, LOCK_UN);
+
+    memcpy(hello.magic, REPL_HELLO_MAGIC, sizeof(REPL_HELLO_MAGIC));
+    hello.log_id = hdr.log_id;
+    hello.next_lsn = next;
+    if (send_all(peer->sock, &hello, sizeof(hello)) != NO_ERROR)
+        goto done;
+    printf(M_REPL_PEER, peer->addr, (unsigned long long)next);
+    fflush(stdout);
+
+    for (;;) {
+        size_t n = 0;
+
+        if (log_lock_current(&log_fd, LOCK_SH, &hdr) != NO_ERROR)
+            break;
+        last = hdr.first_lsn + log_records(log_fd) - 1;
+        if (next < hdr.first_lsn || next > last + 1)
+            next = hdr.first_lsn;
+        if (next <= last) {
+            n = (last - next + 1 < REPL_BATCH) ? (size_t)(last - next + 1) : REPL_BATCH;
+            ssize_t got = pread(log_fd, recs, n * sizeof(log_rec_t),
+                                (off_t)(sizeof(hdr) + (next - hdr.first_lsn) * sizeof(log_rec_t)));
+            n = (got > 0) ? (size_t)got / sizeof(log_rec_t) : 0;
+        }
+        flock(log_fd, LOCK_UN);
+
+        if (n > 0) {
+            if (send_all(peer->sock, recs, n * sizeof(log_rec_t)) != NO_ERROR)
+                break;
+            next += n;
+            idle_ms = REPL_HEARTBEAT_MS;
+            continue;
+        }
+
+        if (idle_ms >= REPL_HEARTBEAT_MS) {
+            log_rec_t hb = {.lsn = last, .op = LOG_HEARTBEAT};
+            if (send_all(peer->sock, &hb, sizeof(hb)) != NO_ERROR)
+                break;
+            idle_ms = 0;
+        }
+
+        // followers never send after the hello, readable means closed
+        struct pollfd pfd = {.fd = peer->sock, .events = POLLIN};
+        if (poll(&pfd, 1, REPL_POLL_MS) != 0)
+            break;
+        idle_ms += REPL_POLL_MS;
+    }
+
+done:
+    if (log_fd != -1)
+        close(log_fd);
+    close(peer->sock);
+    free(peer);
+    free(recs);
+    return NULL;
+}
+
+/*
+ *  repl_leader
+ *      db_fd:  linux file descriptor of the database
+ *      port:   TCP port to accept followers on
+ *
+ *  Creates the log from a snapshot of the database if it does not exist
+ *  yet, then accepts followers forever, one thread per follower.  From now
+ *  on every sdbsc change to the database is appended to the log, also
+ *  while no leader is running.
+ *
+ *  returns:  ERR_DB_FILE    log or socket setup failed, or accept() failed
+ *
+ *  console:  M_REPL_LEADER      when ready for followers
+ *            M_REPL_PEER        for every follower
+ *            M_ERR_REPL_LOG     log could not be created
+ *            M_ERR_REPL_LISTEN  port could not be bound
+ */
+int repl_leader(int db_fd, int port)
+{
+    return repl_leader_ranges(&db_fd, 1, MAX_STD_ID, port);
+}
+
+/*
+ *  repl_leader_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      port:          TCP port to accept followers on
+ *
+ *  Same as repl_leader() for a database split over several files, as a
+ *  sharded one is.  The log does not depend on the layout, followers of a
+ *  sharded leader may or may not be sharded themselves.
+ *
+ *  returns:  same as repl_leader()
+ *
+ *  console:  same as repl_leader()
+ */
+int repl_leader_ranges(const int fds[], int nfds, int slots_per_fd, int port)
+{
+    struct sockaddr_in addr = {0};
+    log_hdr_t hdr;
+    int enable = 1;
+    int svr_sock, log_fd = -1;
+    uint64_t last;
+
+    if (access(DB_LOG_FILE, F_OK) != 0 &&
+        log_write_snapshot(fds, nfds, slots_per_fd, 1, repl_new_log_id()) != NO_ERROR) {
+        printf(M_ERR_REPL_LOG);
+        return ERR_DB_FILE;
+    }
+    if (log_lock_current(&log_fd, LOCK_SH, &hdr) != NO_ERROR) {
+        printf(M_ERR_REPL_LOG);
+        if (log_fd != -1)
+            close(log_fd);
+        return ERR_DB_FILE;
+    }
+    last = hdr.first_lsn + log_records(log_fd) - 1;
+    flock(log_fd, LOCK_UN);
+    close(log_fd);
+
+    svr_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (svr_sock < 0) {
+        printf(M_ERR_REPL_LISTEN, port);
+        return ERR_DB_FILE;
+    }
+    setsockopt(svr_sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(svr_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(svr_sock, 8) < 0) {
+        printf(M_ERR_REPL_LISTEN, port);
+        close(svr_sock);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_REPL_LEADER, port, (unsigned long long)last);
+    fflush(stdout);
+
+    for (;;) {
+        struct sockaddr_in cli_addr;
+        socklen_t cli_len = sizeof(cli_addr);
+        pthread_t tid;
+        int cli_sock = accept(svr_sock, (struct sockaddr *)&cli_addr, &cli_len);
+
+        if (cli_sock < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        repl_peer_t *peer = malloc(sizeof(repl_peer_t));
+        if (peer == NULL) {
+            close(cli_sock);
+            continue;
+        }
+        peer->sock = cli_sock;
+        inet_ntop(AF_INET, &cli_addr.sin_addr, peer->addr, sizeof(peer->addr));
+        if (pthread_create(&tid, NULL, repl_serve_follower, peer) != 0) {
+            close(cli_sock);
+            free(peer);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    close(svr_sock);
+    return ERR_DB_FILE;
+}
+
+static void repl_save_state(int state_fd, const repl_state_t *state)
+{
+    if (state_fd != -1)
+        pwrite(state_fd, state, sizeof(*state), 0);
+}
+
+/*
+ *  repl_apply
+ *      fds, nfds, slots_per_fd:  database files, see shard_range_fd()
+ *      rec:                      LOG_PUT or LOG_RESET record
+ *      size:                     current size of the database, updated
+ *
+ *  A LOG_PUT only ever grows the database.  Between two LOG_RESETs the
+ *  leader never shrinks it, and a sharded leader logs the size of the
+ *  shard file that was written, which can be less than the whole.
+ *
+ *  returns:  NO_ERROR       record applied
+ *            ERR_DB_FILE    database I/O issue
+ */
+static int repl_apply(const int fds[], int nfds, int slots_per_fd, const log_rec_t *rec, uint64_t *size)
+{
+    uint64_t end;
+
+    if (rec->op == LOG_RESET) {
+        for (int i = 0; i < nfds; i++) {
+            if (ftruncate(fds[i], 0) == -1 || ftruncate(fds[i], (off_t)rec->db_size) == -1)
+                return ERR_DB_FILE;
+        }
+        *size = rec->db_size;
+        if (pgen_mark(0, (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE) != NO_ERROR)
+            printf(M_ERR_PGEN);
+        if (shm_db_exists() && shm_db_publish_ranges(fds, nfds, slots_per_fd) < 0)
+            printf(M_ERR_SHM);
+        if (colcache_invalidate() != NO_ERROR)
+            printf(M_ERR_COLCACHE);
+        return NO_ERROR;
+    }
+
+    off_t off = (off_t)rec->slot * STUDENT_RECORD_SIZE;
+    int db_fd = fds[shard_range_fd(nfds, slots_per_fd, (uint64_t)off, &end)];
+    if (pwrite(db_fd, &rec->s, STUDENT_RECORD_SIZE, off) != STUDENT_RECORD_SIZE)
+        return ERR_DB_FILE;
+    if (rec->db_size > *size) {
+        if (ftruncate(db_fd, (off_t)rec->db_size) == -1)
+            return ERR_DB_FILE;
+        *size = rec->db_size;
+    }
+    if (pgen_mark(off, STUDENT_RECORD_SIZE) != NO_ERROR)
+        printf(M_ERR_PGEN);
+    if (shm_db_mirror((int)rec->slot + 1, &rec->s) != NO_ERROR)
+        printf(M_ERR_SHM);
+    if (colcache_patch(db_fd, (int)rec->slot) != NO_ERROR)
+        printf(M_ERR_COLCACHE);
+    return NO_ERROR;
+}
+
+/*
+ *  repl_follower
+ *      db_fd:  linux file descriptor of the database
+ *      host:   leader host name or address
+ *      port:   leader port
+ *
+ *  Connects to a leader and applies its log to the database until the
+ *  connection is closed.  The lsn and log id of the last applied record
+ *  are kept in DB_LSN_FILE, so a restarted follower catches up from where
+ *  it stopped instead of copying the whole table again.  After every
+ *  heartbeat the lag in records is reported if it changed.
+ *
+ *  returns:  NO_ERROR       the leader closed the connection
+ *            ERR_DB_FILE    connection failed or broke, database I/O issue
+ *
+ *  console:  M_REPL_FOLLOWING     when connected
+ *            M_REPL_LAG           when the lag changes
+ *            M_REPL_CLOSED        when the leader goes away
+ *            M_ERR_REPL_CONN      leader cannot be reached
+ *            M_ERR_DB_WRITE       error writing the database file
+ */
+int repl_follower(int db_fd, const char *host, int port)
+{
+    return repl_follower_ranges(&db_fd, 1, MAX_STD_ID, host, port);
+}
+
+/*
+ *  repl_follower_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      host:          leader host name or address
+ *      port:          leader port
+ *
+ *  Same as repl_follower() for a database split over several files, as a
+ *  sharded one is.  Every record is written to the file that owns its
+ *  slot.
+ *
+ *  returns:  same as repl_follower()
+ *
+ *  console:  same as repl_follower()
+ */
+int repl_follower_ranges(const int fds[], int nfds, int slots_per_fd, const char *host, int port)
+{
+    struct addrinfo hints = {0}, *res = NULL;
+    repl_state_t state = {0};
+    repl_hello_t hello = {0};
+    char port_str[16];
+    log_rec_t *buf = malloc(sizeof(log_rec_t) * REPL_BATCH);
+    uint64_t leader_lsn = 0, shown_applied = UINT64_MAX, shown_lag = UINT64_MAX;
+    uint64_t size;
+    size_t have = 0;
+    int sock = -1, state_fd;
+    int rc = ERR_DB_FILE;
+
+    state_fd = open(DB_LSN_FILE, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (state_fd != -1 && pread(state_fd, &state, sizeof(state), 0) != (ssize_t)sizeof(state))
+        memset(&state, 0, sizeof(state));
+    if (buf == NULL || shard_ranges_size(fds, nfds, slots_per_fd, &size) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 ||
+        (sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0 ||
+        connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+        printf(M_ERR_REPL_CONN, host, port);
+        goto done;
+    }
+
+    memcpy(hello.magic, REPL_HELLO_MAGIC, sizeof(REPL_HELLO_MAGIC));
+    hello.log_id = state.log_id;
+    hello.next_lsn = state.applied_lsn + 1;
+    if (send_all(sock, &hello, sizeof(hello)) != NO_ERROR ||
+        recv_all(sock, &hello, sizeof(hello)) != NO_ERROR ||
+        memcmp(hello.magic, REPL_HELLO_MAGIC, sizeof(REPL_HELLO_MAGIC)) != 0) {
+        printf(M_ERR_REPL_CONN, host, port);
+        goto done;
+    }
+    state.log_id = hello.log_id;
+    printf(M_REPL_FOLLOWING, host, port, (unsigned long long)hello.next_lsn);
+    fflush(stdout);
+
+    for (;;) {
+        ssize_t got = recv(sock, (char *)buf + have, sizeof(log_rec_t) * REPL_BATCH - have, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            printf(M_REPL_CLOSED, (unsigned long long)state.applied_lsn);
+            rc = (got == 0) ? NO_ERROR : ERR_DB_FILE;
+            break;
+        }
+        have += (size_t)got;
+
+        size_t n = have / sizeof(log_rec_t);
+        bool heartbeat = false;
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i].op == LOG_HEARTBEAT) {
+                leader_lsn = buf[i].lsn;
+                heartbeat = true;
+                continue;
+            }
+            if (repl_apply(fds, nfds, slots_per_fd, &buf[i], &size) != NO_ERROR) {
+                printf(M_ERR_DB_WRITE);
+                goto done;
+            }
+            state.applied_lsn = buf[i].lsn;
+        }
+        have -= n * sizeof(log_rec_t);
+        memmove(buf, (char *)buf + n * sizeof(log_rec_t), have);
+        repl_save_state(state_fd, &state);
+
+        uint64_t lag = (leader_lsn > state.applied_lsn) ? leader_lsn - state.applied_lsn : 0;
+        if (heartbeat && (lag != shown_lag || state.applied_lsn != shown_applied)) {
+            printf(M_REPL_LAG, (unsigned long long)state.applied_lsn, (unsigned long long)lag);
+            fflush(stdout);
+            shown_lag = lag;
+            shown_applied = state.applied_lsn;
+        }
+    }
+
+done:
+    if (res != NULL)
+        freeaddrinfo(res);
+    if (sock != -1)
+        close(sock);
+    if (state_fd != -1)
+        close(state_fd);
+    free(buf);
+    return rc;
+}
@@ -0,0 +1,75 @@
+#ifndef __SDBREPL_H__
+    #define __SDBREPL_H__
+
+#include <stdint.h>
+
+#include "db.h" //get student record type
+
+//Log shipping replication.  Once a leader has been started with -L the file
+//DB_LOG_FILE exists and every change sdbsc makes to DB_FILE is appended to it
+//as a fixed size log_rec_t with the next log sequence number (lsn).  The log
+//starts with a LOG_RESET and a LOG_PUT for every student, so replaying it
+//from its first lsn rebuilds the whole table.  Operations that rewrite the
+//table (-z, -x, -I, -R) replace the log with a new snapshot that continues
+//the lsn sequence.  A sharded database logs the same records, the slot
+//numbers do not depend on the layout.
+//
+//The leader streams the log over TCP.  A follower sends the next lsn it
+//needs, lsns still in the log are streamed from their offset
+//(sizeof(log_hdr_t) + (lsn - first_lsn) * sizeof(log_rec_t)), anything older
+//or from another log restarts from the snapshot at the head of the log.
+//While idle the leader sends heartbeats carrying its last lsn, which the
+//follower uses to report its lag.  The follower applies records to the
+//database in its own directory, sharded or not, and remembers the last
+//applied lsn in DB_LSN_FILE.
+#define REPL_LOG_MAGIC      "SDBLOG1"
+#define REPL_HELLO_MAGIC    "SDBREPL"
+#define REPL_BATCH          256         //log records per read/send
+#define REPL_POLL_MS        50          //leader poll interval while idle
+#define REPL_HEARTBEAT_MS   1000        //leader heartbeat interval while idle
+
+typedef enum log_op {
+    LOG_PUT = 1,                        //slot now holds s
+    LOG_RESET,                          //table cleared, file is db_size zeros
+    LOG_HEARTBEAT,                      //lsn is the last lsn of the leader
+} log_op_t;
+
+typedef struct log_rec {
+    uint64_t  lsn;
+    uint32_t  op;                       //log_op_t
+    uint32_t  slot;                     //student slot, id - 1
+    uint64_t  db_size;                  //database file size after the change
+    student_t s;
+} log_rec_t;
+
+typedef struct log_hdr {
+    char      magic[8];                 //REPL_LOG_MAGIC
+    uint64_t  first_lsn;                //lsn of the first record
+    uint64_t  log_id;                   //kept when the log is replaced
+    char      pad[sizeof(log_rec_t) - 24];
+} log_hdr_t;
+
+//sent by the follower with the lsn it needs and answered by the leader with
+//the lsn it starts streaming from
+typedef struct repl_hello {
+    char      magic[8];                 //REPL_HELLO_MAGIC
+    uint64_t  log_id;                   //log the lsn belongs to
+    uint64_t  next_lsn;
+} repl_hello_t;
+
+//contents of DB_LSN_FILE on a follower
+typedef struct repl_state {
+    uint64_t  log_id;
+    uint64_t  applied_lsn;              //last lsn applied to DB_FILE
+} repl_state_t;
+
+//prototypes for replication, see sdbrepl.c for documentation
+int repl_log_slot(int db_fd, int slot);
+int repl_log_reset(int db_fd);
+int repl_log_reset_ranges(const int fds[], int nfds, int slots_per_fd);
+int repl_leader(int db_fd, int port);
+int repl_leader_ranges(const int fds[], int nfds, int slots_per_fd, int port);
+int repl_follower(int db_fd, const char *host, int port);
+int repl_follower_ranges(const int fds[], int nfds, int slots_per_fd, const char *host, int port);
+
+#endif
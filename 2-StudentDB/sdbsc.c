@@ -5,10 +5,21 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/mman.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
+#include "sdbfmt.h"
+#include "sdbshm.h"
+#include "sdbshard.h"
+#include "sdbcsv.h"
+#include "sdbcol.h"
+#include "sdbpgen.h"
+#include "sdbrepl.h"
+#include "sdbquery.h"
+#include "sdbcache.h"
 
 /*
  *  open_db
@@ -173,6 +184,23 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
     }
     
     printf(M_STD_ADDED, id);
+
+    // stamp the page for the next incremental backup
+    if (pgen_mark(offset, STUDENT_RECORD_SIZE) != NO_ERROR)
+        printf(M_ERR_PGEN);
+
+    // keep the shared memory copy, if one is published, in sync
+    if (shm_db_mirror(id, &new_student) != NO_ERROR)
+        printf(M_ERR_SHM);
+
+    // ship the change to followers, if a leader was started
+    if (repl_log_slot(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_REPL_LOG);
+
+    // patch the slot in the column cache, if one was built
+    if (colcache_patch(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_COLCACHE);
+
     return NO_ERROR;
 }
 
@@ -225,9 +253,281 @@ int del_student(int fd, int id)
     }
     
     printf(M_STD_DEL_MSG, id);
+
+    // stamp the page for the next incremental backup
+    if (pgen_mark(offset, STUDENT_RECORD_SIZE) != NO_ERROR)
+        printf(M_ERR_PGEN);
+
+    // keep the shared memory copy, if one is published, in sync
+    if (shm_db_mirror(id, &EMPTY_STUDENT_RECORD) != NO_ERROR)
+        printf(M_ERR_SHM);
+
+    // ship the change to followers, if a leader was started
+    if (repl_log_slot(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_REPL_LOG);
+
+    // patch the slot in the column cache, if one was built
+    if (colcache_patch(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_COLCACHE);
+
     return NO_ERROR;
 }
 
+/*
+ *  update_student
+ *      fd:      linux file descriptor
+ *      id:      student id to be updated
+ *      upd:     student_t holding the new values of the selected fields
+ *      fields:  bit mask of UPD_FNAME, UPD_LNAME and UPD_GPA
+ *
+ *  Changes fields of an existing student in place.  Instead of reading the
+ *  whole record and writing all 64 bytes back, the id field of the slot is
+ *  read with a single pread() to check that the student exists and then
+ *  each selected field is written with one pwrite() at its offsetof()
+ *  inside student_t.  Name fields are written in full so that the old name
+ *  is cleared.  The caller is responsible for validating the new values.
+ *
+ *  returns:  NO_ERROR       student updated
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      student not in database
+ *
+ *  console:  M_STD_UPDATED      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be updated
+ *            M_ERR_DB_READ      error reading the database file
+ *            M_ERR_DB_WRITE     error writing to db file
+ */
+int update_student(int fd, int id, student_t *upd, int fields)
+{
+    static const struct {
+        int     flag;
+        size_t  off;
+        size_t  len;
+    } upd_fields[] = {
+        {UPD_FNAME, offsetof(student_t, fname), sizeof(((student_t *)0)->fname)},
+        {UPD_LNAME, offsetof(student_t, lname), sizeof(((student_t *)0)->lname)},
+        {UPD_GPA,   offsetof(student_t, gpa),   sizeof(((student_t *)0)->gpa)},
+    };
+    off_t offset = (off_t)(id - 1) * STUDENT_RECORD_SIZE;
+    int stored_id = DELETED_STUDENT_ID;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID) {
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    }
+
+    // the only check needed, an empty or deleted slot never holds this id
+    ssize_t bytes_read = pread(fd, &stored_id, sizeof(stored_id),
+                               offset + offsetof(student_t, id));
+    if (bytes_read == -1) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (bytes_read != sizeof(stored_id) || stored_id != id) {
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    }
+
+    for (size_t i = 0; i < sizeof(upd_fields) / sizeof(upd_fields[0]); i++) {
+        if (!(fields & upd_fields[i].flag))
+            continue;
+
+        const char *data = (const char *)upd + upd_fields[i].off;
+        if (pwrite(fd, data, upd_fields[i].len, offset + upd_fields[i].off) !=
+            (ssize_t)upd_fields[i].len) {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+
+        // stamp the page for the next incremental backup
+        if (pgen_mark(offset + upd_fields[i].off, upd_fields[i].len) != NO_ERROR)
+            printf(M_ERR_PGEN);
+
+        // keep the shared memory copy, if one is published, in sync
+        if (shm_db_mirror_field(id, upd_fields[i].off, data, upd_fields[i].len) != NO_ERROR)
+            printf(M_ERR_SHM);
+    }
+
+    printf(M_STD_UPDATED, id);
+
+    // ship the change to followers, if a leader was started
+    if (repl_log_slot(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_REPL_LOG);
+
+    // patch the slot in the column cache, if one was built
+    if (colcache_patch(fd, id - 1) != NO_ERROR)
+        printf(M_ERR_COLCACHE);
+    return NO_ERROR;
+}
+
+/*
+ *  apply_row
+ *
+ *  csv_row_fn used by import_csv().  Applies the add_student() rules to the
+ *  in memory table: the id and gpa must pass validate_range() and the slot
+ *  must be empty, otherwise the row is rejected.
+ */
+static void apply_row(void *arg, const student_t *s, int line_no)
+{
+    csv_import_t *imp = (csv_import_t *)arg;
+    (void)line_no;
+
+    if (s == NULL || validate_range(s->id, s->gpa) != NO_ERROR ||
+        memcmp(&imp->tbl[s->id - 1], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
+        imp->rejected++;
+        return;
+    }
+
+    imp->tbl[s->id - 1] = *s;
+    imp->dirty[(s->id - 1) / CSV_CHUNK_SLOTS] = 1;
+    imp->imported++;
+}
+
+/*
+ *  import_csv
+ *      fd:        linux file descriptor of the database
+ *      csv_file:  path of the CSV file to load
+ *
+ *  Loads the current table into memory with large reads, applies every CSV
+ *  row to it and writes back only the chunks of CSV_CHUNK_SLOTS records
+ *  that changed, one pwrite() per chunk.  The database file is then sized
+ *  like add_student() leaves it.  A published shared memory copy is
+ *  refreshed afterwards.
+ *
+ *  returns:  <number>       number of students imported
+ *            ERR_DB_FILE    database or CSV file I/O issue
+ *
+ *  console:  M_CSV_IMPORTED   on success
+ *            M_CSV_REJECTED   if rows were skipped
+ *            M_ERR_CSV_OPEN   CSV file cannot be opened or mapped
+ *            M_ERR_DB_READ    error reading the database file
+ *            M_ERR_DB_WRITE   error writing to the database file
+ */
+int import_csv(int fd, const char *csv_file)
+{
+    return import_csv_ranges(&fd, 1, MAX_STD_ID, csv_file);
+}
+
+/*
+ *  import_csv_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *      csv_file:      path of the CSV file to load
+ *
+ *  Same as import_csv() for a database split over several files, as a
+ *  sharded one is.  Every file is only read and written inside its own
+ *  range, a chunk that straddles two ranges is written in two parts.
+ *
+ *  returns:  same as import_csv()
+ *
+ *  console:  same as import_csv()
+ */
+int import_csv_ranges(const int fds[], int nfds, int slots_per_fd, const char *csv_file)
+{
+    size_t tbl_len = (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE;
+    int nchunks = (MAX_STD_ID + CSV_CHUNK_SLOTS - 1) / CSV_CHUNK_SLOTS;
+    csv_import_t imp = {0};
+    struct stat st, db_st;
+    char *csv = NULL;
+    int rc = ERR_DB_FILE;
+    int csv_fd;
+
+    csv_fd = open(csv_file, O_RDONLY);
+    if (csv_fd == -1 || fstat(csv_fd, &st) == -1) {
+        printf(M_ERR_CSV_OPEN, csv_file);
+        if (csv_fd != -1)
+            close(csv_fd);
+        return ERR_DB_FILE;
+    }
+    if (st.st_size > 0) {
+        csv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, csv_fd, 0);
+        if (csv == MAP_FAILED) {
+            printf(M_ERR_CSV_OPEN, csv_file);
+            close(csv_fd);
+            return ERR_DB_FILE;
+        }
+        madvise(csv, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+
+    imp.tbl = calloc(1, tbl_len);
+    imp.dirty = calloc((size_t)nchunks, 1);
+    if (imp.tbl == NULL || imp.dirty == NULL) {
+        printf(M_ERR_DB_READ);
+        goto done;
+    }
+
+    // current contents, whatever lies past the end of a file stays zero
+    for (int i = 0; i < nfds; i++) {
+        size_t first = (size_t)i * slots_per_fd * STUDENT_RECORD_SIZE;
+        size_t end = first + (size_t)slots_per_fd * STUDENT_RECORD_SIZE;
+        if (end > tbl_len)
+            end = tbl_len;
+
+        for (size_t off = first; off < end; ) {
+            ssize_t got = pread(fds[i], (char *)imp.tbl + off, end - off, (off_t)off);
+            if (got == -1) {
+                printf(M_ERR_DB_READ);
+                goto done;
+            }
+            if (got == 0)
+                break;
+            off += (size_t)got;
+        }
+    }
+
+    if (csv != NULL)
+        csv_parse(csv, (size_t)st.st_size, apply_row, &imp);
+
+    for (int c = 0; c < nchunks; c++) {
+        if (!imp.dirty[c])
+            continue;
+        int chunk_end = (c + 1) * CSV_CHUNK_SLOTS < MAX_STD_ID ? (c + 1) * CSV_CHUNK_SLOTS : MAX_STD_ID;
+
+        for (int first = c * CSV_CHUNK_SLOTS; first < chunk_end; ) {
+            int i = first / slots_per_fd;
+            int n = ((i + 1) * slots_per_fd < chunk_end ? (i + 1) * slots_per_fd : chunk_end) - first;
+            size_t bytes = (size_t)n * STUDENT_RECORD_SIZE;
+            off_t off = (off_t)first * STUDENT_RECORD_SIZE;
+            if (pwrite(fds[i], &imp.tbl[first], bytes, off) != (ssize_t)bytes) {
+                printf(M_ERR_DB_WRITE);
+                goto done;
+            }
+            if (pgen_mark(off, bytes) != NO_ERROR)
+                printf(M_ERR_PGEN);
+            first += n;
+        }
+    }
+
+    if (imp.imported > 0) {
+        for (int i = 0; i < nfds; i++) {
+            if (fstat(fds[i], &db_st) == -1 ||
+                ((size_t)db_st.st_size < tbl_len && ftruncate(fds[i], (off_t)tbl_len) == -1)) {
+                printf(M_ERR_DB_WRITE);
+                goto done;
+            }
+        }
+        if (shm_db_exists() && shm_db_publish_ranges(fds, nfds, slots_per_fd) < 0)
+            printf(M_ERR_SHM);
+        if (repl_log_reset_ranges(fds, nfds, slots_per_fd) != NO_ERROR)
+            printf(M_ERR_REPL_LOG);
+        if (colcache_invalidate() != NO_ERROR)
+            printf(M_ERR_COLCACHE);
+    }
+
+    printf(M_CSV_IMPORTED, imp.imported, csv_file);
+    if (imp.rejected > 0)
+        printf(M_CSV_REJECTED, imp.rejected);
+    rc = imp.imported;
+
+done:
+    if (csv != NULL)
+        munmap(csv, (size_t)st.st_size);
+    close(csv_fd);
+    free(imp.tbl);
+    free(imp.dirty);
+    return rc;
+}
+
 /*
  *  count_db_records
  *      fd:     linux file descriptor
@@ -323,6 +623,7 @@ int print_db(int fd)
     student_t student = {0};
     bool header_printed = false;
     bool records_found = false;
+    out_buff_t out;
     
     // Seek to beginning of file
     if (lseek(fd, 0, SEEK_SET) == -1) {
@@ -330,19 +631,26 @@ int print_db(int fd)
         return ERR_DB_FILE;
     }
     
+    // Rows are formatted by the printf-free writer in sdbfmt.c, the bytes
+    // are identical to STUDENT_PRINT_HDR_STRING/STUDENT_PRINT_FMT_STRING
+    ob_init(&out, STDOUT_FILENO);
+
     ssize_t bytes_read;
     while ((bytes_read = read(fd, &student, STUDENT_RECORD_SIZE)) == STUDENT_RECORD_SIZE) {
         if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
             if (!header_printed) {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+                ob_write_hdr(&out);
                 header_printed = true;
             }
             records_found = true;
-            float gpa = student.gpa / 100.0;
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, gpa);
+            ob_write_student(&out, &student);
         }
     }
     
+    if (ob_flush(&out) != NO_ERROR) {
+        return ERR_DB_FILE;
+    }
+
     if (bytes_read == -1) {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
@@ -390,9 +698,11 @@ void print_student(student_t *s)
         return;
     }
     
-    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-    float gpa = s->gpa / 100.0;
-    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, gpa);
+    out_buff_t out;
+    ob_init(&out, STDOUT_FILENO);
+    ob_write_hdr(&out);
+    ob_write_student(&out, s);
+    ob_flush(&out);
 }
 
 /*
@@ -448,6 +758,9 @@ int compress_db(int fd)
     // TODO
     student_t student = {0};
     int tmp_fd;
+    // asked before the rename below gives DB_FILE a new inode, after it
+    // the published segment no longer counts as this database's
+    bool published = shm_db_exists();
     
     // Create temporary file
     tmp_fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, 
@@ -500,6 +813,19 @@ int compress_db(int fd)
     }
     
     printf(M_DB_COMPRESSED_OK);
+
+    // every record moved, the next backup has to rewrite every page
+    if (pgen_mark(0, (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE) != NO_ERROR)
+        printf(M_ERR_PGEN);
+
+    if (published && shm_db_publish(fd) < 0)
+        printf(M_ERR_SHM);
+
+    // records moved to new slots, followers start over from a snapshot
+    if (repl_log_reset(fd) != NO_ERROR)
+        printf(M_ERR_REPL_LOG);
+    if (colcache_invalidate() != NO_ERROR)
+        printf(M_ERR_COLCACHE);
     return fd;
 }
 
@@ -530,6 +856,68 @@ int validate_range(int id, int gpa)
     return NO_ERROR;
 }
 
+/*
+ *  parse_update_args
+ *      nargs:   number of field=value arguments
+ *      args:    the field=value arguments, the '=' is overwritten
+ *      upd:     receives the new values of the named fields
+ *      fields:  receives the UPD_* bit mask of the named fields
+ *
+ *  Collects every field=value pair of the -u option before the database is
+ *  touched so that a bad argument never leaves a partial update behind.
+ *
+ *  returns:    EXIT_OK         all arguments are valid
+ *              EXIT_FAIL_ARGS  unknown field, missing '=' or gpa out of range
+ *
+ *  console:  M_ERR_UPD_FIELD  unknown field or missing '='
+ *            M_ERR_UPD_RNG    gpa out of range
+ */
+int parse_update_args(int nargs, char *args[], student_t *upd, int *fields)
+{
+    *fields = 0;
+    for (int i = 0; i < nargs; i++)
+    {
+        char *value = strchr(args[i], '=');
+        if (value == NULL)
+        {
+            printf(M_ERR_UPD_FIELD);
+            return EXIT_FAIL_ARGS;
+        }
+        *value++ = '\0';
+
+        if (strcmp(args[i], "fname") == 0)
+        {
+            memset(upd->fname, 0, sizeof(upd->fname));
+            strncpy(upd->fname, value, sizeof(upd->fname) - 1);
+            *fields |= UPD_FNAME;
+        }
+        else if (strcmp(args[i], "lname") == 0)
+        {
+            memset(upd->lname, 0, sizeof(upd->lname));
+            strncpy(upd->lname, value, sizeof(upd->lname) - 1);
+            *fields |= UPD_LNAME;
+        }
+        else if (strcmp(args[i], "gpa") == 0)
+        {
+            upd->gpa = atoi(value);
+            *fields |= UPD_GPA;
+        }
+        else
+        {
+            printf(M_ERR_UPD_FIELD);
+            return EXIT_FAIL_ARGS;
+        }
+    }
+
+    // the id is checked against the database by update_student()
+    if ((*fields & UPD_GPA) && validate_range(MIN_STD_ID, upd->gpa) != NO_ERROR)
+    {
+        printf(M_ERR_UPD_RNG);
+        return EXIT_FAIL_ARGS;
+    }
+    return EXIT_OK;
+}
+
 /*
  *  usage
  *      exename:  the name of the executable from argv[0]
@@ -543,15 +931,27 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|c|d|f|u|p|q|g|z|I|E|B|R|L|F|n|m|M] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-u id field=value...:  updates fname=, lname= or gpa= of a student in place\n");
     printf("\t-p:  prints all records in the student database\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-I file.csv:  bulk imports id,first_name,last_name,gpa rows\n");
+    printf("\t-q query:  prints students matching a query like \"gpa>=350 and lname^=D\"\n");
+    printf("\t-g [query]:  prints gpa count, min, max and average\n");
+    printf("\t-E out.col:  exports a columnar snapshot for analytics\n");
+    printf("\t-B dir:  writes an incremental backup of the changed pages to dir\n");
+    printf("\t-R dir:  restores the database from the backups in dir\n");
+    printf("\t-L port:  ships every change to followers connecting on port\n");
+    printf("\t-F host port:  follows a leader into the local database\n");
+    printf("\t-n count [dir...]:  shard the database by id range over count files\n");
+    printf("\t-m:  publish the database to shared memory for fast lookups\n");
+    printf("\t-M:  remove the shared memory copy of the database\n");
 }
 
 // Welcome to main()
@@ -563,12 +963,17 @@ int main(int argc, char *argv[])
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    int fields;    // fields to change for -u
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
     // and print_student().
     student_t student = {0};
 
+    // view of the shared memory copy of the database used by -f when one
+    // has been published with -m
+    stu_table_t shm_tbl = {.fd = -1};
+
     // This function must have at least one arg, and the arg must start
     // with a dash
     if ((argc < 2) || (*argv[1] != '-'))
@@ -578,7 +983,7 @@ int main(int argc, char *argv[])
     }
 
     // The option is the first character after the dash for example
-    //-h -a -c -d -f -p -x -z
+    //-h -a -c -d -f -u -p -q -g -x -z -I -E -B -R -L -F -n -m -M
     opt = (char)*(argv[1] + 1); // get the option flag
 
     // handle the help flag and then exit normally
@@ -588,6 +993,13 @@ int main(int argc, char *argv[])
         exit(EXIT_OK);
     }
 
+    // a sharded database keeps its records in the shard files listed in
+    // the manifest, every operation is routed through sdbshard.c
+    if (opt != 'n' && shard_db_exists())
+    {
+        exit(shard_run(argc, argv));
+    }
+
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
     // parameter
@@ -674,7 +1086,17 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
+
+        // prefer the published shared memory copy, the lookup is then
+        // just a read of the mapped segment instead of a syscall.  The file
+        // is read when there is no segment or the slot was left half written
+        rc = ERR_DB_FILE;
+        if (shm_db_attach(&shm_tbl, false) == NO_ERROR) {
+            rc = tbl_get_student(&shm_tbl, id, &student);
+            shm_db_detach(&shm_tbl);
+        }
+        if (rc == ERR_DB_FILE)
+            rc = get_student(fd, id, &student);
 
         switch (rc)
         {
@@ -692,6 +1114,27 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'u':
+        //   arv[0] arv[1]  arv[2]       arv[3]     arv[n]
+        // prog_name     -u      id  field=value        ...
+        //-------------------------------------------------
+        // example:  prog_name -u 100 gpa=355 lname=Smith
+        if (argc < 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        exit_code = parse_update_args(argc - 3, argv + 3, &student, &fields);
+        if (exit_code != EXIT_OK)
+            break;
+
+        rc = update_student(fd, id, &student, fields);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
         //    arv[0] arv[1]
         // prog_name     -p
@@ -702,6 +1145,42 @@ int main(int argc, char *argv[])
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 'q':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -q   query
+        //-------------------------
+        // example:  prog_name -q "gpa>=350 and lname^=D"
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_db(fd, argv[2]);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        //    arv[0] arv[1]    arv[2]
+        // prog_name     -g  [query]
+        //--------------------------
+        // example:  prog_name -g "lname^=D"
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_gpa_stats(fd, (argc == 3) ? argv[2] : NULL);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'x':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -731,6 +1210,146 @@ int main(int argc, char *argv[])
         }
         printf(M_DB_ZERO_OK);
         exit_code = EXIT_OK;
+
+        // the next backup has to record the zeroed pages
+        if (pgen_mark(0, (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE) != NO_ERROR)
+            printf(M_ERR_PGEN);
+
+        // a published shared memory copy must not keep the old records
+        if (shm_db_exists() && shm_db_publish(fd) < 0)
+            exit_code = EXIT_FAIL_DB;
+
+        // followers start over from the empty table
+        if (repl_log_reset(fd) != NO_ERROR)
+            printf(M_ERR_REPL_LOG);
+        if (colcache_invalidate() != NO_ERROR)
+            printf(M_ERR_COLCACHE);
+        break;
+
+    case 'I':
+        //    arv[0] arv[1]     arv[2]
+        // prog_name     -I   file.csv
+        //-----------------------------
+        // example:  prog_name -I students.csv
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = import_csv(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'E':
+        //    arv[0] arv[1]   arv[2]
+        // prog_name     -E  out.col
+        //---------------------------
+        // example:  prog_name -E students.col
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = export_columns(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'B':
+    case 'R':
+        //    arv[0] arv[1] arv[2]
+        // prog_name  -B|-R    dir
+        //------------------------
+        // example:  prog_name -B /backups/students
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = (opt == 'B') ? backup_db(fd, argv[2]) : restore_db(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'L':
+        //    arv[0] arv[1] arv[2]
+        // prog_name     -L   port
+        //------------------------
+        // example:  prog_name -L 7070
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        // a leader serves until it fails, returning at all is a failure
+        if (repl_leader(fd, atoi(argv[2])) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'F':
+        //    arv[0] arv[1]     arv[2] arv[3]
+        // prog_name     -F       host   port
+        //-----------------------------------
+        // example:  prog_name -F localhost 7070
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (repl_follower(fd, argv[2], atoi(argv[3])) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'n':
+        //   arv[0] arv[1]  arv[2]  arv[3]  arv[n]
+        // prog_name     -n   count    dir1     ...
+        //----------------------------------------
+        // example:  prog_name -n 4 /disk1 /disk2
+        if (argc < 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = shard_db_create(fd, atoi(argv[2]), argv + 3, argc - 3);
+        if (rc < 0)
+        {
+            exit_code = (rc == ERR_DB_OP) ? EXIT_FAIL_ARGS : EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_SHARD_CREATED, atoi(argv[2]), rc);
+        break;
+
+    case 'm':
+        //    arv[0] arv[1]
+        // prog_name     -m
+        //-----------------
+        // example:  prog_name -m
+        rc = shm_db_publish(fd);
+        if (rc < 0) {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_SHM_PUBLISHED, rc);
+        break;
+
+    case 'M':
+        //    arv[0] arv[1]
+        // prog_name     -M
+        //-----------------
+        // example:  prog_name -M
+        if (shm_db_unlink() != NO_ERROR) {
+            printf(M_SHM_NOT_FOUND);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_SHM_REMOVED);
         break;
     default:
         usage(argv[0]);
@@ -1,4 +1,7 @@
 #ifndef __SDB_H__
+    #define __SDB_H__
+
+#include <stdbool.h>
 
 #include "db.h" //get student record type
 
@@ -7,13 +10,22 @@ int open_db(char *dbFile, bool should_truncate);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
+int update_student(int fd, int id, student_t *upd, int fields);
+int import_csv(int fd, const char *csv_file);
+int import_csv_ranges(const int fds[], int nfds, int slots_per_fd, const char *csv_file);
 int compress_db(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
+int parse_update_args(int nargs, char *args[], student_t *upd, int *fields);
 int count_db_records(int fd);
 int print_db(int fd);
 void usage(char *);
 
+//fields that update_student() can change in place, combined as a bit mask
+#define UPD_FNAME       0x01
+#define UPD_LNAME       0x02
+#define UPD_GPA         0x04
+
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
 // ERR_DB_FILE is returned if there is are any issues with the database file itself
@@ -44,8 +56,26 @@ void usage(char *);
 #define M_ERR_DB_WRITE    "Error writing DB file, exiting!\n"
 #define M_ERR_DB_ADD_DUP  "Cant add student with ID=%d, already exists in db.\n"
 #define M_ERR_STD_PRINT   "Cant print student. Student is NULL or ID is zero\n"
+#define M_ERR_UPD_FIELD   "Cant update student, expected fname=<s>, lname=<s> or gpa=<n>!\n"
+#define M_ERR_UPD_RNG     "Cant update student, GPA out of allowable range!\n"
+#define M_ERR_SHARD_EXISTS "Database is already sharded!\n"
+#define M_ERR_SHARD_CNT   "Shard count must be between 1 and %d!\n"
+#define M_ERR_SHARD_MANIFEST "Error reading shard manifest, exiting!\n"
+#define M_ERR_CSV_OPEN    "Error opening CSV file %s!\n"
+#define M_ERR_COL_WRITE   "Error writing column file %s!\n"
+#define M_ERR_PGEN        "Error recording page generations, next backup may miss this change!\n"
+#define M_ERR_BACKUP      "Error writing backup to %s!\n"
+#define M_ERR_RESTORE     "No complete backup chain found in %s!\n"
+#define M_ERR_REPL_LOG    "Error writing replication log, followers may miss this change!\n"
+#define M_ERR_REPL_LISTEN "Cant accept followers on port %d!\n"
+#define M_ERR_REPL_CONN   "Cant connect to replication leader %s:%d!\n"
+#define M_ERR_QUERY       "Cant parse query at '%s'!\n"
+#define M_ERR_COLCACHE    "Error updating column cache!\n"
+#define M_ERR_SHM         "Error accessing shared memory segment!\n"
+#define M_ERR_LOOKUP      "Error allocating lookup table!\n"
 
 #define M_STD_ADDED       "Student %d added to database.\n"
+#define M_STD_UPDATED     "Student %d updated in database.\n"
 #define M_STD_DEL_MSG     "Student %d was deleted from database.\n"
 #define M_STD_NOT_FND_MSG "Student %d was not found in database.\n"
 #define M_DB_COMPRESSED_OK "Database successfully compressed!\n"
@@ -53,6 +83,23 @@ void usage(char *);
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_SHARD_CREATED   "Created sharded database with %d shard(s), moved %d student record(s).\n"
+#define M_CSV_IMPORTED    "Imported %d student record(s) from %s.\n"
+#define M_CSV_REJECTED    "Skipped %d invalid or duplicate row(s).\n"
+#define M_COL_EXPORTED    "Exported %d student record(s) to %s.\n"
+#define M_BACKUP_FULL     "Full backup %u of %d page(s) written to %s.\n"
+#define M_BACKUP_INCR     "Incremental backup %u of %d changed page(s) written to %s.\n"
+#define M_RESTORED        "Restored database from %d backup(s) in %s.\n"
+#define M_REPL_LEADER     "Replication leader on port %d, log at lsn %llu.\n"
+#define M_REPL_PEER       "Follower %s streaming from lsn %llu.\n"
+#define M_REPL_FOLLOWING  "Following %s:%d from lsn %llu.\n"
+#define M_REPL_LAG        "Replica at lsn %llu, lag %llu record(s).\n"
+#define M_REPL_CLOSED     "Replication stream closed at lsn %llu.\n"
+#define M_QUERY_NONE      "No student records match the query.\n"
+#define M_GPA_STATS       "%d student(s), gpa min %.2f, max %.2f, avg %.2f\n"
+#define M_SHM_PUBLISHED   "Published %d student record(s) to shared memory.\n"
+#define M_SHM_REMOVED     "Shared memory copy removed.\n"
+#define M_SHM_NOT_FOUND   "No shared memory copy is published.\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbfmt.h"
+#include "sdbshm.h"
+#include "sdbshard.h"
+#include "sdbpgen.h"
+#include "sdbcache.h"
+#include "sdbcol.h"
+#include "sdbrepl.h"
+#include "sdbquery.h"
+
+#define SCAN_BATCH      1024    //records read per pread() while scanning
+
+//work item for one shard during a parallel scan
+typedef struct shard_scan {
+    int     fd;
+    int     first_slot;         //first slot of the shard's id range
+    int     nslots;             //number of slots in the range
+    bool    format;             //also format the rows for print_db
+    int     count;              //out: records found
+    int     rc;                 //out: NO_ERROR or ERR_DB_FILE
+    char    *out;               //out: formatted rows when format is set
+    size_t  out_len;
+    size_t  out_cap;
+} shard_scan_t;
+
+/*
+ *  shard_db_exists
+ *
+ *  returns:  true if the database in the current directory is sharded
+ */
+bool shard_db_exists(void)
+{
+    return access(DB_MANIFEST_FILE, F_OK) == 0;
+}
+
+/*
+ *  shard_db_create
+ *      db_fd:    linux file descriptor of the (unsharded) database file
+ *      nshards:  number of shards, 1..SHARD_MAX
+ *      dirs:     directories the shard files are spread over round robin,
+ *                may be NULL to put every shard in the current directory
+ *      ndirs:    number of entries in dirs
+ *
+ *  Creates the shard files and the manifest DB_MANIFEST_FILE.  Any records
+ *  already in the database file are moved into their shard and the database
+ *  file is emptied, from then on every operation goes through the manifest.
+ *  The manifest is written to a temporary file and renamed into place so a
+ *  crash never leaves a half written layout behind.
+ *
+ *  returns:  <number>       number of student records moved into shards
+ *            ERR_DB_FILE    database or shard file I/O issue
+ *            ERR_DB_OP      already sharded or bad shard count
+ *
+ *  console:  M_ERR_SHARD_EXISTS  database is already sharded
+ *            M_ERR_SHARD_CNT     nshards out of range
+ *            M_ERR_DB_CREATE     error creating a shard or the manifest
+ *            M_ERR_DB_READ       error reading the database file
+ *            M_ERR_DB_WRITE      error writing a shard file
+ */
+int shard_db_create(int db_fd, int nshards, char *dirs[], int ndirs)
+{
+    shard_db_t sdb = {0};
+    student_t batch[SCAN_BATCH];
+    char path[4096];
+    int moved = 0;
+    int rc = ERR_DB_FILE;
+    FILE *mf;
+
+    if (shard_db_exists()) {
+        printf(M_ERR_SHARD_EXISTS);
+        return ERR_DB_OP;
+    }
+    if (nshards < 1 || nshards > SHARD_MAX) {
+        printf(M_ERR_SHARD_CNT, SHARD_MAX);
+        return ERR_DB_OP;
+    }
+
+    sdb.nshards = nshards;
+    sdb.ids_per_shard = (MAX_STD_ID + nshards - 1) / nshards;
+    for (int i = 0; i < nshards; i++) {
+        const char *dir = (ndirs > 0) ? dirs[i % ndirs] : ".";
+        snprintf(path, sizeof(path), "%s/%s.%d", dir, DB_FILE, i);
+        sdb.paths[i] = strdup(path);
+        sdb.fds[i] = -1;
+        if (sdb.paths[i] == NULL)
+            goto done;
+
+        // same apparent size as an unsharded database, see add_student()
+        sdb.fds[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (sdb.fds[i] == -1 ||
+            ftruncate(sdb.fds[i], (off_t)MAX_STD_ID * STUDENT_RECORD_SIZE) == -1) {
+            printf(M_ERR_DB_CREATE);
+            goto done;
+        }
+    }
+
+    // move the records that are already in the database into their shard
+    for (int slot = 0; ; slot += SCAN_BATCH) {
+        ssize_t got = pread(db_fd, batch, sizeof(batch), (off_t)slot * STUDENT_RECORD_SIZE);
+        if (got == -1) {
+            printf(M_ERR_DB_READ);
+            goto done;
+        }
+        int n = (int)(got / STUDENT_RECORD_SIZE);
+        if (n == 0)
+            break;
+
+        for (int i = 0; i < n; i++) {
+            student_t *s = &batch[i];
+            if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0 ||
+                s->id != slot + i + 1)
+                continue;
+            int shard = shard_for_id(&sdb, s->id);
+            if (pwrite(sdb.fds[shard], s, STUDENT_RECORD_SIZE,
+                       (off_t)(s->id - 1) * STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE) {
+                printf(M_ERR_DB_WRITE);
+                goto done;
+            }
+            moved++;
+        }
+    }
+
+    mf = fopen(DB_MANIFEST_FILE ".tmp", "w");
+    if (mf == NULL) {
+        printf(M_ERR_DB_CREATE);
+        goto done;
+    }
+    fprintf(mf, "%s 1\n", SHARD_MANIFEST_TAG);
+    fprintf(mf, "shards %d ids_per_shard %d\n", sdb.nshards, sdb.ids_per_shard);
+    for (int i = 0; i < nshards; i++)
+        fprintf(mf, "%s\n", sdb.paths[i]);
+    if (fclose(mf) != 0 || rename(DB_MANIFEST_FILE ".tmp", DB_MANIFEST_FILE) == -1) {
+        printf(M_ERR_DB_CREATE);
+        goto done;
+    }
+
+    // the records now live in the shards
+    if (ftruncate(db_fd, 0) == -1) {
+        printf(M_ERR_DB_WRITE);
+        goto done;
+    }
+    if (colcache_invalidate() != NO_ERROR)
+        printf(M_ERR_COLCACHE);
+    // the published copy is reloaded from the files that now hold the records
+    if (shm_db_exists() && shm_db_publish_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard) < 0)
+        printf(M_ERR_SHM);
+    rc = moved;
+
+done:
+    shard_db_close(&sdb);
+    return rc;
+}
+
+/*
+ *  shard_db_open
+ *      sdb:  receives the layout and the open shard fds
+ *
+ *  Reads DB_MANIFEST_FILE and opens every shard file.
+ *
+ *  returns:  NO_ERROR       all shards open
+ *            ERR_DB_FILE    manifest unreadable or a shard cannot be opened
+ *
+ *  console:  M_ERR_SHARD_MANIFEST  manifest missing or malformed
+ *            M_ERR_DB_OPEN         a shard file cannot be opened
+ */
+int shard_db_open(shard_db_t *sdb)
+{
+    char line[4096];
+    int version;
+    FILE *mf;
+
+    memset(sdb, 0, sizeof(*sdb));
+    mf = fopen(DB_MANIFEST_FILE, "r");
+    if (mf == NULL) {
+        printf(M_ERR_SHARD_MANIFEST);
+        return ERR_DB_FILE;
+    }
+
+    if (fscanf(mf, SHARD_MANIFEST_TAG " %d\n", &version) != 1 || version != 1 ||
+        fscanf(mf, "shards %d ids_per_shard %d\n", &sdb->nshards, &sdb->ids_per_shard) != 2 ||
+        sdb->nshards < 1 || sdb->nshards > SHARD_MAX || sdb->ids_per_shard < 1) {
+        fclose(mf);
+        sdb->nshards = 0;
+        printf(M_ERR_SHARD_MANIFEST);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < sdb->nshards; i++)
+        sdb->fds[i] = -1;
+
+    for (int i = 0; i < sdb->nshards; i++) {
+        if (fgets(line, sizeof(line), mf) == NULL) {
+            fclose(mf);
+            shard_db_close(sdb);
+            printf(M_ERR_SHARD_MANIFEST);
+            return ERR_DB_FILE;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        sdb->paths[i] = strdup(line);
+        sdb->fds[i] = open(line, O_RDWR);
+        if (sdb->paths[i] == NULL || sdb->fds[i] == -1) {
+            fclose(mf);
+            shard_db_close(sdb);
+            printf(M_ERR_DB_OPEN);
+            return ERR_DB_FILE;
+        }
+    }
+
+    fclose(mf);
+    return NO_ERROR;
+}
+
+/*
+ *  shard_db_close
+ *      sdb:  layout returned by shard_db_open() or built by shard_db_create()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shard_db_close(shard_db_t *sdb)
+{
+    for (int i = 0; i < sdb->nshards; i++) {
+        if (sdb->fds[i] != -1)
+            close(sdb->fds[i]);
+        free(sdb->paths[i]);
+        sdb->fds[i] = -1;
+        sdb->paths[i] = NULL;
+    }
+    sdb->nshards = 0;
+}
+
+/*
+ *  shard_for_id
+ *      sdb:  open sharded database
+ *      id:   student id
+ *
+ *  returns:  index of the shard that holds id, or -1 if id is out of range
+ */
+int shard_for_id(shard_db_t *sdb, int id)
+{
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return -1;
+
+    int shard = (id - 1) / sdb->ids_per_shard;
+    return (shard < sdb->nshards) ? shard : -1;
+}
+
+/*
+ *  shard_range_fd
+ *      nfds:          number of database files
+ *      slots_per_fd:  file i holds the slots i * slots_per_fd and up, the
+ *                     last file also everything after its range
+ *      off:           byte offset in the database layout
+ *      end:           receives the end of the range of the returned file
+ *
+ *  The *_ranges() functions take the shard fds this way, an unsharded
+ *  database is the single file list {fd} with MAX_STD_ID slots.
+ *
+ *  returns:  index of the file that holds the byte at off
+ */
+int shard_range_fd(int nfds, int slots_per_fd, uint64_t off, uint64_t *end)
+{
+    uint64_t range = (uint64_t)slots_per_fd * STUDENT_RECORD_SIZE;
+    int i = (int)(off / range);
+
+    if (i >= nfds - 1) {
+        *end = UINT64_MAX;
+        return nfds - 1;
+    }
+    *end = (uint64_t)(i + 1) * range;
+    return i;
+}
+
+/*
+ *  shard_ranges_size
+ *      fds, nfds, slots_per_fd:  database files, see shard_range_fd()
+ *      size:                     receives the size of the database
+ *
+ *  The size of a database split over files is where the last byte any of
+ *  them holds inside its own range ends, every other byte reads as zero.
+ *  For a single file it is the file size.
+ *
+ *  returns:  NO_ERROR       size stored
+ *            ERR_DB_FILE    a file cannot be examined
+ */
+int shard_ranges_size(const int fds[], int nfds, int slots_per_fd, uint64_t *size)
+{
+    struct stat st;
+    uint64_t end;
+
+    *size = 0;
+    for (int i = 0; i < nfds; i++) {
+        uint64_t start = (uint64_t)i * slots_per_fd * STUDENT_RECORD_SIZE;
+        if (fstat(fds[i], &st) == -1)
+            return ERR_DB_FILE;
+        shard_range_fd(nfds, slots_per_fd, start, &end);
+        uint64_t held = (uint64_t)st.st_size < end ? (uint64_t)st.st_size : end;
+        if (held > start && held > *size)
+            *size = held;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  scan_shard
+ *      arg:  shard_scan_t describing the range to scan
+ *
+ *  Thread body of a parallel scan.  Reads the shard's id range in large
+ *  batches, counts the records and optionally formats them into a private
+ *  buffer that the caller writes out in shard order.
+ *
+ *  returns:  NULL, results are stored in the shard_scan_t
+ */
+static void *scan_shard(void *arg)
+{
+    shard_scan_t *job = (shard_scan_t *)arg;
+    student_t *batch = malloc(sizeof(student_t) * SCAN_BATCH);
+
+    job->rc = NO_ERROR;
+    if (batch == NULL) {
+        job->rc = ERR_DB_FILE;
+        return NULL;
+    }
+
+    for (int done = 0; done < job->nslots; done += SCAN_BATCH) {
+        int want = job->nslots - done < SCAN_BATCH ? job->nslots - done : SCAN_BATCH;
+        ssize_t got = pread(job->fd, batch, (size_t)want * STUDENT_RECORD_SIZE,
+                            (off_t)(job->first_slot + done) * STUDENT_RECORD_SIZE);
+        if (got == -1) {
+            job->rc = ERR_DB_FILE;
+            break;
+        }
+        int n = (int)(got / STUDENT_RECORD_SIZE);
+
+        for (int i = 0; i < n; i++) {
+            if (memcmp(&batch[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                continue;
+            job->count++;
+            if (!job->format)
+                continue;
+
+            if (job->out_cap - job->out_len < STUDENT_ROW_MAX) {
+                size_t cap = job->out_cap ? job->out_cap * 2 : OUT_BUFF_SZ;
+                char *out = realloc(job->out, cap);
+                if (out == NULL) {
+                    job->rc = ERR_DB_FILE;
+                    free(batch);
+                    return NULL;
+                }
+                job->out = out;
+                job->out_cap = cap;
+            }
+            job->out_len += fmt_student_row(job->out + job->out_len, &batch[i]);
+        }
+
+        if (n < want)
+            break;      //end of file
+    }
+
+    free(batch);
+    return NULL;
+}
+
+/*
+ *  run_scan
+ *      sdb:     open sharded database
+ *      jobs:    one shard_scan_t per shard, filled in by this function
+ *      format:  also format the rows
+ *
+ *  Scans all shards in parallel, one thread per shard.  If a thread cannot
+ *  be started its shard is scanned by the calling thread instead.
+ *
+ *  returns:  NO_ERROR       every shard scanned
+ *            ERR_DB_FILE    a shard could not be read
+ */
+static int run_scan(shard_db_t *sdb, shard_scan_t *jobs, bool format)
+{
+    pthread_t tids[SHARD_MAX];
+    bool started[SHARD_MAX];
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < sdb->nshards; i++) {
+        memset(&jobs[i], 0, sizeof(jobs[i]));
+        jobs[i].fd = sdb->fds[i];
+        jobs[i].first_slot = i * sdb->ids_per_shard;
+        jobs[i].nslots = sdb->ids_per_shard;
+        if (jobs[i].first_slot + jobs[i].nslots > MAX_STD_ID)
+            jobs[i].nslots = MAX_STD_ID - jobs[i].first_slot;
+        jobs[i].format = format;
+        started[i] = pthread_create(&tids[i], NULL, scan_shard, &jobs[i]) == 0;
+        if (!started[i])
+            scan_shard(&jobs[i]);
+    }
+
+    for (int i = 0; i < sdb->nshards; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        if (jobs[i].rc != NO_ERROR)
+            rc = ERR_DB_FILE;
+    }
+    return rc;
+}
+
+/*
+ *  shard_count_db_records
+ *      sdb:  open sharded database
+ *
+ *  Sharded version of count_db_records(), the shards are counted in
+ *  parallel.
+ *
+ *  returns:  <number>       number of records in the database
+ *            ERR_DB_FILE    shard file I/O issue
+ *
+ *  console:  same as count_db_records()
+ */
+int shard_count_db_records(shard_db_t *sdb)
+{
+    shard_scan_t jobs[SHARD_MAX];
+    int count = 0;
+
+    if (run_scan(sdb, jobs, false) != NO_ERROR) {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < sdb->nshards; i++)
+        count += jobs[i].count;
+
+    if (count == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, count);
+    return count;
+}
+
+/*
+ *  shard_print_db
+ *      sdb:  open sharded database
+ *
+ *  Sharded version of print_db().  Every shard formats its rows in parallel
+ *  and the results are written in shard order, so the output is identical
+ *  to the unsharded table.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    shard file I/O issue
+ *
+ *  console:  same as print_db()
+ */
+int shard_print_db(shard_db_t *sdb)
+{
+    shard_scan_t jobs[SHARD_MAX];
+    int rc = run_scan(sdb, jobs, true);
+    int count = 0;
+    out_buff_t out;
+
+    if (rc == NO_ERROR) {
+        for (int i = 0; i < sdb->nshards; i++)
+            count += jobs[i].count;
+
+        if (count == 0) {
+            printf(M_DB_EMPTY);
+        } else {
+            ob_init(&out, STDOUT_FILENO);
+            ob_write_hdr(&out);
+            for (int i = 0; i < sdb->nshards && rc == NO_ERROR; i++)
+                rc = ob_write_mem(&out, jobs[i].out, jobs[i].out_len);
+            if (ob_flush(&out) != NO_ERROR)
+                rc = ERR_DB_FILE;
+        }
+    } else {
+        printf(M_ERR_DB_READ);
+    }
+
+    for (int i = 0; i < sdb->nshards; i++)
+        free(jobs[i].out);
+    return rc;
+}
+
+/*
+ *  shard_zero_db
+ *      sdb:  open sharded database
+ *
+ *  Sharded version of the -z option, every shard file is truncated.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a shard could not be truncated
+ */
+int shard_zero_db(shard_db_t *sdb)
+{
+    for (int i = 0; i < sdb->nshards; i++) {
+        if (ftruncate(sdb->fds[i], 0) == -1)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shard_run
+ *      argc, argv:  the program arguments, same options as main()
+ *
+ *  main() hands the whole command over to this function when the database
+ *  is sharded.  Single record operations are routed to the shard that owns
+ *  the id and use the regular record functions on that shard's fd, scans
+ *  run over all shards in parallel.  The other table wide operations use
+ *  the *_ranges() version of their function with the list of shard fds.
+ *  Only -x is not available, compress moves records away from the slot
+ *  of their id and a shard is found by that slot.
+ *
+ *  returns:  exit code for the shell, see EXIT_* in sdbsc.h
+ */
+int shard_run(int argc, char *argv[])
+{
+    shard_db_t sdb;
+    student_t student = {0};
+    stu_table_t shm_tbl = {.fd = -1};
+    char opt = argv[1][1];
+    int exit_code = EXIT_OK;
+    int id, gpa, fields, shard, rc;
+
+    if (shard_db_open(&sdb) != NO_ERROR)
+        return EXIT_FAIL_DB;
+
+    switch (opt)
+    {
+    case 'a':
+        if (argc != 6)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        gpa = atoi(argv[5]);
+        if (validate_range(id, gpa) != NO_ERROR)
+        {
+            printf(M_ERR_STD_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        shard = shard_for_id(&sdb, id);
+        if (add_student(sdb.fds[shard], id, argv[3], argv[4], gpa) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'd':
+    case 'f':
+    case 'u':
+        if ((opt == 'u') ? argc < 4 : argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        if (opt == 'u')
+        {
+            exit_code = parse_update_args(argc - 3, argv + 3, &student, &fields);
+            if (exit_code != EXIT_OK)
+                break;
+        }
+
+        shard = shard_for_id(&sdb, id);
+        if (shard < 0)
+        {
+            printf(M_STD_NOT_FND_MSG, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+
+        if (opt == 'd')
+            rc = del_student(sdb.fds[shard], id);
+        else if (opt == 'u')
+            rc = update_student(sdb.fds[shard], id, &student, fields);
+        else
+        {
+            rc = ERR_DB_FILE;
+            if (shm_db_attach(&shm_tbl, false) == NO_ERROR)
+            {
+                rc = tbl_get_student(&shm_tbl, id, &student);
+                shm_db_detach(&shm_tbl);
+            }
+            if (rc == ERR_DB_FILE)
+                rc = get_student(sdb.fds[shard], id, &student);
+            if (rc == NO_ERROR)
+                print_student(&student);
+            else
+                printf(rc == SRCH_NOT_FOUND ? M_STD_NOT_FND_MSG : M_ERR_DB_READ, id);
+        }
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'c':
+        if (shard_count_db_records(&sdb) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'p':
+        if (shard_print_db(&sdb) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'z':
+        if (shard_zero_db(&sdb) != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        if (shm_db_exists() && shm_db_publish_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard) < 0)
+            printf(M_ERR_SHM);
+        printf(M_DB_ZERO_OK);
+
+        // the next backup has to record the zeroed pages
+        if (pgen_mark(0, (size_t)MAX_STD_ID * STUDENT_RECORD_SIZE) != NO_ERROR)
+            printf(M_ERR_PGEN);
+
+        // followers start over from the empty table
+        if (repl_log_reset_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard) != NO_ERROR)
+            printf(M_ERR_REPL_LOG);
+        break;
+
+    case 'n':
+        printf(M_ERR_SHARD_EXISTS);
+        exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'm':
+        // the segment keeps the unsharded layout, every shard fills its range
+        rc = shm_db_publish_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard);
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_SHM_PUBLISHED, rc);
+        break;
+
+    case 'I':
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (import_csv_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2]) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'E':
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (export_columns_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2]) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'B':
+    case 'R':
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (opt == 'B')
+            rc = backup_db_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2]);
+        else
+            rc = restore_db_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'L':
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        // a leader serves until it fails, returning at all is a failure
+        if (repl_leader_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, atoi(argv[2])) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'F':
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (repl_follower_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2], atoi(argv[3])) < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'q':
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_db_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard, argv[2]);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = query_gpa_stats_ranges(sdb.fds, sdb.nshards, sdb.ids_per_shard,
+                                    (argc == 3) ? argv[2] : NULL);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'M':
+        if (shm_db_unlink() != NO_ERROR)
+        {
+            printf(M_SHM_NOT_FOUND);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        printf(M_SHM_REMOVED);
+        break;
+
+    case 'x':
+        printf(M_NOT_IMPL);
+        exit_code = EXIT_NOT_IMPL;
+        break;
+
+    default:
+        usage(argv[0]);
+        exit_code = EXIT_FAIL_ARGS;
+    }
+
+    shard_db_close(&sdb);
+    return exit_code;
+}
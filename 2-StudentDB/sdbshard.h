@@ -0,0 +1,43 @@
+#ifndef __SDBSHARD_H__
+    #define __SDBSHARD_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "db.h" //get student record type
+
+//Id range sharding.  When DB_MANIFEST_FILE exists the records do not live in
+//DB_FILE but in N shard files, shard i holding the ids
+//
+//      i * ids_per_shard + 1  ..  (i + 1) * ids_per_shard
+//
+//Every shard file keeps the regular file layout (slot = id - 1) and only
+//ever writes inside its own id range, the rest of the file is a sparse hole.
+//That way get_student(), add_student(), del_student() and update_student()
+//work unchanged on a shard fd, routing an id is just picking the fd, and a
+//scan of a shard only reads its own range.  Shards can be placed in
+//different directories (disks) when the database is created.
+#define SHARD_MAX           64          //most shards a database can have
+#define SHARD_MANIFEST_TAG  "sdbsc-shards"
+
+typedef struct shard_db {
+    int     nshards;
+    int     ids_per_shard;
+    char    *paths[SHARD_MAX];
+    int     fds[SHARD_MAX];
+} shard_db_t;
+
+//prototypes for sharding, see sdbshard.c for documentation
+bool shard_db_exists(void);
+int shard_db_create(int db_fd, int nshards, char *dirs[], int ndirs);
+int shard_db_open(shard_db_t *sdb);
+void shard_db_close(shard_db_t *sdb);
+int shard_for_id(shard_db_t *sdb, int id);
+int shard_range_fd(int nfds, int slots_per_fd, uint64_t off, uint64_t *end);
+int shard_ranges_size(const int fds[], int nfds, int slots_per_fd, uint64_t *size);
+int shard_count_db_records(shard_db_t *sdb);
+int shard_print_db(shard_db_t *sdb);
+int shard_zero_db(shard_db_t *sdb);
+int shard_run(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+#include "sdbshm.h"
+
+#define SHM_COPY_BATCH  1024    //records read from the db file per pread()
+#define SHM_SEQ_WAIT_MS 50      //longest a reader waits on an odd counter
+
+/*
+ *  tbl_map_size
+ *      nslots:  number of student slots in the table
+ *
+ *  returns:  number of bytes needed for the header, the sequence counters
+ *            and the records
+ */
+size_t tbl_map_size(int nslots)
+{
+    size_t seq_len = ((size_t)nslots * sizeof(atomic_uint) + 63) & ~(size_t)63;
+    return sizeof(shm_db_hdr_t) + seq_len + (size_t)nslots * STUDENT_RECORD_SIZE;
+}
+
+/*
+ *  tbl_bind
+ *      t:       table view to set up
+ *      mem:     start of a mapping of at least tbl_map_size(nslots) bytes
+ *      nslots:  number of student slots in the table
+ *
+ *  Points the header, counter and record arrays of t into mem.  Does not
+ *  touch the memory itself.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void tbl_bind(stu_table_t *t, void *mem, int nslots)
+{
+    size_t seq_len = ((size_t)nslots * sizeof(atomic_uint) + 63) & ~(size_t)63;
+
+    t->hdr = (shm_db_hdr_t *)mem;
+    t->seq = (atomic_uint *)((char *)mem + sizeof(shm_db_hdr_t));
+    t->recs = (student_t *)((char *)t->seq + seq_len);
+    t->map_len = tbl_map_size(nslots);
+}
+
+/*
+ *  tbl_get_student
+ *      t:   table view, may be mapped read only
+ *      id:  the student id we are looking for
+ *      *s:  where the located student is copied
+ *
+ *  Lock free reader side of the seqlock.  The record is copied out and the
+ *  copy is only trusted if the slot counter was even (no write in progress)
+ *  and did not change while copying, otherwise the copy is retried.  A
+ *  counter that stays odd for SHM_SEQ_WAIT_MS belongs to a writer that died
+ *  in the middle of the slot, the caller then reads the database file.
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            SRCH_NOT_FOUND id out of range or slot empty
+ *            ERR_DB_FILE    slot left half written, see tbl_patch_student()
+ */
+int tbl_get_student(const stu_table_t *t, int id, student_t *s)
+{
+    struct timespec now, deadline = {0};
+    unsigned int before, after;
+
+    if (id < MIN_STD_ID || id > (int)t->hdr->nslots)
+        return SRCH_NOT_FOUND;
+
+    atomic_uint *seq = &t->seq[id - 1];
+    const student_t *rec = &t->recs[id - 1];
+
+    for (;;) {
+        before = atomic_load_explicit(seq, memory_order_acquire);
+        if (before & 1) {
+            // writer is in the middle of this slot, the clock is only read
+            // on this slow path
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (deadline.tv_sec == 0) {
+                deadline = now;
+                deadline.tv_nsec += SHM_SEQ_WAIT_MS * 1000000L;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+                deadline.tv_nsec %= 1000000000L;
+            } else if (now.tv_sec > deadline.tv_sec ||
+                       (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+                return ERR_DB_FILE;
+            }
+            sched_yield();
+            continue;
+        }
+        memcpy(s, rec, STUDENT_RECORD_SIZE);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(seq, memory_order_relaxed);
+        if (before == after)
+            break;
+    }
+
+    if (memcmp(s, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0 || s->id != id)
+        return SRCH_NOT_FOUND;
+
+    return NO_ERROR;
+}
+
+/*
+ *  tbl_put_student
+ *      t:   table view, must be mapped writable
+ *      id:  slot to write, caller has validated the range
+ *      *s:  new contents of the slot, EMPTY_STUDENT_RECORD to delete
+ *
+ *  Writer side of the seqlock.  The caller must hold the writer lock, see
+ *  shm_db_lock(), there is only ever one writer per table.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void tbl_put_student(stu_table_t *t, int id, const student_t *s)
+{
+    tbl_patch_student(t, id, 0, s, STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  tbl_patch_student
+ *      t:     table view, must be mapped writable
+ *      id:    slot to write, caller has validated the range
+ *      off:   byte offset of the field inside student_t
+ *      data:  new field contents
+ *      len:   size of the field
+ *
+ *  Same as tbl_put_student() but only replaces one field of the record.
+ *
+ *  An odd counter at this point was left by a writer that died in the
+ *  middle of the slot.  Writing the whole record repairs it, a single
+ *  field does not, the counter then stays odd and readers keep going to
+ *  the database file until the next full write or -m.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void tbl_patch_student(stu_table_t *t, int id, size_t off, const void *data, size_t len)
+{
+    atomic_uint *seq = &t->seq[id - 1];
+    unsigned int v = atomic_load_explicit(seq, memory_order_relaxed);
+    bool torn = v & 1;
+
+    if (!torn) {
+        atomic_store_explicit(seq, v + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+    memcpy((char *)&t->recs[id - 1] + off, data, len);
+    if (!torn || len == (size_t)STUDENT_RECORD_SIZE)
+        atomic_store_explicit(seq, (v | 1) + 1, memory_order_release);
+}
+
+/*
+ *  tbl_load_db
+ *      t:       table view, must be mapped writable
+ *      db_fd:   linux file descriptor of the database file
+ *
+ *  Copies every slot of the database file into the table.  Slots past the
+ *  end of the file are loaded as empty.  Only slots whose contents change,
+ *  or that a dead writer left half written, are rewritten through the
+ *  writer side of the seqlock, so readers keep working while this runs.
+ *  The caller must hold the writer lock.
+ *
+ *  returns:  <number>       number of student records in the table
+ *            -1             error reading the database file
+ */
+int tbl_load_db(stu_table_t *t, int db_fd)
+{
+    return tbl_load_range(t, db_fd, 0, (int)t->hdr->nslots);
+}
+
+/*
+ *  tbl_load_range
+ *      t:           table view, must be mapped writable
+ *      db_fd:       linux file descriptor of a file with the database layout
+ *      first_slot:  first slot to copy
+ *      nslots:      number of slots to copy, clipped to the table
+ *
+ *  Same as tbl_load_db() for the slots first_slot .. first_slot + nslots - 1
+ *  only, for a shard file that only owns that range.
+ *
+ *  returns:  <number>       number of student records in the range
+ *            -1             error reading the file
+ */
+int tbl_load_range(stu_table_t *t, int db_fd, int first_slot, int nslots)
+{
+    student_t batch[SHM_COPY_BATCH];
+    int end = first_slot + nslots;
+    int count = 0;
+
+    if (end > (int)t->hdr->nslots)
+        end = (int)t->hdr->nslots;
+
+    for (int slot = first_slot; slot < end; slot += SHM_COPY_BATCH) {
+        int n = end - slot < SHM_COPY_BATCH ? end - slot : SHM_COPY_BATCH;
+        ssize_t got = pread(db_fd, batch, (size_t)n * STUDENT_RECORD_SIZE,
+                            (off_t)slot * STUDENT_RECORD_SIZE);
+        if (got == -1)
+            return -1;
+
+        // anything past the end of the file is an empty slot
+        memset((char *)batch + got, 0, (size_t)n * STUDENT_RECORD_SIZE - (size_t)got);
+
+        for (int i = 0; i < n; i++) {
+            if (memcmp(&batch[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+                count++;
+            if ((atomic_load_explicit(&t->seq[slot + i], memory_order_relaxed) & 1) ||
+                memcmp(&batch[i], &t->recs[slot + i], STUDENT_RECORD_SIZE) != 0)
+                tbl_put_student(t, slot + i + 1, &batch[i]);
+        }
+    }
+    return count;
+}
+
+/*
+ *  shm_db_name
+ *      name:  buffer of SHM_DB_NAME_SZ bytes for the segment name
+ *      *db:   where the stat() of the database file is stored
+ *
+ *  The segment of the database in the current directory is SHM_DB_PREFIX
+ *  followed by a 64 bit FNV-1a hash of the real path of DB_FILE, so the
+ *  name survives the rename() done by compress while two directories never
+ *  share a segment.  A hash collision is caught by the dev/ino check in
+ *  shm_db_attach().
+ *
+ *  returns:  NO_ERROR       name and *db filled in
+ *            ERR_DB_FILE    DB_FILE does not exist
+ */
+static int shm_db_name(char name[SHM_DB_NAME_SZ], struct stat *db)
+{
+    char path[PATH_MAX];
+    uint64_t h = 14695981039346656037ull;
+
+    if (realpath(DB_FILE, path) == NULL || stat(path, db) == -1)
+        return ERR_DB_FILE;
+    for (const char *p = path; *p != '\0'; p++) {
+        h ^= (unsigned char)*p;
+        h *= 1099511628211ull;
+    }
+    snprintf(name, SHM_DB_NAME_SZ, "%s%016llx", SHM_DB_PREFIX, (unsigned long long)h);
+    return NO_ERROR;
+}
+
+/*
+ *  shm_db_attach
+ *      t:         table view to fill in
+ *      writable:  map read/write (writer) or read only (reader)
+ *
+ *  Maps the published segment of the database in the current directory,
+ *  see shm_db_name().
+ *
+ *  returns:  NO_ERROR       segment mapped into t
+ *            ERR_DB_FILE    segment does not exist, cannot be mapped, has
+ *                           not been published completely or was published
+ *                           from another database file
+ *
+ *  console:  Does not produce any console I/O
+ */
+int shm_db_attach(stu_table_t *t, bool writable)
+{
+    char name[SHM_DB_NAME_SZ];
+    struct stat st, db;
+    size_t len = tbl_map_size(MAX_STD_ID);
+    void *mem;
+
+    t->fd = -1;
+    if (shm_db_name(name, &db) != NO_ERROR)
+        return ERR_DB_FILE;
+
+    t->fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (t->fd == -1)
+        return ERR_DB_FILE;
+
+    if (fstat(t->fd, &st) == -1 || (size_t)st.st_size < len) {
+        close(t->fd);
+        t->fd = -1;
+        return ERR_DB_FILE;
+    }
+
+    mem = mmap(NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               MAP_SHARED, t->fd, 0);
+    if (mem == MAP_FAILED) {
+        close(t->fd);
+        t->fd = -1;
+        return ERR_DB_FILE;
+    }
+    tbl_bind(t, mem, MAX_STD_ID);
+
+    if (t->hdr->magic != SHM_DB_MAGIC || t->hdr->version != SHM_DB_VERSION ||
+        t->hdr->nslots != MAX_STD_ID || t->hdr->rec_size != (uint32_t)STUDENT_RECORD_SIZE ||
+        t->hdr->db_dev != (uint64_t)db.st_dev || t->hdr->db_ino != (uint64_t)db.st_ino) {
+        shm_db_detach(t);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  shm_db_detach
+ *      t:   table view returned by shm_db_attach()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void shm_db_detach(stu_table_t *t)
+{
+    if (t->hdr != NULL)
+        munmap(t->hdr, t->map_len);
+    if (t->fd != -1)
+        close(t->fd);
+    t->hdr = NULL;
+    t->fd = -1;
+}
+
+/*
+ *  shm_db_lock / shm_db_unlock
+ *      t:   writable table view
+ *
+ *  Serializes writers across processes.  The kernel drops a flock() when
+ *  its holder exits, so a writer that dies does not block the next one.
+ *  It can still leave the slot it was writing with an odd counter, see
+ *  tbl_get_student() and tbl_patch_student() for how that is handled.
+ *
+ *  returns:  NO_ERROR or ERR_DB_FILE (shm_db_lock only)
+ */
+int shm_db_lock(stu_table_t *t)
+{
+    while (flock(t->fd, LOCK_EX) == -1) {
+        if (errno != EINTR)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+void shm_db_unlock(stu_table_t *t)
+{
+    flock(t->fd, LOCK_UN);
+}
+
+/*
+ *  shm_db_publish
+ *      db_fd:   linux file descriptor of the database file
+ *
+ *  Creates the segment of the database in the current directory if needed
+ *  and copies every slot of the database file into it.  Slots past the end
+ *  of the file are published as empty.  Readers that already have the
+ *  segment mapped keep working while this runs, only slots whose contents
+ *  change are rewritten.
+ *
+ *  returns:  <number>       number of student records published
+ *            ERR_DB_FILE    database file or shared memory I/O issue
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ *            M_ERR_SHM      error creating or mapping the segment
+ */
+int shm_db_publish(int db_fd)
+{
+    return shm_db_publish_ranges(&db_fd, 1, MAX_STD_ID);
+}
+
+/*
+ *  shm_db_publish_ranges
+ *      fds:           linux file descriptors with the database layout
+ *      nfds:          number of entries in fds
+ *      slots_per_fd:  fds[i] holds the slots i * slots_per_fd and up
+ *
+ *  Same as shm_db_publish() for a database split over several files, as a
+ *  sharded one is.  The segment still belongs to DB_FILE.
+ *
+ *  returns:  <number>       number of student records published
+ *            ERR_DB_FILE    database file or shared memory I/O issue
+ *
+ *  console:  M_ERR_DB_READ  error reading a database file
+ *            M_ERR_SHM      error creating or mapping the segment
+ */
+int shm_db_publish_ranges(const int fds[], int nfds, int slots_per_fd)
+{
+    stu_table_t t = {.fd = -1};
+    char name[SHM_DB_NAME_SZ];
+    struct stat db;
+    size_t len = tbl_map_size(MAX_STD_ID);
+    int count = 0;
+    void *mem;
+
+    if (shm_db_name(name, &db) != NO_ERROR) {
+        printf(M_ERR_SHM);
+        return ERR_DB_FILE;
+    }
+
+    t.fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (t.fd == -1 || ftruncate(t.fd, len) == -1) {
+        printf(M_ERR_SHM);
+        shm_db_detach(&t);
+        return ERR_DB_FILE;
+    }
+
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, t.fd, 0);
+    if (mem == MAP_FAILED) {
+        printf(M_ERR_SHM);
+        shm_db_detach(&t);
+        return ERR_DB_FILE;
+    }
+    tbl_bind(&t, mem, MAX_STD_ID);
+
+    if (shm_db_lock(&t) != NO_ERROR) {
+        printf(M_ERR_SHM);
+        shm_db_detach(&t);
+        return ERR_DB_FILE;
+    }
+
+    // readers only trust the segment once the magic is set below
+    t.hdr->version = SHM_DB_VERSION;
+    t.hdr->nslots = MAX_STD_ID;
+    t.hdr->rec_size = STUDENT_RECORD_SIZE;
+    t.hdr->db_dev = (uint64_t)db.st_dev;
+    t.hdr->db_ino = (uint64_t)db.st_ino;
+
+    for (int i = 0; i < nfds; i++) {
+        int n = tbl_load_range(&t, fds[i], i * slots_per_fd, slots_per_fd);
+        if (n < 0) {
+            shm_db_unlock(&t);
+            shm_db_detach(&t);
+            printf(M_ERR_DB_READ);
+            return ERR_DB_FILE;
+        }
+        count += n;
+    }
+
+    atomic_thread_fence(memory_order_release);
+    t.hdr->magic = SHM_DB_MAGIC;
+
+    shm_db_unlock(&t);
+    shm_db_detach(&t);
+    return count;
+}
+
+/*
+ *  shm_db_unlink
+ *
+ *  Removes the segment name.  Processes that still have it mapped keep their
+ *  mapping until they detach.
+ *
+ *  returns:  NO_ERROR       segment removed
+ *            ERR_DB_FILE    there was no segment to remove
+ */
+int shm_db_unlink(void)
+{
+    char name[SHM_DB_NAME_SZ];
+    struct stat db;
+
+    if (shm_db_name(name, &db) != NO_ERROR || shm_unlink(name) == -1)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+/*
+ *  shm_db_exists
+ *
+ *  A segment left behind by a database file that has since been replaced
+ *  does not count, nothing attaches to it and -m publishes over it.
+ *
+ *  returns:  true if a segment has been published for the database in the
+ *            current directory
+ */
+bool shm_db_exists(void)
+{
+    stu_table_t t = {.fd = -1};
+
+    if (shm_db_attach(&t, false) != NO_ERROR)
+        return false;
+    shm_db_detach(&t);
+    return true;
+}
+
+/*
+ *  shm_db_mirror
+ *      id:  student id that changed in the database file
+ *      *s:  new contents of the record, EMPTY_STUDENT_RECORD after a delete
+ *
+ *  Applies a change that was just written to the database file to the
+ *  published segment.  Does nothing when no segment is published.
+ *
+ *  returns:  NO_ERROR       change applied or nothing published
+ *            ERR_DB_FILE    segment exists but could not be updated
+ */
+int shm_db_mirror(int id, const student_t *s)
+{
+    return shm_db_mirror_field(id, 0, s, STUDENT_RECORD_SIZE);
+}
+
+/*
+ *  shm_db_mirror_field
+ *      id:    student id that changed in the database file
+ *      off:   byte offset of the changed field inside student_t
+ *      data:  new field contents
+ *      len:   size of the field
+ *
+ *  Field level version of shm_db_mirror().  The segment is attached once
+ *  per process and kept for later calls.
+ *
+ *  returns:  NO_ERROR       change applied or nothing published
+ *            ERR_DB_FILE    segment exists but could not be updated
+ */
+int shm_db_mirror_field(int id, size_t off, const void *data, size_t len)
+{
+    static stu_table_t t = {.fd = -1};
+    static int state = 0;   //0 = not tried yet, 1 = attached, -1 = no segment
+
+    if (state == 0)
+        state = (shm_db_attach(&t, true) == NO_ERROR) ? 1 : -1;
+    if (state < 0)
+        return shm_db_exists() ? ERR_DB_FILE : NO_ERROR;
+
+    if (id < MIN_STD_ID || id > MAX_STD_ID)
+        return NO_ERROR;
+
+    if (shm_db_lock(&t) != NO_ERROR)
+        return ERR_DB_FILE;
+    tbl_patch_student(&t, id, off, data, len);
+    shm_db_unlock(&t);
+    return NO_ERROR;
+}
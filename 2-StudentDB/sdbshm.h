@@ -0,0 +1,68 @@
+#ifndef __SDBSHM_H__
+    #define __SDBSHM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "db.h" //get student record type
+
+//Shared memory resident copy of the student table.  The segment holds a small
+//header, one sequence counter per student slot and the student records laid
+//out exactly like the database file (slot = id - 1).  Readers map the segment
+//read only and copy records out using the seqlock protocol, so a lookup by
+//id from any process is a couple of plain memory loads.  A single writer at
+//a time (serialized with flock() on the segment) applies add/del.  A writer
+//that dies in the middle of a slot leaves its counter odd, readers then
+//fall back to the database file for that slot until it is written again.
+//
+//Every database gets its own segment, named after the real path of its
+//DB_FILE.  The header also records the file's device and inode, and a
+//segment that does not match the database in the current directory is
+//never attached.
+#define SHM_DB_MAGIC        0x53444253u     //"SDBS"
+#define SHM_DB_VERSION      2
+#define SHM_DB_NAME_SZ      32              //SHM_DB_PREFIX and a 64 bit hash
+
+typedef struct shm_db_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;                    //number of student slots
+    uint32_t rec_size;                  //sizeof(student_t)
+    uint64_t db_dev;                    //st_dev and st_ino of the DB_FILE
+    uint64_t db_ino;                    //the segment was published from
+    char     pad[32];                   //keep the counters cache aligned
+} shm_db_hdr_t;
+
+//view of a student table in memory, either the shared memory segment or any
+//other mapping with the same layout
+typedef struct stu_table {
+    int             fd;                 //segment fd, -1 if not backed by one
+    size_t          map_len;
+    shm_db_hdr_t    *hdr;
+    atomic_uint     *seq;               //seq[slot], odd while being written
+    student_t       *recs;              //recs[slot]
+} stu_table_t;
+
+//prototypes for the table, see sdbshm.c for documentation
+size_t tbl_map_size(int nslots);
+void tbl_bind(stu_table_t *t, void *mem, int nslots);
+int tbl_get_student(const stu_table_t *t, int id, student_t *s);
+void tbl_put_student(stu_table_t *t, int id, const student_t *s);
+void tbl_patch_student(stu_table_t *t, int id, size_t off, const void *data, size_t len);
+int tbl_load_db(stu_table_t *t, int db_fd);
+int tbl_load_range(stu_table_t *t, int db_fd, int first_slot, int nslots);
+
+int shm_db_attach(stu_table_t *t, bool writable);
+void shm_db_detach(stu_table_t *t);
+int shm_db_lock(stu_table_t *t);
+void shm_db_unlock(stu_table_t *t);
+int shm_db_publish(int db_fd);
+int shm_db_publish_ranges(const int fds[], int nfds, int slots_per_fd);
+int shm_db_unlink(void);
+bool shm_db_exists(void);
+int shm_db_mirror(int id, const student_t *s);
+int shm_db_mirror_field(int id, size_t off, const void *data, size_t len);
+
+#endif
@@ -2,8 +2,10 @@
 
 # The setup function runs before every test
 setup_file() {
-    # Delete the student.db file if it exists
+    # Delete the student.db file if it exists, along with any shared memory
+    # copy left over from an earlier run, which is named after the file
     if [ -f "student.db" ]; then
+        ./sdbsc -M > /dev/null || true
         rm "student.db"
     fi
 }
@@ -164,6 +166,166 @@ setup_file() {
     }
 }
 
+@test "Print student records matches printf byte for byte" {
+    run ./sdbsc -p
+    [ "$status" -eq 0 ]
+
+    expected_output=$(printf "%-6s %-24s %-32s %-3s\n" "ID" "FIRST_NAME" "LAST_NAME" "GPA"
+                      printf "%-6d %-24.24s %-32.32s %-3.2f\n" 1 john doe 3.45 3 jane doe 3.90 \
+                                 63 jim doe 2.85 99999 big dude 2.05)
+
+    [ "$output" = "$expected_output" ] || {
+        echo "Failed Output: $output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Find student matches printf byte for byte" {
+    run ./sdbsc -f 63
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "$(printf "%-6d %-24.24s %-32.32s %-3.2f" 63 jim doe 2.85)" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Publish db to shared memory" {
+    run ./sdbsc -m
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Published 4 student record(s) to shared memory." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Shared memory copy follows add and delete" {
+    run ./sdbsc -a 7 sam shm 401
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -f 7
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "7 sam shm 4.01" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -d 7
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -f 7
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 7 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Find reads the file when a dead writer left a slot half written" {
+    seg=$(ls -t /dev/shm/sdbsc_* | head -n 1)
+
+    # the counter of slot 3 sits after the 64 byte header, an odd value is
+    # what a writer that died in the middle of the slot leaves behind
+    printf '\001\000\000\000' | dd of="$seg" bs=1 seek=72 conv=notrunc status=none
+
+    run timeout 5 ./sdbsc -f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 jane doe 3.90" ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    # republishing rewrites the slot and makes its counter even again
+    run ./sdbsc -m
+    [ "$status" -eq 0 ]
+    [ $(( $(od -An -t u4 -j 72 -N 4 "$seg") % 2 )) -eq 0 ]
+}
+
+@test "Remove shared memory copy" {
+    run ./sdbsc -M
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Shared memory copy removed." ]
+
+    run ./sdbsc -M
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No shared memory copy is published." ]
+}
+
+@test "Update gpa and last name of student 3 in place" {
+    run ./sdbsc -u 3 gpa=395 lname=dough
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 3 updated in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 3
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 jane dough 3.95" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Update of non-existent student or bad field fails" {
+    run ./sdbsc -u 4 gpa=300
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 4 was not found in database." ]
+
+    run ./sdbsc -u 3 major=cs
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant update student, expected fname=<s>, lname=<s> or gpa=<n>!" ]
+
+    run ./sdbsc -u 3 gpa=501
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Cant update student, GPA out of allowable range!" ]
+}
+
+@test "Import students from CSV" {
+    csv_file=$(mktemp)
+    printf 'id,fname,lname,gpa\n200,csv,one,3.10\n201,"csv",two,295\r\n1,dup,row,300\n202,bad\n203,out,range,501\n' > "$csv_file"
+
+    run ./sdbsc -I "$csv_file"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Imported 2 student record(s) from $csv_file." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Skipped 3 invalid or duplicate row(s)." ]
+    rm -f "$csv_file"
+
+    run ./sdbsc -f 201
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "201 csv two 2.95" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+
+    run stat --format="%s" ./student.db
+    [ "${lines[0]}" = "6400000" ]
+}
+
+
+@test "Export columnar snapshot" {
+    col_file=$(mktemp)
+    run ./sdbsc -E "$col_file"
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Exported $(./sdbsc -c | tr -dc '0-9') student record(s) to $col_file." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run od -An -c -N 7 "$col_file"
+    [ "$(echo -n "$output" | tr -d '[:space:]')" = "SDBCOL1" ]
+
+    run od -An -t u4 -j 12 -N 4 "$col_file"
+    [ "$(echo -n "$output" | tr -d '[:space:]')" = "$(./sdbsc -c | tr -dc '0-9')" ]
+    rm -f "$col_file"
+}
 
 @test "Compress db - try 1" {
     skip
@@ -192,4 +354,317 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "Sharded db routes records to shard files" {
+    sdbsc="$PWD/sdbsc"
+    shard_dir=$(mktemp -d)
+    cd "$shard_dir"
+    mkdir d1 d2
+
+    run "$sdbsc" -a 10 john doe 345
+    [ "$status" -eq 0 ]
+
+    run "$sdbsc" -n 4 d1 d2
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Created sharded database with 4 shard(s), moved 1 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ -f d1/student.db.0 ] && [ -f d2/student.db.1 ] && [ -f d1/student.db.2 ] && [ -f d2/student.db.3 ]
+
+    run "$sdbsc" -a 99999 big dude 205
+    [ "$status" -eq 0 ]
+    run "$sdbsc" -a 50001 mid dle 310
+    [ "$status" -eq 0 ]
+    run "$sdbsc" -u 50001 gpa=320
+    [ "$status" -eq 0 ]
+    run "$sdbsc" -d 99999
+    [ "$status" -eq 0 ]
+
+    # 25000 and 25001 share an import chunk but not a shard
+    printf '25000,last,zero,300\n25001,first,one,301\n10,dup,row,300\n' > rows.csv
+    run "$sdbsc" -I rows.csv
+    [ "$status" -eq 0 ]
+    [ "${lines[1]}" = "Skipped 1 invalid or duplicate row(s)." ]
+    run "$sdbsc" -f 25001
+    [ "$status" -eq 0 ]
+
+    run "$sdbsc" -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 4 student record(s)." ]
+
+    run "$sdbsc" -p
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST_NAME LAST_NAME GPA 10 john doe 3.45 25000 last zero 3.00 25001 first one 3.01 50001 mid dle 3.20"
+
+    run "$sdbsc" -E out.col
+    [ "$status" -eq 0 ]
+    col_ids=$(od -An -t d4 -j 128 -N 16 out.col | tr -s '[:space:]' ' ')
+
+    run "$sdbsc" -q "id>=25000 and gpa>300"
+    query_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    run "$sdbsc" -g "id>=25000"
+    stats_output=$output
+
+    run "$sdbsc" -m
+    shm_output=$output
+    run "$sdbsc" -f 50001
+    shm_find=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    "$sdbsc" -M > /dev/null
+    cd - > /dev/null
+    rm -rf "$shard_dir"
+
+    [ "$shm_output" = "Published 4 student record(s) to shared memory." ] || {
+        echo "Failed Output:  $shm_output"
+        return 1
+    }
+    [ "$shm_find" = "50001 mid dle 3.20" ]
+    [ "$col_ids" = " 10 25000 25001 50001 " ] || {
+        echo "Failed Output:  $col_ids"
+        return 1
+    }
+    [ "$query_output" = "ID FIRST_NAME LAST_NAME GPA 25001 first one 3.01 50001 mid dle 3.20" ] || {
+        echo "Failed Output:  $query_output"
+        return 1
+    }
+    [ "$stats_output" = "3 student(s), gpa min 3.00, max 3.20, avg 3.07" ] || {
+        echo "Failed Output:  $stats_output"
+        return 1
+    }
+
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+}
+
+@test "Incremental backup and restore" {
+    sdbsc="$PWD/sdbsc"
+    bk_dir=$(mktemp -d)
+    cd "$bk_dir"
+
+    run "$sdbsc" -a 1 john doe 345
+    run "$sdbsc" -a 90000 jane smith 390
+    run "$sdbsc" -B bk
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Full backup 1 of 1563 page(s) written to bk." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run "$sdbsc" -a 2 bob jones 250
+    run "$sdbsc" -u 90000 gpa=380
+    run "$sdbsc" -B bk
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Incremental backup 2 of 2 changed page(s) written to bk." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    cp student.db expected.db
+    run "$sdbsc" -d 1
+    run "$sdbsc" -R bk
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Restored database from 2 backup(s) in bk." ]
+    cmp -s student.db expected.db
+    restored=$?
+
+    run "$sdbsc" -B bk
+    cd - > /dev/null
+    rm -rf "$bk_dir"
+
+    [ "$restored" -eq 0 ]
+    [ "${lines[0]}" = "Incremental backup 3 of 0 changed page(s) written to bk." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Backups carry over into a sharded db" {
+    sdbsc="$PWD/sdbsc"
+    bk_dir=$(mktemp -d)
+    cd "$bk_dir"
+
+    "$sdbsc" -a 10 john doe 345 > /dev/null
+    "$sdbsc" -B bk > /dev/null
+    "$sdbsc" -n 4 > /dev/null
+
+    # 25001 sits on the page shared by shard 0 and shard 1
+    "$sdbsc" -a 25001 jane smith 390 > /dev/null
+    "$sdbsc" -u 10 gpa=350 > /dev/null
+    run "$sdbsc" -B bk
+    incr_output=${lines[0]}
+    expected_output=$("$sdbsc" -p)
+
+    "$sdbsc" -d 25001 > /dev/null
+    "$sdbsc" -z > /dev/null
+    run "$sdbsc" -R bk
+    restore_status=$status
+    restored_output=$("$sdbsc" -p)
+    cd - > /dev/null
+    rm -rf "$bk_dir"
+
+    [ "$incr_output" = "Incremental backup 2 of 2 changed page(s) written to bk." ] || {
+        echo "Failed Output:  $incr_output"
+        return 1
+    }
+    [ "$restore_status" -eq 0 ]
+    [ "$restored_output" = "$expected_output" ]
+}
+
+@test "Follower replicates leader changes" {
+    sdbsc="$PWD/sdbsc"
+    port=$((20000 + $$ % 20000))
+    leader_dir=$(mktemp -d)
+    follower_dir=$(mktemp -d)
+
+    cd "$leader_dir"
+    "$sdbsc" -a 1 john doe 345 > /dev/null
+    "$sdbsc" -L $port > leader.out 2>&1 3>&- &
+    leader_pid=$!
+    sleep 0.5
+
+    cd "$follower_dir"
+    "$sdbsc" -F localhost $port > follower.out 2>&1 3>&- &
+    follower_pid=$!
+
+    cd "$leader_dir"
+    "$sdbsc" -a 2 jane smith 390 > /dev/null
+    "$sdbsc" -u 1 gpa=350 > /dev/null
+    "$sdbsc" -d 2 > /dev/null
+
+    for i in $(seq 50); do
+        cmp -s "$leader_dir/student.db" "$follower_dir/student.db" && break
+        sleep 0.1
+    done
+    same=1
+    cmp -s "$leader_dir/student.db" "$follower_dir/student.db" && same=0
+
+    kill $follower_pid $leader_pid
+    wait $follower_pid $leader_pid 2> /dev/null || true
+    first_line=$(head -n 1 "$follower_dir/follower.out")
+    cd - > /dev/null
+    rm -rf "$leader_dir" "$follower_dir"
+
+    [ "$same" -eq 0 ]
+    [ "$first_line" = "Following localhost:$port from lsn 1." ] || {
+        echo "Failed Output:  $first_line"
+        return 1
+    }
+}
+
+@test "Sharded leader replicates to a sharded follower" {
+    sdbsc="$PWD/sdbsc"
+    port=$((20001 + $$ % 20000))
+    leader_dir=$(mktemp -d)
+    follower_dir=$(mktemp -d)
+
+    cd "$leader_dir"
+    "$sdbsc" -a 1 john doe 345 > /dev/null
+    "$sdbsc" -n 4 > /dev/null
+    "$sdbsc" -L $port > leader.out 2>&1 3>&- &
+    leader_pid=$!
+    sleep 0.5
+
+    # the follower has its own layout, records land in its own shards
+    cd "$follower_dir"
+    "$sdbsc" -n 2 > /dev/null
+    "$sdbsc" -F localhost $port > follower.out 2>&1 3>&- &
+    follower_pid=$!
+
+    cd "$leader_dir"
+    "$sdbsc" -a 60000 jane smith 390 > /dev/null
+    "$sdbsc" -a 99000 bob jones 250 > /dev/null
+    "$sdbsc" -u 1 gpa=350 > /dev/null
+    "$sdbsc" -d 99000 > /dev/null
+    expected_output=$("$sdbsc" -p)
+
+    for i in $(seq 50); do
+        [ "$(cd "$follower_dir" && "$sdbsc" -p)" = "$expected_output" ] && break
+        sleep 0.1
+    done
+    follower_output=$(cd "$follower_dir" && "$sdbsc" -p)
+
+    kill $follower_pid $leader_pid
+    wait $follower_pid $leader_pid 2> /dev/null || true
+    cd - > /dev/null
+    rm -rf "$leader_dir" "$follower_dir"
+
+    [ "$follower_output" = "$expected_output" ] || {
+        echo "Failed Output:  $follower_output"
+        return 1
+    }
+}
+
+@test "Query students with a predicate" {
+    sdbsc="$PWD/sdbsc"
+    query_dir=$(mktemp -d)
+    cd "$query_dir"
+    "$sdbsc" -a 1 john doe 345 > /dev/null
+    "$sdbsc" -a 2 jane dover 380 > /dev/null
+    "$sdbsc" -a 3 bob davis 390 > /dev/null
+    "$sdbsc" -a 70000 zed dorian 320 > /dev/null
+
+    run "$sdbsc" -q "gpa>=350 and lname^=d"
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    query_status=$status
+
+    run "$sdbsc" -q "gpa > 4.00"
+    none_output=$output
+
+    run "$sdbsc" -q "gpa ~ 3"
+    bad_status=$status
+
+    run "$sdbsc" -q "id < 9999999999"
+    range_status=$status
+    run "$sdbsc" -q "gpa >= 7.5"
+    gpa_range_status=$status
+    cd - > /dev/null
+    rm -rf "$query_dir"
+
+    [ "$query_status" -eq 0 ]
+    [ "$normalized_output" = "ID FIRST_NAME LAST_NAME GPA 2 jane dover 3.80 3 bob davis 3.90" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+    [ "$none_output" = "No student records match the query." ]
+    [ "$bad_status" -eq 2 ]
+    [ "$range_status" -eq 2 ]
+    [ "$gpa_range_status" -eq 2 ]
+}
+
+@test "Column cache serves gpa stats and tracks updates" {
+    sdbsc="$PWD/sdbsc"
+    cache_dir=$(mktemp -d)
+    cd "$cache_dir"
+    "$sdbsc" -a 1 john doe 345 > /dev/null
+    "$sdbsc" -a 2 jane dover 380 > /dev/null
+    "$sdbsc" -a 3 bob davis 255 > /dev/null
+
+    run "$sdbsc" -g
+    all_output=$output
+    [ -f student.db.cols ] && built=0 || built=1
+
+    "$sdbsc" -u 3 gpa=395 > /dev/null
+    run "$sdbsc" -g "gpa>=350"
+    some_output=$output
+
+    "$sdbsc" -z > /dev/null
+    [ -f student.db.cols ] && removed=1 || removed=0
+    cd - > /dev/null
+    rm -rf "$cache_dir"
+
+    [ "$built" -eq 0 ]
+    [ "$all_output" = "3 student(s), gpa min 2.55, max 3.80, avg 3.27" ] || {
+        echo "Failed Output:  $all_output"
+        return 1
+    }
+    [ "$some_output" = "2 student(s), gpa min 3.80, max 3.95, avg 3.88" ] || {
+        echo "Failed Output:  $some_output"
+        return 1
+    }
+    [ "$removed" -eq 0 ]
+}
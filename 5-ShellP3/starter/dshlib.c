@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,9 +7,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <errno.h>
 #include "dshlib.h"
 
+extern char **environ;
+
 /*
  * Implement your exec_local_cmd_loop function by building a loop that prompts the 
  * user for input.  Use the SH_PROMPT constant from dshlib.h and then
@@ -329,6 +333,111 @@ int free_cmd_list(command_list_t *cmd_list) {
     return OK;
 }
 
+/*
+ * spawn_pipeline(clist, in_fd, out_fd, err_fd, pids, errs)
+ *      clist:   parsed pipeline to start
+ *      in_fd:   stdin of the first command
+ *      out_fd:  stdout of the last command
+ *      err_fd:  stderr of the last command, earlier commands keep ours
+ *      pids:    filled with the pid of each command, -1 if it did not start
+ *      errs:    0 for a command that started, the errno from posix_spawnp()
+ *               if it could not be executed, or SPAWN_ERR_REDIR if one of
+ *               its redirection files could not be opened
+ *
+ *  Starts every command of the pipeline without forking the shell.  The
+ *  pipes and redirection files are opened here with O_CLOEXEC and handed to
+ *  posix_spawnp() as dup2 file actions, so the children only inherit their
+ *  own stdin/stdout/stderr.  A < or > file replaces the pipe on that side,
+ *  the same as the old fork() and dup2() code did.  Redirection errors are
+ *  reported on the stderr the command would have had; exec errors are left
+ *  to the caller.
+ *
+ *  Returns OK, or ERR_EXEC_CMD if the pipes could not be created.
+ */
+static void add_dup(posix_spawn_file_actions_t *fa, int from, int to) {
+    if (from != to)
+        posix_spawn_file_actions_adddup2(fa, from, to);
+}
+
+int spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int err_fd,
+                   pid_t pids[], int errs[]) {
+    int pipes[CMD_MAX-1][2];
+    int last = clist->num - 1;
+
+    // Create all necessary pipes
+    for (int i = 0; i < last; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+            perror("pipe");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return ERR_EXEC_CMD;
+        }
+    }
+
+    for (int i = 0; i <= last; i++) {
+        cmd_buff_t *cmd = &clist->commands[i];
+        int stage_in = (i == 0) ? in_fd : pipes[i-1][0];
+        int stage_out = (i == last) ? out_fd : pipes[i][1];
+        int stage_err = (i == last) ? err_fd : STDERR_FILENO;
+        int in_file = -1, out_file = -1;
+        posix_spawn_file_actions_t fa;
+
+        pids[i] = -1;
+        errs[i] = 0;
+
+        // Input redirection (<)
+        if (cmd->input_file != NULL) {
+            in_file = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+            if (in_file < 0) {
+                dprintf(stage_err, "Cannot open input file: %s\n", cmd->input_file);
+                errs[i] = SPAWN_ERR_REDIR;
+                continue;
+            }
+            stage_in = in_file;
+        }
+
+        // Output redirection (> or >>)
+        if (cmd->output_file != NULL) {
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+            flags |= cmd->append_mode ? O_APPEND : O_TRUNC;
+
+            out_file = open(cmd->output_file, flags, 0644);
+            if (out_file < 0) {
+                dprintf(stage_err, "Cannot open output file: %s\n", cmd->output_file);
+                errs[i] = SPAWN_ERR_REDIR;
+                if (in_file >= 0)
+                    close(in_file);
+                continue;
+            }
+            stage_out = out_file;
+        }
+
+        posix_spawn_file_actions_init(&fa);
+        add_dup(&fa, stage_in, STDIN_FILENO);
+        add_dup(&fa, stage_out, STDOUT_FILENO);
+        add_dup(&fa, stage_err, STDERR_FILENO);
+
+        errs[i] = posix_spawnp(&pids[i], cmd->argv[0], &fa, NULL, cmd->argv, environ);
+        if (errs[i] != 0)
+            pids[i] = -1;
+
+        posix_spawn_file_actions_destroy(&fa);
+        if (in_file >= 0)
+            close(in_file);
+        if (out_file >= 0)
+            close(out_file);
+    }
+
+    // Parent process: close all pipe file descriptors
+    for (int i = 0; i < last; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    return OK;
+}
+
 int execute_pipeline(command_list_t *clist) {
     if (clist->num == 0) {
         return WARN_NO_CMDS;
@@ -349,103 +458,34 @@ int execute_pipeline(command_list_t *clist) {
         }
     }
     
-    int pipes[CMD_MAX-1][2]; // Array of pipes
     pid_t pids[CMD_MAX];     // Array to store child PIDs
-    
-    // Create all necessary pipes
-    for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) < 0) {
-            perror("pipe");
-            return ERR_EXEC_CMD;
-        }
+    int errs[CMD_MAX];       // Why a command did not start, 0 if it did
+
+    if (spawn_pipeline(clist, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, pids, errs) != OK) {
+        return ERR_EXEC_CMD;
     }
-    
-    // Fork and execute each command in the pipeline
+
+    // Report commands that could not be executed
     for (int i = 0; i < clist->num; i++) {
-        cmd_buff_t *cmd = &clist->commands[i];
-        
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("fork");
-            return ERR_EXEC_CMD;
-        }
-        
-        if (pids[i] == 0) {
-            // Child process
-            
-            // Set up input redirection (except for the first command)
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            // Set up output redirection (except for the last command)
-            if (i < clist->num - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
-            
-            // Close all pipe file descriptors in the child
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            
-            // Handle file redirection
-            int fd;
-            
-            // Input redirection (<)
-            if (cmd->input_file != NULL) {
-                fd = open(cmd->input_file, O_RDONLY);
-                if (fd < 0) {
-                    fprintf(stderr, "Cannot open input file: %s\n", cmd->input_file);
-                    exit(1);
-                }
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
-            
-            // Output redirection (> or >>)
-            if (cmd->output_file != NULL) {
-                int flags = O_WRONLY | O_CREAT;
-                
-                if (cmd->append_mode) {
-                    flags |= O_APPEND;  // For >>
-                } else {
-                    flags |= O_TRUNC;   // For >
-                }
-                
-                fd = open(cmd->output_file, flags, 0644);
-                if (fd < 0) {
-                    fprintf(stderr, "Cannot open output file: %s\n", cmd->output_file);
-                    exit(1);
-                }
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
-            
-            // Execute the command
-            execvp(cmd->argv[0], cmd->argv);
-            
-            // If we get here, execvp failed
-            if (errno == ENOENT) {
-                fprintf(stderr, "Command not found in PATH\n");
-            } else if (errno == EACCES) {
-                fprintf(stderr, "Permission denied\n");
-            } else {
-                fprintf(stderr, "execvp error: %s\n", strerror(errno));
-            }
-            exit(errno);
+        if (errs[i] == ENOENT) {
+            fprintf(stderr, "Command not found in PATH\n");
+        } else if (errs[i] == EACCES) {
+            fprintf(stderr, "Permission denied\n");
+        } else if (errs[i] > 0) {
+            fprintf(stderr, "dsh: %s: %s\n", clist->commands[i].argv[0], strerror(errs[i]));
         }
     }
     
-    // Parent process: close all pipe file descriptors
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
-    }
-    
     // Wait for all children to complete
     int status;
     for (int i = 0; i < clist->num; i++) {
+        if (pids[i] < 0) {
+            // Same code the child used to exit with: 1 for a bad redirection,
+            // errno for a failed exec
+            if (i == clist->num - 1)
+                last_rc = (errs[i] == SPAWN_ERR_REDIR) ? 1 : errs[i];
+            continue;
+        }
         waitpid(pids[i], &status, 0);
         if (i == clist->num - 1) { // Only store exit status of last command in pipeline
             if (WIFEXITED(status)) {
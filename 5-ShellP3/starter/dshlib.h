@@ -1,6 +1,8 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <sys/types.h>
+
 
 //Constants for command structure sizes
 #define EXE_MAX 64
@@ -62,6 +64,9 @@ typedef struct command_list{
 #define ERR_EXEC_CMD            -6
 #define OK_EXIT                 -7
 
+//errs[] value from spawn_pipeline() for a command whose < or > file failed
+#define SPAWN_ERR_REDIR         -1
+
 //prototypes
 int alloc_cmd_buff(cmd_buff_t *cmd_buff);
 int free_cmd_buff(cmd_buff_t *cmd_buff);
@@ -87,6 +92,8 @@ Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd);
 int exec_local_cmd_loop();
 int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
+int spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int err_fd,
+                   pid_t pids[], int errs[]);
 
 
 
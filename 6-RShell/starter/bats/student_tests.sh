@@ -276,3 +276,271 @@ EOF
     [[ "$output" == *"line 1"* ]]
     [[ "$output" == *"line 2"* ]]
 }
+
+@test "Local: hash caches command paths" {
+    run ./dsh <<EOF
+hash
+ls > /dev/null
+ls > /dev/null
+hash
+hash -r
+hash
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    ls_path=$(command -v ls)
+
+    # Assertions
+    [ "$status" -eq 0 ]
+    [[ "$stripped_output" == *"hash:hashtableempty"*"hitscommand2${ls_path}"*"hash:hashtableempty"* ]]
+}
+
+@test "Local: hash entry is refreshed when the command moves" {
+    tool_dir1=$(mktemp -d)
+    tool_dir2=$(mktemp -d)
+    printf '#!/bin/sh\necho first\n' > "$tool_dir1/dshtool"
+    printf '#!/bin/sh\necho second\n' > "$tool_dir2/dshtool"
+    chmod +x "$tool_dir1/dshtool" "$tool_dir2/dshtool"
+
+    run env PATH="$tool_dir1:$tool_dir2:$PATH" ./dsh <<EOF
+dshtool
+rm $tool_dir1/dshtool
+dshtool
+EOF
+    rm -rf "$tool_dir1" "$tool_dir2"
+
+    # Assertions
+    [ "$status" -eq 0 ]
+    [[ "$output" == *"first"*"second"* ]]
+}
+
+@test "Local: builtins run in pipelines and honor redirection" {
+    out_file=$(mktemp)
+    run ./dsh <<EOF
+echo one two three | wc -w
+pwd | cat
+echo saved > $out_file
+cat < $out_file
+false
+rc
+cat $out_file nosuchfile
+rc
+EOF
+    rm -f "$out_file"
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+
+    # Assertions
+    [ "$status" -eq 0 ]
+    [[ "$output" == *"$PWD"* ]]
+    [[ "$stripped_output" == *"3"*"saved"*"1"*"saved"*"cat:nosuchfile:Nosuchfileordirectory"*"1"* ]]
+}
+
+@test "Local: long pipelines and argument lists are not truncated" {
+    many_args=$(seq -s ' ' 1 500)
+    long_pipe=$(printf 'cat | %.0s' $(seq 1 20))
+
+    run ./dsh <<EOF
+echo $many_args | wc -w
+echo start | ${long_pipe} tr a-z A-Z
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+
+    # Assertions
+    [ "$status" -eq 0 ]
+    [[ "$stripped_output" == "500START"* ]]
+}
+
+@test "Local: quotes protect pipes, spaces and redirects inside a word" {
+    rm -f /tmp/dsh_lex_test.txt
+    run ./dsh <<EOF
+echo "a|b" 'c > d' x"y z"w
+echo hi>/tmp/dsh_lex_test.txt
+cat</tmp/dsh_lex_test.txt | wc -l
+EOF
+
+    # the banner and prompts are stdio buffered, where they land between
+    # the commands' own writes depends on flushes, so only the command
+    # output is compared
+    stripped_output=$(echo "$output" | sed -e 's/dsh4> //g' -e '/^local mode$/d' -e '/^cmd loop returned/d' | tr -d '[:space:]')
+    expected_output="a|bc>dxyzw1"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+    rm -f /tmp/dsh_lex_test.txt
+}
+
+@test "Local: background jobs with wait, fg and per-job exit codes" {
+    rm -f /tmp/dsh_job_test.txt
+    run ./dsh <<EOF
+sh -c "exit 3" &
+echo "a&b" | cat > /tmp/dsh_job_test.txt &
+sh -c "sleep 0.2; exit 5" &
+wait %1
+rc
+fg
+rc
+wait
+rc
+cat /tmp/dsh_job_test.txt
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="localmodedsh4>dsh4>dsh4>dsh4>dsh4>3dsh4>sh-csleep0.2;exit5dsh4>5dsh4>dsh4>0dsh4>a&bdsh4>cmdloopreturned0"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+    rm -f /tmp/dsh_job_test.txt
+}
+
+@test "Local: parallel runs inputs N at a time with ordered output and failure count" {
+    run ./dsh <<EOF
+parallel -k -j 3 sh -c "sleep 0.{}; echo {}" ::: 3 2 1
+parallel -j 4 sh -c "exit {}" ::: 0 1 0 2 3
+rc
+printf "x\ny\n" | parallel -k echo got
+EOF
+
+    stripped_output=$(echo "$output" | sed -e 's/dsh4> //g' -e '/^local mode$/d' -e '/^cmd loop returned/d' | tr -d '[:space:]')
+    expected_output="3213gotxgoty"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Local: dsh -f runs a script without prompts and exits with its last status" {
+    printf '#!./dsh -f\n# comment\necho one\necho two | wc -c\nsh -c "exit 7"\n' > /tmp/dsh_script_test.dsh
+    run ./dsh -f /tmp/dsh_script_test.dsh
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="one4"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 7 ]
+    rm -f /tmp/dsh_script_test.dsh
+}
+
+@test "Local: time reports every stage of a pipeline and keeps its exit code" {
+    # script mode, so no prompt shares a line with the report
+    run ./dsh -f /dev/stdin <<EOF
+time sh -c "sleep 0.2; exit 3" | wc -l
+rc
+time sh -c "exit 4"
+rc
+EOF
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    # one header and one total per time, one row per stage
+    [ "$(echo "$output" | grep -c '^stage  *real  *user  *sys  *maxrss  *vcsw  *ivcsw  *command$')" -eq 2 ]
+    [ "$(echo "$output" | grep -c '^total ')" -eq 2 ]
+    echo "$output" | grep -q '^1  *0\.[2-9][0-9]*s .*  sh -c sleep 0.2; exit 3$'
+    echo "$output" | grep -q '^2  .*  wc -l$'
+    echo "$output" | grep -q '^0$'
+    echo "$output" | grep -q '^4$'
+    [ "$status" -eq 0 ]
+}
+
+@test "Local: set pipesize sizes pipeline pipes and rejects bad sizes" {
+    run ./dsh -f /dev/stdin <<EOF
+set
+set pipesize=256K
+set
+head -c 3000000 /dev/zero | cat | cat | wc -c
+set pipesize=lots
+rc
+set pipesize=default
+set
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="pipesize=defaultpipesize=2621443000000set:badoption'pipesize=lots'1pipesize=default"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Local: here-documents and here-strings feed stdin without files" {
+    run ./dsh -f /dev/stdin <<EOF
+cat <<END | wc -l
+one
+two
+three
+END
+wc -w <<< "four five"
+cat <<<'x|y'
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="32x|y"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Local: process substitution connects inner pipelines through /dev/fd" {
+    run ./dsh -f /dev/stdin <<EOF
+diff <(printf "a\nb\n") <(printf "a\nb\n")
+rc
+cat <(echo one) <(echo two)
+wc -l < <(seq 7)
+echo quiet > >(tr a-z A-Z)
+paste <(echo 1) <(cat <(echo nested))
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="0onetwo7QUIET1nested"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Local: command substitution splits pipeline output into arguments" {
+    run ./dsh -f /dev/stdin <<EOF
+echo a \$(printf "x  y\n\n\n") b
+echo \$(echo \$(echo nested) deep)
+\$(echo echo) first
+echo \$(seq 1000) | wc -w
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="axybnesteddeepfirst1000"
+
+    echo "Captured stdout:"
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
@@ -0,0 +1,213 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dshlib.h"
+
+/*
+ *  bench_parse
+ *
+ *  Measures build_cmd_list() throughput on a mix of generated command
+ *  lines, against the parser it replaced (strtok_r on '|', then a copy and
+ *  a second scan of every command), which is kept below as old_*.
+ *
+ *  usage:  bench_parse [lines]
+ */
+
+#define DEF_LINES   2000000
+#define NUM_SHAPES  4
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int old_push_arg(cmd_buff_t *cmd, char *arg)
+{
+    if (cmd->argc + 1 >= cmd->argv_cap) {
+        int cap = cmd->argv_cap * 2;
+        char **argv = arena_grow(cmd->arena, cmd->argv,
+                                 cmd->argv_cap * sizeof(char *), cap * sizeof(char *));
+        if (argv == NULL)
+            return ERR_MEMORY;
+        cmd->argv = argv;
+        cmd->argv_cap = cap;
+    }
+    cmd->argv[cmd->argc++] = arg;
+    return OK;
+}
+
+static char *old_trim(char *str)
+{
+    char *end;
+    while (isspace((unsigned char)*str)) str++;
+    if (*str == 0)
+        return str;
+    end = str + strlen(str) - 1;
+    while (end > str && isspace((unsigned char)*end)) end--;
+    *(end + 1) = '\0';
+    return str;
+}
+
+// the redirect filename scan shared by < and >
+static char *old_file(cmd_buff_t *cmd, char **pp)
+{
+    char *p = *pp, *start, *name;
+    while (*p && isspace((unsigned char)*p))
+        p++;
+    start = p;
+    while (*p && !isspace((unsigned char)*p) && *p != '<' && *p != '>')
+        p++;
+    char temp = *p;
+    *p = '\0';
+    name = arena_strdup(cmd->arena, old_trim(start));
+    *p = temp;
+    *pp = p;
+    return name;
+}
+
+static int old_build_cmd_buff(char *cmd_line, cmd_buff_t *cmd)
+{
+    cmd->_cmd_buffer = arena_strdup(cmd->arena, cmd_line);
+    if (cmd->_cmd_buffer == NULL)
+        return ERR_MEMORY;
+    cmd->input_file = NULL;
+    cmd->output_file = NULL;
+    cmd->append_mode = 0;
+
+    char *p = old_trim(cmd->_cmd_buffer);
+    if (strlen(p) == 0)
+        return WARN_NO_CMDS;
+    cmd->argc = 0;
+
+    while (*p) {
+        while (*p && isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0')
+            break;
+        if (*p == '<') {
+            *p++ = '\0';
+            cmd->input_file = old_file(cmd, &p);
+            continue;
+        } else if (*p == '>') {
+            *p++ = '\0';
+            if (*p == '>') {
+                cmd->append_mode = 1;
+                p++;
+            }
+            cmd->output_file = old_file(cmd, &p);
+            continue;
+        }
+
+        char *start = p;
+        if (*p == '"') {
+            start = ++p;
+            while (*p && *p != '"')
+                p++;
+            if (*p == '"')
+                *p++ = '\0';
+        } else {
+            while (*p && !isspace((unsigned char)*p) && *p != '<' && *p != '>')
+                p++;
+            if (*p)
+                *p++ = '\0';
+        }
+        if (old_push_arg(cmd, start) != OK)
+            return ERR_MEMORY;
+    }
+    cmd->argv[cmd->argc] = NULL;
+    return OK;
+}
+
+static int old_build_cmd_list(char *cmd_line, command_list_t *clist, arena_t *arena)
+{
+    char *saveptr;
+
+    clist->num = 0;
+    clist->cap = 0;
+    clist->commands = NULL;
+    clist->arena = arena;
+
+    char *line_copy = arena_strdup(arena, cmd_line);
+    if (line_copy == NULL)
+        return ERR_MEMORY;
+
+    for (char *tok = strtok_r(line_copy, PIPE_STRING, &saveptr); tok != NULL;
+         tok = strtok_r(NULL, PIPE_STRING, &saveptr)) {
+        char *trimmed = old_trim(tok);
+        if (strlen(trimmed) == 0)
+            continue;
+        if (clist->num == clist->cap) {
+            int cap = clist->cap ? clist->cap * 2 : CMD_LIST_INIT;
+            cmd_buff_t *cmds = arena_grow(arena, clist->commands,
+                                          clist->cap * sizeof(cmd_buff_t), cap * sizeof(cmd_buff_t));
+            if (cmds == NULL)
+                return ERR_MEMORY;
+            clist->commands = cmds;
+            clist->cap = cap;
+        }
+        cmd_buff_t *cmd = &clist->commands[clist->num];
+        if (alloc_cmd_buff(cmd, arena) != OK)
+            return ERR_MEMORY;
+        int rc = old_build_cmd_buff(trimmed, cmd);
+        if (rc == OK)
+            clist->num++;
+        else if (rc == ERR_MEMORY)
+            return ERR_MEMORY;
+    }
+    return (clist->num == 0) ? WARN_NO_CMDS : OK;
+}
+
+// the lines are parsed in place, so every round starts from a fresh copy
+static double run(const char *name, int (*parse)(char *, command_list_t *, arena_t *),
+                  char shapes[][256], int lines, long *words)
+{
+    arena_t arena;
+    command_list_t clist;
+    char line[256];
+
+    if (arena_init(&arena, ARENA_INIT_SZ) != OK) {
+        printf("out of memory\n");
+        exit(1);
+    }
+
+    *words = 0;
+    double t0 = now_sec();
+    for (int i = 0; i < lines; i++) {
+        strcpy(line, shapes[i % NUM_SHAPES]);
+        if (parse(line, &clist, &arena) == OK) {
+            for (int c = 0; c < clist.num; c++)
+                *words += clist.commands[c].argc;
+        }
+        arena_reset(&arena);
+    }
+    double t = now_sec() - t0;
+
+    printf("  %-8s %.3f s  %.0f lines/s  %.1f ns/line\n", name, t, lines / t, t * 1e9 / lines);
+    arena_free(&arena);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    int lines = (argc > 1) ? atoi(argv[1]) : DEF_LINES;
+    // kept free of quotes inside words so both parsers give the same argv
+    char shapes[NUM_SHAPES][256] = {
+        "ls -la /usr/bin",
+        "cat data.txt | grep -v \"not this\" | sort -r | uniq -c | head -n 20",
+        "sort < input.txt >> sorted.txt",
+        "  find . -name src -type d   |   xargs -n 1 du -sh | sort -h > sizes.txt  ",
+    };
+    long old_words, new_words;
+
+    printf("%d lines in %d shapes\n", lines, NUM_SHAPES);
+    double t_old = run("old", old_build_cmd_list, shapes, lines, &old_words);
+    double t_new = run("lexer", build_cmd_list, shapes, lines, &new_words);
+    printf("  %.2fx\n", t_old / t_new);
+
+    return (old_words == new_words) ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dshlib.h"
+
+/*
+ *  bench_pipe
+ *
+ *  Measures pipeline throughput for different pipe capacities (the
+ *  pipesize option) by running
+ *
+ *      head -c <MB>M /dev/zero | cat | cat | wc -c > /dev/null
+ *
+ *  through build_cmd_list() and execute_pipeline(), once with the cat and
+ *  wc builtins and once with /bin/cat processes.
+ *
+ *  usage:  bench_pipe [megabytes]
+ */
+
+#define DEF_MB      2048
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *fmt, int mb)
+{
+    char line[256];
+    arena_t arena;
+    command_list_t clist;
+
+    snprintf(line, sizeof(line), fmt, mb);
+    if (arena_init(&arena, ARENA_INIT_SZ) != OK || build_cmd_list(line, &clist, &arena) != OK) {
+        printf("cannot parse %s\n", line);
+        exit(1);
+    }
+
+    double t0 = now_sec();
+    execute_pipeline(&clist);
+    double t = now_sec() - t0;
+
+    free_cmd_list(&clist);
+    arena_free(&arena);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    int mb = (argc > 1) ? atoi(argv[1]) : DEF_MB;
+    const char *sizes[] = {"default", "256K", "1M"};
+    const char *lines[] = {
+        "head -c %dM /dev/zero | cat | cat | wc -c > /dev/null",
+        "head -c %dM /dev/zero | /bin/cat | /bin/cat | wc -c > /dev/null",
+    };
+    const char *names[] = {"builtin cat", "/bin/cat"};
+
+    printf("%d MB through head | cat | cat | wc -c\n", mb);
+    for (int l = 0; l < 2; l++) {
+        printf("  %s\n", names[l]);
+        for (int s = 0; s < 3; s++) {
+            set_pipe_size(sizes[s]);
+            double t = run(lines[l], mb);
+            printf("    pipesize=%-8s %.3f s  %.0f MB/s\n", sizes[s], t, mb / t);
+        }
+    }
+    return 0;
+}
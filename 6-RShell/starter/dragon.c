@@ -1,7 +1,9 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 // EXTRA CREDIT - print the drexel dragon from the readme.md
-extern void print_dragon(){
+extern void print_dragon_fd(int fd){
   static unsigned char compressed_dragon[] =
   "                                                                        @%%%%                       \n"
   "                                                                     %%%%%%                         \n"
@@ -43,5 +45,18 @@ extern void print_dragon(){
   "                                                                                 %%%%%%%@       \n";
       // In a real compressed implementation, you would decode the binary data.
       // Here we simply print the data stored in a binary array.
-      printf("%s", (char *)compressed_dragon);
+      const char *p = (const char *)compressed_dragon;
+      size_t len = strlen(p);
+      while (len > 0) {
+          ssize_t n = write(fd, p, len);
+          if (n <= 0)
+              return;
+          p += n;
+          len -= n;
+      }
+}
+
+extern void print_dragon(){
+      fflush(stdout);
+      print_dragon_fd(STDOUT_FILENO);
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,9 +7,20 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 
 #include "dshlib.h"
 
+extern char **environ;
+
 #include <errno.h>
 
 #include <stdlib.h>
@@ -24,32 +36,145 @@
 
  static int last_rc = 0;
 
- // allocates memory for the command buffer
- int alloc_cmd_buff(cmd_buff_t *cmd_buff) {
-     cmd_buff->_cmd_buffer = malloc(SH_CMD_MAX + 1);
-     if(cmd_buff->_cmd_buffer == NULL) {
+/*
+ * Per-line arena
+ *
+ *  Everything the parser builds for one command line (the line copy, the
+ *  command array, argv arrays and redirection names) and the launcher's
+ *  per-pipeline arrays are bump allocated from an arena owned by the command
+ *  loop, one per rsh session.  Nothing is freed one piece at a time,
+ *  arena_reset() after the pipeline has run makes all of it reusable at
+ *  once.  When a line needs more than the first chunk, extra chunks are
+ *  chained on, and the next reset folds them into one chunk big enough for
+ *  that line, so a loop running similar commands settles into doing no
+ *  malloc() at all.
+ */
+#define ARENA_ALIGN     16
+
+static size_t arena_round(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static arena_chunk_t *arena_chunk_new(size_t cap, arena_chunk_t *next) {
+    arena_chunk_t *c = malloc(sizeof(arena_chunk_t) + cap);
+    if (c == NULL)
+        return NULL;
+    c->next = next;
+    c->cap = cap;
+    c->used = 0;
+    return c;
+}
+
+int arena_init(arena_t *a, size_t initial) {
+    a->head = arena_chunk_new(arena_round(initial), NULL);
+    a->last = NULL;
+    return a->head ? OK : ERR_MEMORY;
+}
+
+void arena_free(arena_t *a) {
+    while (a->head != NULL) {
+        arena_chunk_t *c = a->head;
+        a->head = c->next;
+        free(c);
+    }
+    a->last = NULL;
+}
+
+// makes everything allocated since the last reset reusable
+void arena_reset(arena_t *a) {
+    a->last = NULL;
+    if (a->head == NULL)
+        return;
+    if (a->head->next != NULL) {
+        // this line outgrew the arena, keep one chunk that fits all of it
+        size_t total = 0;
+        for (arena_chunk_t *c = a->head; c != NULL; c = c->next)
+            total += c->cap;
+        arena_free(a);
+        a->head = arena_chunk_new(total, NULL);
+        if (a->head == NULL)
+            return;
+    }
+    a->head->used = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    arena_chunk_t *c = a->head;
+
+    size = arena_round(size ? size : 1);
+    if (c == NULL || c->cap - c->used < size) {
+        size_t cap = c ? c->cap * 2 : size;
+        c = arena_chunk_new(cap > size ? cap : size, a->head);
+        if (c == NULL)
+            return NULL;
+        a->head = c;
+    }
+    a->last = c->data + c->used;
+    c->used += size;
+    return a->last;
+}
+
+// grows the newest allocation in place when it can, copies otherwise
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+    arena_chunk_t *c = a->head;
+
+    if (ptr != NULL && ptr == a->last) {
+        size_t start = (char *)ptr - c->data;
+        if (c->cap - start >= arena_round(new_size)) {
+            c->used = start + arena_round(new_size);
+            return ptr;
+        }
+    }
+    void *p = arena_alloc(a, new_size);
+    if (p != NULL && ptr != NULL)
+        memcpy(p, ptr, old_size);
+    return p;
+}
+
+char *arena_strdup(arena_t *a, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *p = arena_alloc(a, len);
+    if (p != NULL)
+        memcpy(p, str, len);
+    return p;
+}
+
+ // allocates the argv array of the command buffer from the arena, the
+ // command text itself is copied in by build_cmd_buff()
+ int alloc_cmd_buff(cmd_buff_t *cmd_buff, arena_t *arena) {
+     cmd_buff->arena = arena;
+     cmd_buff->argv = arena_alloc(arena, CMD_ARGV_INIT * sizeof(char *));
+     if(cmd_buff->argv == NULL) {
          return ERR_MEMORY;
      }
+     cmd_buff->argv_cap = CMD_ARGV_INIT;
      cmd_buff->argc = 0;
-     for (int i = 0; i < CMD_ARGV_MAX; i++)
-         cmd_buff->argv[i] = NULL;
+     cmd_buff->argv[0] = NULL;
+     cmd_buff->_cmd_buffer = NULL;
+     cmd_buff->input_file = NULL;
+     cmd_buff->output_file = NULL;
+     cmd_buff->append_mode = 0;
+     cmd_buff->here_delim = NULL;
+     cmd_buff->here_text = NULL;
+     cmd_buff->here_len = 0;
+     cmd_buff->subs = NULL;
+     cmd_buff->nsubs = 0;
      return OK;
  }
  
- // frees allocated memory in the command buffer
+ // drops the command buffer's references, the memory belongs to the arena
  int free_cmd_buff(cmd_buff_t *cmd_buff) {
-    if(cmd_buff->_cmd_buffer)
-        free(cmd_buff->_cmd_buffer);
     cmd_buff->_cmd_buffer = NULL;
-    
-    // Free redirection paths
-    if(cmd_buff->input_file)
-        free(cmd_buff->input_file);
-    if(cmd_buff->output_file)
-        free(cmd_buff->output_file);
-        
+    cmd_buff->argv = NULL;
+    cmd_buff->argv_cap = 0;
+    cmd_buff->argc = 0;
     cmd_buff->input_file = NULL;
     cmd_buff->output_file = NULL;
+    cmd_buff->here_delim = NULL;
+    cmd_buff->here_text = NULL;
+    cmd_buff->here_len = 0;
+    cmd_buff->subs = NULL;
+    cmd_buff->nsubs = 0;
     
     return OK;
 }
@@ -57,8 +182,9 @@
  // clears fields in cmd_buff for reuse
  int clear_cmd_buff(cmd_buff_t *cmd_buff) {
     cmd_buff->argc = 0;
-    for (int i = 0; i < CMD_ARGV_MAX; i++)
-        cmd_buff->argv[i] = NULL;
+    if(cmd_buff->argv) {
+        cmd_buff->argv[0] = NULL;
+    }
     // zero out the buffer (optional)
     if(cmd_buff->_cmd_buffer) {
         cmd_buff->_cmd_buffer[0] = '\0';
@@ -68,9 +194,30 @@
     cmd_buff->input_file = NULL;
     cmd_buff->output_file = NULL;
     cmd_buff->append_mode = 0;
+    cmd_buff->here_delim = NULL;
+    cmd_buff->here_text = NULL;
+    cmd_buff->here_len = 0;
+    cmd_buff->subs = NULL;
+    cmd_buff->nsubs = 0;
     
     return OK;
 }
+
+ // appends one argument, doubling argv when it is full; one slot is always
+ // kept free for the NULL terminator
+ static int push_arg(cmd_buff_t *cmd_buff, char *arg) {
+     if(cmd_buff->argc + 1 >= cmd_buff->argv_cap) {
+         int cap = cmd_buff->argv_cap * 2;
+         char **argv = arena_grow(cmd_buff->arena, cmd_buff->argv,
+                                  cmd_buff->argv_cap * sizeof(char *), cap * sizeof(char *));
+         if(argv == NULL)
+             return ERR_MEMORY;
+         cmd_buff->argv = argv;
+         cmd_buff->argv_cap = cap;
+     }
+     cmd_buff->argv[cmd_buff->argc++] = arg;
+     return OK;
+ }
  
  static char *trim_whitespace(char *str) {
      char *end;
@@ -83,103 +230,245 @@
      return str;
 }
  
-int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
-    // copy cmd_line into the allocated buffer
-    strncpy(cmd_buff->_cmd_buffer, cmd_line, SH_CMD_MAX);
-    cmd_buff->_cmd_buffer[SH_CMD_MAX] = '\0';
-    
-    // Initialize redirection fields
+/*
+ * Command line lexer
+ *
+ *  One left to right scan does all of the parsing: it finds the '|' that
+ *  end each command, the < > >> redirections, and the span of every
+ *  argument.  Double or single quotes can appear anywhere in a word and
+ *  protect spaces, '|', '<' and '>' inside them, so `echo "a|b"` is one
+ *  command.  Nothing is copied, each word is compacted in place (dropping
+ *  its quote characters) and terminated where it ends, and argv just points
+ *  at it.  The terminator can land on the '|', '<' or '>' that ended the
+ *  word, so that one character is remembered in lex_t.saved.
+ */
+typedef struct lex {
+    char *p;            // next character to look at
+    char *clobbered;    // where a terminator overwrote a delimiter
+    char saved;         // the delimiter that was there
+} lex_t;
+
+// character classes, one table lookup per character in the word loop
+#define LEX_SPACE   0x01
+#define LEX_OP      0x02    // '\0' '|' '<' '>' '&'
+#define LEX_QUOTE   0x04
+#define LEX_DELIM   (LEX_SPACE | LEX_OP)
+
+static const unsigned char lex_class[256] = {
+    ['\0'] = LEX_OP, ['|'] = LEX_OP, ['<'] = LEX_OP, ['>'] = LEX_OP, ['&'] = LEX_OP,
+    [' '] = LEX_SPACE, ['\t'] = LEX_SPACE, ['\n'] = LEX_SPACE,
+    ['\v'] = LEX_SPACE, ['\f'] = LEX_SPACE, ['\r'] = LEX_SPACE,
+    ['"'] = LEX_QUOTE, ['\''] = LEX_QUOTE,
+};
+
+#define LEX_CLASS(c) lex_class[(unsigned char)(c)]
+
+static char lex_peek(const lex_t *lx, const char *at) {
+    return (at == lx->clobbered) ? lx->saved : *at;
+}
+
+static void lex_skip_space(lex_t *lx) {
+    while (LEX_CLASS(lex_peek(lx, lx->p)) & LEX_SPACE)
+        lx->p++;
+}
+
+/*
+ * Scans one word and terminates it in place, returns its start.  A word
+ * never starts on a clobbered delimiter, so the loop reads the line
+ * directly.
+ */
+static char *lex_word(lex_t *lx) {
+    char *r = lx->p, *w = lx->p, *start = lx->p;
+
+    for (;;) {
+        // plain characters need no compaction until the first quote
+        while (!(LEX_CLASS(*r) & (LEX_DELIM | LEX_QUOTE)))
+            *w++ = *r++;
+        if (!(LEX_CLASS(*r) & LEX_QUOTE))
+            break;
+        char quote = *r++;
+        while (*r != quote && *r != '\0')
+            *w++ = *r++;
+        if (*r == quote)
+            r++;
+    }
+
+    // remember the delimiter if the terminator is about to overwrite it
+    if (w == r && *r != '\0') {
+        lx->clobbered = r;
+        lx->saved = *r;
+    }
+    *w = '\0';
+    lx->p = r;
+    return start;
+}
+
+/*
+ * <(pipeline), >(pipeline) or $(pipeline), kind is the first character:
+ * the pipeline is cut out of the line in place at its matching ), it is
+ * parsed when it is started.  For < and > *arg is set to a buffer that
+ * start_proc_subs() fills in with the /dev/fd path, for an argv entry or a
+ * < > file name.  For $ *arg is the pipeline text itself, an argv entry
+ * that expand_cmd_subs() replaces with the words of its output.
+ */
+static int lex_sub(lex_t *lx, cmd_buff_t *cmd_buff, char kind, char **arg) {
+    char *r = lx->p + 2, quote = 0;
+    int depth = 1;
+
+    for (; *r != '\0'; r++) {
+        if (quote) {
+            if (*r == quote)
+                quote = 0;
+        } else if (*r == '"' || *r == '\'') {
+            quote = *r;
+        } else if (*r == '(') {
+            depth++;
+        } else if (*r == ')' && --depth == 0) {
+            break;
+        }
+    }
+    if (*r != ')')
+        return ERR_CMD_ARGS_BAD;
+
+    proc_sub_t *subs = arena_grow(cmd_buff->arena, cmd_buff->subs,
+                                  cmd_buff->nsubs * sizeof(proc_sub_t),
+                                  (cmd_buff->nsubs + 1) * sizeof(proc_sub_t));
+    if (subs == NULL)
+        return ERR_MEMORY;
+    cmd_buff->subs = subs;
+
+    proc_sub_t *sub = &subs[cmd_buff->nsubs++];
+    memset(sub, 0, sizeof(*sub));
+    sub->text = lx->p + 2;
+    sub->out = (kind == '>');
+    sub->capture = (kind == '$');
+    sub->fd = -1;
+    *r = '\0';
+    lx->p = r + 1;
+    if (sub->capture) {
+        *arg = sub->text;
+        return OK;
+    }
+
+    sub->path = arena_alloc(cmd_buff->arena, PROC_SUB_PATH_SZ);
+    if (sub->path == NULL)
+        return ERR_MEMORY;
+    strcpy(sub->path, "/dev/fd/?");
+    *arg = sub->path;
+    return OK;
+}
+
+/*
+ * lex_command(lx, cmd_buff)
+ *
+ *  Lexes one command, up to the next unquoted '|' or '&' or the end of the
+ *  line, into cmd_buff.  Leaves lx just past the '|' or '&'.
+ *
+ *  Returns '|', '&' or '\0' for what ended the command, ERR_MEMORY, or
+ *  ERR_CMD_ARGS_BAD for a <( >( or $( without its ).
+ */
+static int lex_command(lex_t *lx, cmd_buff_t *cmd_buff) {
+    static char no_file[] = "";
+
+    cmd_buff->argc = 0;
+    cmd_buff->argv[0] = NULL;
     cmd_buff->input_file = NULL;
     cmd_buff->output_file = NULL;
     cmd_buff->append_mode = 0;
-    
-    // Trim overall input
-    char *line = trim_whitespace(cmd_buff->_cmd_buffer);
-    if(strlen(line) == 0)
-        return WARN_NO_CMDS;
-    
-    cmd_buff->argc = 0;
-    char *p = line;
-    
-    while(*p) {
-        // skip spaces
-        while(*p && isspace((unsigned char)*p))
-            p++;
-        if(*p == '\0')
-            break;
-        
-        // Check for redirection operators
-        if(*p == '<') {
-            *p++ = '\0';  // Terminate current argument
-            while(*p && isspace((unsigned char)*p))
-                p++;
-            char *start = p;
-            // Find end of filename
-            while(*p && !isspace((unsigned char)*p) && *p != '<' && *p != '>')
-                p++;
-            if(*p) {
-                char temp = *p;
-                *p = '\0';
-                cmd_buff->input_file = strdup(trim_whitespace(start));
-                *p = temp;
-            } else {
-                cmd_buff->input_file = strdup(trim_whitespace(start));
-            }
+    cmd_buff->here_delim = NULL;
+    cmd_buff->here_text = NULL;
+    cmd_buff->here_len = 0;
+    cmd_buff->subs = NULL;
+    cmd_buff->nsubs = 0;
+
+    for (;;) {
+        lex_skip_space(lx);
+        char c = lex_peek(lx, lx->p);
+
+        if (c == '\0' || c == '|' || c == '&') {
+            if (c != '\0')
+                lx->p++;
+            cmd_buff->argv[cmd_buff->argc] = NULL;  // argv must be null terminated
+            return c;
+        }
+
+        if ((c == '<' || c == '>' || c == '$') && lex_peek(lx, lx->p + 1) == '(') {
+            char *arg;
+            int rc = lex_sub(lx, cmd_buff, c, &arg);
+            if (rc == OK)
+                rc = push_arg(cmd_buff, arg);
+            if (rc != OK)
+                return rc;
             continue;
-        } 
-        else if(*p == '>') {
-            *p++ = '\0';  // Terminate current argument
-            
-            // Check for append mode (>>)
-            if(*p == '>') {
-                cmd_buff->append_mode = 1;
-                p++;
-            }
-            
-            while(*p && isspace((unsigned char)*p))
-                p++;
-            char *start = p;
-            // Find end of filename
-            while(*p && !isspace((unsigned char)*p) && *p != '<' && *p != '>')
-                p++;
-            if(*p) {
-                char temp = *p;
-                *p = '\0';
-                cmd_buff->output_file = strdup(trim_whitespace(start));
-                *p = temp;
-            } else {
-                cmd_buff->output_file = strdup(trim_whitespace(start));
+        }
+
+        if (c == '<' && lex_peek(lx, lx->p + 1) == '<') {
+            // <<< word is a here-string, << word a here-document whose
+            // body the command loop reads, it stays empty if nothing does
+            bool here_string = (lex_peek(lx, lx->p + 2) == '<');
+            lx->p += here_string ? 3 : 2;
+            lex_skip_space(lx);
+            c = lex_peek(lx, lx->p);
+            char *word = (LEX_CLASS(c) & LEX_OP) ? no_file : lex_word(lx);
+            cmd_buff->input_file = NULL;
+            cmd_buff->here_text = no_file;
+            cmd_buff->here_len = 0;
+            if (!here_string) {
+                cmd_buff->here_delim = word;
+                continue;
             }
+            cmd_buff->here_len = strlen(word) + 1;
+            cmd_buff->here_text = arena_alloc(cmd_buff->arena, cmd_buff->here_len);
+            if (cmd_buff->here_text == NULL)
+                return ERR_MEMORY;
+            memcpy(cmd_buff->here_text, word, cmd_buff->here_len - 1);
+            cmd_buff->here_text[cmd_buff->here_len - 1] = '\n';
             continue;
         }
-        
-        // If argument is quoted
-        if(*p == '"') {
-            p++;  // skip initial quote
-            char *start = p;
-            // find closing quote
-            while(*p && *p != '"')
-                p++;
-            if(*p == '"') {
-                *p = '\0';
-                p++; // skip closing quote
+
+        if (c == '<' || c == '>') {
+            char **target = (c == '<') ? &cmd_buff->input_file : &cmd_buff->output_file;
+            lx->p++;
+            if (c == '>') {
+                // Check for append mode (>>)
+                cmd_buff->append_mode = (lex_peek(lx, lx->p) == '>');
+                if (cmd_buff->append_mode)
+                    lx->p++;
             }
-            cmd_buff->argv[cmd_buff->argc++] = start;
-        } else { // Non-quoted argument
-            char *start = p;
-            while(*p && !isspace((unsigned char)*p) && *p != '<' && *p != '>')
-                p++;
-            if(*p) {
-                *p = '\0';
-                p++;
+            lex_skip_space(lx);
+            c = lex_peek(lx, lx->p);
+            if ((c == '<' || c == '>') && lex_peek(lx, lx->p + 1) == '(') {
+                // < <(pipeline) and > >(pipeline)
+                int rc = lex_sub(lx, cmd_buff, c, target);
+                if (rc != OK)
+                    return rc;
+            } else {
+                // a missing name fails when the file is opened, like before
+                *target = (LEX_CLASS(c) & LEX_OP) ? no_file : lex_word(lx);
             }
-            cmd_buff->argv[cmd_buff->argc++] = start;
+            if (target == &cmd_buff->input_file) {
+                cmd_buff->here_delim = NULL;
+                cmd_buff->here_text = NULL;
+            }
+            continue;
         }
-        if(cmd_buff->argc >= CMD_ARGV_MAX - 1)
-            break;
+
+        char *word = lex_word(lx);
+        if (push_arg(cmd_buff, word) != OK)
+            return ERR_MEMORY;
     }
-    cmd_buff->argv[cmd_buff->argc] = NULL;  // argv must be null terminated
-    return OK;
+}
+
+int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
+    // copy cmd_line, the arguments point into this copy
+    cmd_buff->_cmd_buffer = arena_strdup(cmd_buff->arena, cmd_line);
+    if(cmd_buff->_cmd_buffer == NULL)
+        return ERR_MEMORY;
+
+    lex_t lx = {.p = cmd_buff->_cmd_buffer};
+    if(lex_command(&lx, cmd_buff) == ERR_MEMORY)
+        return ERR_MEMORY;
+    return (cmd_buff->argc > 0) ? OK : WARN_NO_CMDS;
 }
  
  //Match_command: identify if the command is built-in.
@@ -192,6 +481,16 @@ int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
          return BI_CMD_DRAGON;
      else if(strcmp(input, "rc") == 0)
          return BI_RC;
+     else if(strcmp(input, "hash") == 0)
+         return BI_CMD_HASH;
+     else if(strcmp(input, "jobs") == 0)
+         return BI_CMD_JOBS;
+     else if(strcmp(input, "wait") == 0)
+         return BI_CMD_WAIT;
+     else if(strcmp(input, "fg") == 0)
+         return BI_CMD_FG;
+     else if(strcmp(input, "set") == 0)
+         return BI_CMD_SET;
      return BI_NOT_BI;
  }
  
@@ -213,260 +512,2340 @@ int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
              }
          }
          return BI_EXECUTED;
-     } else if(bi == BI_CMD_DRAGON) {
-         extern void print_dragon();
-         print_dragon();
+     } else if(bi == BI_CMD_DRAGON || bi == BI_RC) {
+         fflush(stdout);
+         match_fd_builtin(cmd->argv[0])(cmd, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+         return BI_EXECUTED;
+     } else if(bi == BI_CMD_HASH) {
+         // hash: list, hash -r: clear, hash name...: look up without running
+         if(cmd->argc == 1) {
+             path_hash_print(stdout);
+         } else if(strcmp(cmd->argv[1], "-r") == 0) {
+             path_hash_clear();
+         } else {
+             char exe[PATH_MAX];
+             for(int i = 1; i < cmd->argc; i++) {
+                 if(path_hash_lookup(cmd->argv[i], exe, sizeof(exe), false) != 0)
+                     fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+             }
+         }
+         return BI_EXECUTED;
+     } else if(bi == BI_CMD_JOBS) {
+         jobs_print(stdout);
+         return BI_EXECUTED;
+     } else if(bi == BI_CMD_WAIT) {
+         jobs_wait(cmd);
+         return BI_EXECUTED;
+     } else if(bi == BI_CMD_FG) {
+         jobs_fg(cmd);
          return BI_EXECUTED;
-     } else if(bi == BI_RC) {
-         // Print last return code from the previous external command.
-         printf("%d\n", last_rc);
+     } else if(bi == BI_CMD_SET) {
+         // set: show the options, set name=value: change one
+         if(cmd->argc == 1) {
+             int size = get_pipe_size();
+             if(size > 0)
+                 printf("pipesize=%d\n", size);
+             else
+                 printf("pipesize=default\n");
+             fflush(stdout);
+         }
+         for(int i = 1; i < cmd->argc; i++) {
+             if(strncmp(cmd->argv[i], "pipesize=", 9) == 0 &&
+                set_pipe_size(cmd->argv[i] + 9) == OK) {
+                 last_rc = 0;
+             } else {
+                 fprintf(stderr, "set: bad option '%s'\n", cmd->argv[i]);
+                 last_rc = 1;
+             }
+         }
          return BI_EXECUTED;
      }
      return BI_NOT_BI;
  }
  
-int build_cmd_list(char *cmd_line, command_list_t *clist) {
-    char *token;
-    char *saveptr;
-    int cmd_count = 0;
-    
-    // Make a copy of cmd_line to tokenize
-    char *line_copy = strdup(cmd_line);
-    if (!line_copy) {
-        return ERR_MEMORY;
-    }
+/*
+ * build_cmd_list(cmd_line, clist, arena)
+ *
+ *  Parses cmd_line in place with one pass of the lexer above, so cmd_line
+ *  must stay untouched until the list has been executed.  Only the command
+ *  and argv arrays are allocated, from arena.  Commands with no words (as
+ *  in `ls | | wc`) are dropped.  A '&' at the end of the line sets
+ *  clist->background, anywhere else it is ERR_CMD_ARGS_BAD, as is a <( >(
+ *  or $( that is never closed.
+ */
+int build_cmd_list(char *cmd_line, command_list_t *clist, arena_t *arena) {
+    lex_t lx = {.p = cmd_line};
+    int stop;
     
     // Initialize command list
     clist->num = 0;
+    clist->cap = 0;
+    clist->commands = NULL;
+    clist->arena = arena;
+    clist->background = false;
     
-    // First, count the number of pipe segments to validate against CMD_MAX
-    char *count_copy = strdup(cmd_line);
-    if (!count_copy) {
-        free(line_copy);
-        return ERR_MEMORY;
-    }
-    
-    char *count_token;
-    char *count_saveptr;
-    int pipe_count = 0;
-    
-    count_token = strtok_r(count_copy, PIPE_STRING, &count_saveptr);
-    while (count_token != NULL) {
-        pipe_count++;
-        count_token = strtok_r(NULL, PIPE_STRING, &count_saveptr);
-    }
-    
-    free(count_copy);
-    
-    // Check if pipe count exceeds CMD_MAX
-    if (pipe_count > CMD_MAX) {
-        fprintf(stderr, CMD_ERR_PIPE_LIMIT, CMD_MAX);
-        free(line_copy);
-        return ERR_TOO_MANY_COMMANDS;
-    }
-    
-    // Tokenize by pipe character for actual processing
-    token = strtok_r(line_copy, PIPE_STRING, &saveptr);
-    while (token != NULL && cmd_count < CMD_MAX) {
-        char *trimmed = trim_whitespace(token);
-        if (strlen(trimmed) > 0) {
-            // Allocate buffer for the command
-            if (alloc_cmd_buff(&clist->commands[cmd_count]) != OK) {
-                free(line_copy);
+    do {
+        // the command array doubles as it fills
+        if (clist->num == clist->cap) {
+            int cap = clist->cap ? clist->cap * 2 : CMD_LIST_INIT;
+            cmd_buff_t *cmds = arena_grow(arena, clist->commands,
+                                          clist->cap * sizeof(cmd_buff_t), cap * sizeof(cmd_buff_t));
+            if (cmds == NULL) {
+                free_cmd_list(clist);
                 return ERR_MEMORY;
             }
-            
-            // Build command from the token
-            if (build_cmd_buff(trimmed, &clist->commands[cmd_count]) == OK) {
-                cmd_count++;
-            }
+            clist->commands = cmds;
+            clist->cap = cap;
+        }
+
+        cmd_buff_t *cmd = &clist->commands[clist->num];
+        if (alloc_cmd_buff(cmd, arena) != OK) {
+            free_cmd_list(clist);
+            return ERR_MEMORY;
+        }
+        cmd->_cmd_buffer = lx.p;
+
+        stop = lex_command(&lx, cmd);
+        if (stop == ERR_MEMORY || stop == ERR_CMD_ARGS_BAD) {
+            free_cmd_list(clist);
+            return stop;
         }
-        token = strtok_r(NULL, PIPE_STRING, &saveptr);
+        if (cmd->argc > 0)
+            clist->num++;
+    } while (stop == '|');
+
+    if (stop == '&') {
+        lex_skip_space(&lx);
+        if (lex_peek(&lx, lx.p) != '\0') {
+            free_cmd_list(clist);
+            return ERR_CMD_ARGS_BAD;
+        }
+        clist->background = true;
     }
     
-    free(line_copy);
-    
-    clist->num = cmd_count;
-    return (cmd_count > 0) ? OK : WARN_NO_CMDS;
+    if (clist->num == 0) {
+        free_cmd_list(clist);
+        return WARN_NO_CMDS;
+    }
+    return OK;
 }
 
+// drops the list's references, the memory goes back with arena_reset()
 int free_cmd_list(command_list_t *cmd_list) {
     for (int i = 0; i < cmd_list->num; i++) {
         free_cmd_buff(&cmd_list->commands[i]);
     }
+    cmd_list->commands = NULL;
     cmd_list->num = 0;
+    cmd_list->cap = 0;
     return OK;
 }
 
-int execute_pipeline(command_list_t *clist) {
-    if (clist->num == 0) {
-        return WARN_NO_CMDS;
-    }
-    
-    // If only one command, check if it's a built-in
-    if (clist->num == 1) {
-        cmd_buff_t *cmd = &clist->commands[0];
-        Built_In_Cmds bi = match_command(cmd->argv[0]);
-        if (bi != BI_NOT_BI) {
-            // Built-in commands don't support redirection
-            if (cmd->input_file != NULL || cmd->output_file != NULL) {
-                fprintf(stderr, "Redirection not supported for built-in commands\n");
-                return ERR_EXEC_CMD;
-            }
-            exec_built_in_cmd(cmd);
-            return OK;
+/*
+ * PATH lookup cache
+ *
+ *  Commands without a '/' are resolved against PATH once and the absolute
+ *  path is remembered in a small chained hash table, so running the same
+ *  tool again skips the scan of every PATH directory that execvp() does.
+ *  The whole table is dropped when PATH changes, and a single entry is
+ *  dropped when spawning its path fails with ENOENT (the binary moved).
+ *  The table is shared by all rsh server threads, so it is locked.
+ *
+ *  The `hash` builtin lists the table, `hash -r` clears it and `hash name`
+ *  looks a command up without running it.
+ */
+#define PATH_HASH_BUCKETS   64          //power of two
+
+typedef struct path_ent {
+    struct path_ent *next;
+    unsigned int    hits;
+    char            *path;
+    char            name[];
+} path_ent_t;
+
+static path_ent_t *path_hash[PATH_HASH_BUCKETS];
+static char *path_hash_env;             //PATH the entries were resolved with
+static pthread_mutex_t path_hash_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int path_hash_bucket(const char *name) {
+    unsigned int h = 2166136261u;      //FNV-1a
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h & (PATH_HASH_BUCKETS - 1);
+}
+
+// drops every entry, caller holds path_hash_lock
+static void path_hash_reset(void) {
+    for (int b = 0; b < PATH_HASH_BUCKETS; b++) {
+        while (path_hash[b] != NULL) {
+            path_ent_t *e = path_hash[b];
+            path_hash[b] = e->next;
+            free(e->path);
+            free(e);
         }
     }
-    
-    int pipes[CMD_MAX-1][2]; // Array of pipes
-    pid_t pids[CMD_MAX];     // Array to store child PIDs
-    
-    // Create all necessary pipes
-    for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) < 0) {
-            perror("pipe");
-            return ERR_EXEC_CMD;
+    free(path_hash_env);
+    path_hash_env = NULL;
+}
+
+// walks PATH the way execvp() does, returns a malloc()ed path or NULL with
+// errno set to ENOENT, or EACCES if only non-executable files were found
+static char *path_search(const char *name, const char *path_env) {
+    size_t name_len = strlen(name);
+    int err = ENOENT;
+
+    while (path_env != NULL) {
+        const char *end = strchr(path_env, ':');
+        size_t dir_len = end ? (size_t)(end - path_env) : strlen(path_env);
+        char *full = malloc(dir_len + name_len + 2);
+        struct stat st;
+
+        if (full == NULL)
+            return NULL;
+        // an empty PATH entry means the current directory
+        if (dir_len == 0)
+            sprintf(full, "./%s", name);
+        else
+            sprintf(full, "%.*s/%s", (int)dir_len, path_env, name);
+
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (access(full, X_OK) == 0)
+                return full;
+            err = EACCES;
         }
+        free(full);
+        path_env = end ? end + 1 : NULL;
     }
-    
-    // Fork and execute each command in the pipeline
-    for (int i = 0; i < clist->num; i++) {
-        cmd_buff_t *cmd = &clist->commands[i];
-        
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("fork");
-            return ERR_EXEC_CMD;
-        }
-        
-        if (pids[i] == 0) {
-            // Child process
-            
-            // Set up input redirection (except for the first command)
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            // Set up output redirection (except for the last command)
-            if (i < clist->num - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
-            
-            // Close all pipe file descriptors in the child
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            
-            // Handle file redirection
-            int fd;
-            
-            // Input redirection (<)
-            if (cmd->input_file != NULL) {
-                fd = open(cmd->input_file, O_RDONLY);
-                if (fd < 0) {
-                    fprintf(stderr, "Cannot open input file: %s\n", cmd->input_file);
-                    exit(1);
-                }
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
-            
-            // Output redirection (> or >>)
-            if (cmd->output_file != NULL) {
-                int flags = O_WRONLY | O_CREAT;
-                
-                if (cmd->append_mode) {
-                    flags |= O_APPEND;  // For >>
-                } else {
-                    flags |= O_TRUNC;   // For >
-                }
-                
-                fd = open(cmd->output_file, flags, 0644);
-                if (fd < 0) {
-                    fprintf(stderr, "Cannot open output file: %s\n", cmd->output_file);
-                    exit(1);
-                }
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
-            
-            // Execute the command
-            execvp(cmd->argv[0], cmd->argv);
-            
-            // If we get here, execvp failed
-            if (errno == ENOENT) {
-                fprintf(stderr, "Command not found in PATH\n");
-            } else if (errno == EACCES) {
-                fprintf(stderr, "Permission denied\n");
-            } else {
-                fprintf(stderr, "execvp error: %s\n", strerror(errno));
-            }
-            exit(errno);
-        }
+    errno = err;
+    return NULL;
+}
+
+/*
+ * path_hash_lookup(name, out, out_len, count_hit)
+ *      name:       command as typed, argv[0]
+ *      out:        receives the path to execute
+ *      out_len:    size of out
+ *      count_hit:  true when the command is about to run, counts it in the
+ *                  hits column of `hash`
+ *
+ *  Returns 0, or ENOENT/EACCES if PATH has no executable of that name.
+ */
+int path_hash_lookup(const char *name, char *out, size_t out_len, bool count_hit) {
+    const char *path_env = getenv("PATH");
+    unsigned int b = path_hash_bucket(name);
+    path_ent_t *e;
+    int rc = 0;
+
+    // a name with a slash is a path already, execvp() does not search either
+    if (strchr(name, '/') != NULL) {
+        snprintf(out, out_len, "%s", name);
+        return 0;
     }
-    
-    // Parent process: close all pipe file descriptors
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    if (path_env == NULL)
+        path_env = "/bin:/usr/bin";
+
+    pthread_mutex_lock(&path_hash_lock);
+    if (path_hash_env == NULL || strcmp(path_hash_env, path_env) != 0) {
+        path_hash_reset();
+        path_hash_env = strdup(path_env);
     }
-    
-    // Wait for all children to complete
-    int status;
-    for (int i = 0; i < clist->num; i++) {
-        waitpid(pids[i], &status, 0);
-        if (i == clist->num - 1) { // Only store exit status of last command in pipeline
-            if (WIFEXITED(status)) {
-                last_rc = WEXITSTATUS(status);
-            } else {
-                last_rc = -1;
-            }
+
+    for (e = path_hash[b]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0)
+            break;
+    }
+    if (e == NULL) {
+        char *full = path_search(name, path_env);
+        if (full == NULL) {
+            rc = errno;
+            pthread_mutex_unlock(&path_hash_lock);
+            return rc;
         }
+        e = malloc(sizeof(path_ent_t) + strlen(name) + 1);
+        if (e == NULL) {
+            // still runnable, just not remembered
+            snprintf(out, out_len, "%s", full);
+            free(full);
+            pthread_mutex_unlock(&path_hash_lock);
+            return 0;
+        }
+        strcpy(e->name, name);
+        e->path = full;
+        e->hits = 0;
+        e->next = path_hash[b];
+        path_hash[b] = e;
     }
-    
-    return OK;
+
+    if (count_hit)
+        e->hits++;
+    snprintf(out, out_len, "%s", e->path);
+    pthread_mutex_unlock(&path_hash_lock);
+    return rc;
 }
 
-int exec_local_cmd_loop()
-{
-    char input_line[SH_CMD_MAX + 1];
-    command_list_t cmd_list;
-    
-    while (1) {
-        printf("%s", SH_PROMPT);
-        if (fgets(input_line, sizeof(input_line), stdin) == NULL) {
-            printf("\n");
+// forgets one command, used when its cached path no longer exists
+void path_hash_forget(const char *name) {
+    unsigned int b = path_hash_bucket(name);
+
+    pthread_mutex_lock(&path_hash_lock);
+    for (path_ent_t **pe = &path_hash[b]; *pe != NULL; pe = &(*pe)->next) {
+        if (strcmp((*pe)->name, name) == 0) {
+            path_ent_t *e = *pe;
+            *pe = e->next;
+            free(e->path);
+            free(e);
             break;
         }
-        
-        // Remove trailing newline
-        input_line[strcspn(input_line, "\n")] = '\0';
-        
-        // Skip empty lines
-        if (strlen(trim_whitespace(input_line)) == 0) {
-            continue;
+    }
+    pthread_mutex_unlock(&path_hash_lock);
+}
+
+void path_hash_clear(void) {
+    pthread_mutex_lock(&path_hash_lock);
+    path_hash_reset();
+    pthread_mutex_unlock(&path_hash_lock);
+}
+
+// prints the table for the `hash` builtin
+void path_hash_print(FILE *out) {
+    bool empty = true;
+
+    pthread_mutex_lock(&path_hash_lock);
+    for (int b = 0; b < PATH_HASH_BUCKETS; b++) {
+        for (path_ent_t *e = path_hash[b]; e != NULL; e = e->next) {
+            if (empty)
+                fprintf(out, "hits\tcommand\n");
+            empty = false;
+            fprintf(out, "%4u\t%s\n", e->hits, e->path);
         }
-        
-        // Parse the command line into a command list
-        int rc = build_cmd_list(input_line, &cmd_list);
-        
-        if (rc == WARN_NO_CMDS) {
-            fprintf(stderr, CMD_WARN_NO_CMD);
-            continue;
-        } else if (rc == ERR_TOO_MANY_COMMANDS) {
-            fprintf(stderr, CMD_ERR_PIPE_LIMIT, CMD_MAX);
-            continue;
-        } else if (rc != OK) {
-            continue;
+    }
+    pthread_mutex_unlock(&path_hash_lock);
+
+    if (empty)
+        fprintf(out, "hash: hash table empty\n");
+}
+
+// spawns one command through the PATH cache, retrying once with a fresh
+// lookup if the remembered path has gone away
+static int spawn_cached(pid_t *pid, cmd_buff_t *cmd, posix_spawn_file_actions_t *fa,
+                        const posix_spawnattr_t *attr) {
+    char exe[PATH_MAX];
+    int rc = path_hash_lookup(cmd->argv[0], exe, sizeof(exe), true);
+
+    if (rc == 0)
+        rc = posix_spawn(pid, exe, fa, attr, cmd->argv, environ);
+    if (rc == ENOENT && strchr(cmd->argv[0], '/') == NULL) {
+        path_hash_forget(cmd->argv[0]);
+        rc = path_hash_lookup(cmd->argv[0], exe, sizeof(exe), true);
+        if (rc == 0)
+            rc = posix_spawn(pid, exe, fa, attr, cmd->argv, environ);
+    }
+    return rc;
+}
+
+/*
+ * Builtins that take their stdin/stdout/stderr as file descriptors
+ *
+ *  These never touch stdio or the shell's own fds 0-2 directly, so the same
+ *  function can run in the shell process when it is the only command (with
+ *  any < or > files opened for it) or on a thread as one stage of a
+ *  pipeline, reading and writing the pipe ends.  Either way no fork() or
+ *  exec() is paid for them.  Each returns the exit code the command would
+ *  have had.  cd, exit and hash change shell state and stay in
+ *  exec_built_in_cmd().
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
         }
-        
-        // Execute the command pipeline
-        execute_pipeline(&cmd_list);
-        
-        // Free the command list resources
-        free_cmd_list(&cmd_list);
+        buf += n;
+        len -= n;
     }
-    
-    return OK;
+    return 0;
+}
+
+// dprintf() sets up a heap buffered stream on every call, builtins format
+// into the stack instead; returns -1 on a write error like dprintf()
+static int fd_printf(int fd, const char *fmt, ...) {
+    char buf[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if ((size_t)len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    return write_all(fd, buf, len) == 0 ? len : -1;
+}
+
+static int bi_echo(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    bool newline = true;
+    int first = 1;
+    size_t len = 0;
+    char small[1024];
+    char *buf, *p;
+    (void)in_fd;
+
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+        newline = false;
+        first = 2;
+    }
+    for (int i = first; i < cmd->argc; i++)
+        len += strlen(cmd->argv[i]) + 1;
+
+    // one write, so a pipe reader never sees half a line
+    buf = p = (len + 1 <= sizeof(small)) ? small : malloc(len + 1);
+    if (buf == NULL) {
+        fd_printf(err_fd, "echo: %s\n", strerror(errno));
+        return 1;
+    }
+    for (int i = first; i < cmd->argc; i++) {
+        if (i > first)
+            *p++ = ' ';
+        p = stpcpy(p, cmd->argv[i]);
+    }
+    if (newline)
+        *p++ = '\n';
+
+    int rc = write_all(out_fd, buf, p - buf) == 0 ? 0 : 1;
+    if (buf != small)
+        free(buf);
+    return rc;
+}
+
+static int bi_pwd(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    char cwd[PATH_MAX];
+    (void)cmd; (void)in_fd;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fd_printf(err_fd, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    return fd_printf(out_fd, "%s\n", cwd) < 0 ? 1 : 0;
+}
+
+static int bi_true(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    (void)cmd; (void)in_fd; (void)out_fd; (void)err_fd;
+    return 0;
+}
+
+static int bi_false(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    (void)cmd; (void)in_fd; (void)out_fd; (void)err_fd;
+    return 1;
+}
+
+static int bi_rc(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    (void)cmd; (void)in_fd; (void)err_fd;
+    // Print last return code from the previous command.
+    return fd_printf(out_fd, "%d\n", last_rc) < 0 ? 1 : 0;
+}
+
+static int bi_dragon(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    extern void print_dragon_fd(int fd);
+    (void)cmd; (void)in_fd; (void)err_fd;
+    print_dragon_fd(out_fd);
+    return 0;
+}
+
+// copies all of from to out, -1 on a read or write error
+static int copy_fd(int from, int out) {
+    char buf[BI_IO_BUFF_SZ];
+    ssize_t n;
+
+    while ((n = read(from, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (write_all(out, buf, n) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int bi_cat(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    int rc = 0;
+
+    if (cmd->argc == 1)
+        return copy_fd(in_fd, out_fd) == 0 ? 0 : 1;
+
+    for (int i = 1; i < cmd->argc; i++) {
+        int fd = in_fd;
+        if (strcmp(cmd->argv[i], "-") != 0) {
+            fd = open(cmd->argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                fd_printf(err_fd, "cat: %s: %s\n", cmd->argv[i], strerror(errno));
+                rc = 1;
+                continue;
+            }
+        }
+        if (copy_fd(fd, out_fd) != 0) {
+            fd_printf(err_fd, "cat: %s: %s\n", cmd->argv[i], strerror(errno));
+            rc = 1;
+        }
+        if (fd != in_fd)
+            close(fd);
+    }
+    return rc;
+}
+
+typedef struct wc_counts {
+    long lines;
+    long words;
+    long bytes;
+} wc_counts_t;
+
+static int wc_fd(int fd, wc_counts_t *c) {
+    char buf[BI_IO_BUFF_SZ];
+    bool in_word = false;
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        c->bytes += n;
+        for (ssize_t i = 0; i < n; i++) {
+            bool space = isspace((unsigned char)buf[i]);
+            c->lines += (buf[i] == '\n');
+            c->words += (!space && !in_word);
+            in_word = !space;
+        }
+    }
+    return 0;
+}
+
+// one output line, a lone count is printed bare like `wc -l`
+static void wc_print(int out_fd, const wc_counts_t *c, bool l, bool w, bool b, const char *name) {
+    int shown = l + w + b;
+    const char *fmt = (shown == 1) ? "%ld" : "%7ld";
+    bool first = true;
+    char line[128];
+    int len = 0;
+
+    if (l) { len += snprintf(line + len, sizeof(line) - len, fmt, c->lines); first = false; }
+    if (w) { len += snprintf(line + len, sizeof(line) - len, first ? fmt : " %7ld", c->words); first = false; }
+    if (b) { len += snprintf(line + len, sizeof(line) - len, first ? fmt : " %7ld", c->bytes); }
+    fd_printf(out_fd, "%s%s%s\n", line, name ? " " : "", name ? name : "");
+}
+
+static int bi_wc(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    bool l = false, w = false, b = false;
+    wc_counts_t total = {0};
+    int nfiles = 0, rc = 0;
+    int first = 1;
+
+    // -l -w -c in any combination, none means all three
+    for (; first < cmd->argc && cmd->argv[first][0] == '-' && cmd->argv[first][1]; first++) {
+        for (char *f = cmd->argv[first] + 1; *f; f++) {
+            if (*f == 'l') l = true;
+            else if (*f == 'w') w = true;
+            else if (*f == 'c') b = true;
+            else {
+                fd_printf(err_fd, "wc: invalid option -- '%c'\n", *f);
+                return 1;
+            }
+        }
+    }
+    if (!l && !w && !b)
+        l = w = b = true;
+
+    if (first == cmd->argc) {
+        if (wc_fd(in_fd, &total) != 0) {
+            fd_printf(err_fd, "wc: %s\n", strerror(errno));
+            return 1;
+        }
+        wc_print(out_fd, &total, l, w, b, NULL);
+        return 0;
+    }
+
+    for (int i = first; i < cmd->argc; i++) {
+        wc_counts_t c = {0};
+        int fd = open(cmd->argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || wc_fd(fd, &c) != 0) {
+            fd_printf(err_fd, "wc: %s: %s\n", cmd->argv[i], strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            rc = 1;
+            continue;
+        }
+        close(fd);
+        wc_print(out_fd, &c, l, w, b, cmd->argv[i]);
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+        nfiles++;
+    }
+    if (nfiles > 1)
+        wc_print(out_fd, &total, l, w, b, "total");
+    return rc;
+}
+
+/*
+ * parallel [-j N] [-k] command [arg...] [::: input...]
+ *
+ *  Runs command once per input, N at a time (default one per online CPU).
+ *  Every {} in the command's words is replaced by the input; without a {}
+ *  the input is added as the last argument.  Inputs follow :::, or come
+ *  one per line from stdin.  Children are posix_spawn()ed and waited for
+ *  through pidfds, poll() tells which have exited and waitid(P_PIDFD) reaps
+ *  exactly those, so children of background jobs or of other pipeline
+ *  stages are never taken.  With -k each job's stdout is buffered from a
+ *  pipe and written in input order as soon as the jobs before it are done,
+ *  otherwise the jobs share stdout.  Jobs read /dev/null.
+ *
+ *  Returns 0 when every job exited 0, else the number of failed jobs, 101
+ *  for more than 100, as GNU parallel does.
+ */
+#define PAR_FAILED_MAX  100
+#define PAR_READ_SZ     (1024*16)
+
+typedef struct par_out {
+    char    *buf;
+    size_t  len;
+    size_t  cap;
+    bool    done;               // job finished, buf is complete
+} par_out_t;
+
+typedef struct par_slot {
+    int     input;              // -1 when the slot is free
+    int     pidfd;              // -1 once reaped
+    pid_t   pid;                // no pidfd, reaped with waitpid() once done
+    int     out_fd;             // -k pipe, -1 once drained
+} par_slot_t;
+
+static int par_append(par_out_t *o, const char *data, size_t len) {
+    if (o->len + len > o->cap) {
+        size_t cap = o->cap ? o->cap * 2 : PAR_READ_SZ;
+        while (cap < o->len + len)
+            cap *= 2;
+        char *buf = realloc(o->buf, cap);
+        if (buf == NULL)
+            return -1;
+        o->buf = buf;
+        o->cap = cap;
+    }
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+    return 0;
+}
+
+// each {} in word replaced by input, word itself if it has none
+static char *par_subst(arena_t *a, char *word, const char *input) {
+    size_t n = 0, in_len = strlen(input);
+    char *p, *out, *w;
+
+    for (p = strstr(word, "{}"); p != NULL; p = strstr(p + 2, "{}"))
+        n++;
+    if (n == 0)
+        return word;
+
+    out = arena_alloc(a, strlen(word) + n * in_len - n * 2 + 1);
+    if (out == NULL)
+        return NULL;
+    for (w = out; *word; ) {
+        if (word[0] == '{' && word[1] == '}') {
+            memcpy(w, input, in_len);
+            w += in_len;
+            word += 2;
+        } else {
+            *w++ = *word++;
+        }
+    }
+    *w = '\0';
+    return out;
+}
+
+// starts the job for input into slot, returns 0 or an errno
+static int par_start(par_slot_t *slot, char **tmpl, int ntmpl, const char *input,
+                     bool keep, int null_fd, int out_fd, int err_fd,
+                     const posix_spawnattr_t *attr, arena_t *a) {
+    cmd_buff_t job;
+    posix_spawn_file_actions_t fa;
+    bool placeholder = false;
+    int pipe_fds[2] = {-1, -1};
+    pid_t pid;
+    int rc;
+
+    arena_reset(a);
+    memset(&job, 0, sizeof(job));
+    job.argv = arena_alloc(a, (ntmpl + 2) * sizeof(char *));
+    if (job.argv == NULL)
+        return ENOMEM;
+    for (int i = 0; i < ntmpl; i++) {
+        job.argv[i] = par_subst(a, tmpl[i], input);
+        if (job.argv[i] == NULL)
+            return ENOMEM;
+        placeholder |= (job.argv[i] != tmpl[i]);
+    }
+    job.argc = ntmpl;
+    if (!placeholder)
+        job.argv[job.argc++] = (char *)input;
+    job.argv[job.argc] = NULL;
+
+    if (keep && pipe2(pipe_fds, O_CLOEXEC) < 0)
+        return errno;
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, null_fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, keep ? pipe_fds[1] : out_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, err_fd, STDERR_FILENO);
+    rc = spawn_cached(&pid, &job, &fa, attr);
+    posix_spawn_file_actions_destroy(&fa);
+
+    if (keep)
+        close(pipe_fds[1]);
+    if (rc != 0) {
+        if (keep)
+            close(pipe_fds[0]);
+        return rc;
+    }
+
+    // without a pidfd the job is waited for with waitpid() as soon as its
+    // output is drained, or right away without -k
+    slot->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    slot->pid = (slot->pidfd < 0) ? pid : 0;
+    slot->out_fd = pipe_fds[0];
+    return 0;
+}
+
+// all of fd in one malloc()ed, NUL terminated buffer
+static char *read_all(int fd, size_t *len) {
+    par_out_t o = {0};
+    char chunk[PAR_READ_SZ];
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (par_append(&o, chunk, n) != 0)
+            break;
+    }
+    if (par_append(&o, "", 1) != 0) {
+        free(o.buf);
+        return NULL;
+    }
+    *len = o.len - 1;
+    return o.buf;
+}
+
+static int bi_parallel(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd) {
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep = false;
+    int a = 1, ntmpl, ninputs = 0, failed = 0;
+    char **inputs = NULL, *stdin_buf = NULL;
+
+    for (; a < cmd->argc && cmd->argv[a][0] == '-'; a++) {
+        if (strcmp(cmd->argv[a], "-k") == 0) {
+            keep = true;
+        } else if (strncmp(cmd->argv[a], "-j", 2) == 0) {
+            const char *n = cmd->argv[a][2] ? cmd->argv[a] + 2
+                            : (a + 1 < cmd->argc) ? cmd->argv[++a] : "";
+            njobs = atol(n);
+            if (njobs < 1)
+                break;
+        } else {
+            break;
+        }
+    }
+    for (ntmpl = 0; a + ntmpl < cmd->argc && strcmp(cmd->argv[a + ntmpl], ":::") != 0; ntmpl++)
+        ;
+    if (ntmpl == 0 || njobs < 1 || (a < cmd->argc && cmd->argv[a][0] == '-')) {
+        fd_printf(err_fd, "usage: parallel [-j N] [-k] command [arg...] [::: input...]\n");
+        return 2;
+    }
+    char **tmpl = &cmd->argv[a];
+
+    // the work queue is the list of inputs, taken in order
+    if (a + ntmpl < cmd->argc) {
+        inputs = &cmd->argv[a + ntmpl + 1];
+        ninputs = cmd->argc - (a + ntmpl + 1);
+    } else {
+        size_t len;
+        stdin_buf = read_all(in_fd, &len);
+        if (stdin_buf == NULL)
+            return 1;
+        for (size_t i = 0; i < len; i++)
+            ninputs += (stdin_buf[i] == '\n' || i == len - 1);
+        inputs = malloc((ninputs + 1) * sizeof(char *));
+        if (inputs == NULL) {
+            free(stdin_buf);
+            return 1;
+        }
+        ninputs = 0;
+        for (char *line = stdin_buf, *nl; *line; line = nl + 1) {
+            nl = strchr(line, '\n');
+            inputs[ninputs++] = line;
+            if (nl == NULL)
+                break;
+            *nl = '\0';
+        }
+    }
+    if (njobs > ninputs)
+        njobs = ninputs > 0 ? ninputs : 1;
+
+    par_slot_t *slots = calloc(njobs, sizeof(par_slot_t));
+    struct pollfd *pfds = malloc(njobs * 2 * sizeof(struct pollfd));
+    par_slot_t **pslot = malloc(njobs * 2 * sizeof(par_slot_t *));
+    par_out_t *outs = keep ? calloc(ninputs ? ninputs : 1, sizeof(par_out_t)) : NULL;
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    arena_t argv_arena = {0};
+    posix_spawnattr_t attr;
+    sigset_t none;
+
+    if (slots == NULL || pfds == NULL || pslot == NULL || (keep && outs == NULL) ||
+        null_fd < 0 || arena_init(&argv_arena, ARENA_INIT_SZ) != OK) {
+        fd_printf(err_fd, "parallel: %s\n", strerror(errno ? errno : ENOMEM));
+        ninputs = 0;
+        failed = 1;
+    }
+    for (int i = 0; slots != NULL && i < njobs; i++)
+        slots[i].input = -1;
+
+    // on a pipeline thread SIGPIPE and SIGCHLD are blocked, the jobs must
+    // not start that way
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    int next = 0, running = 0, flushed = 0;
+    while (next < ninputs || running > 0) {
+        // keep every slot busy while there is work
+        for (int i = 0; i < njobs && next < ninputs; i++) {
+            if (slots[i].input >= 0)
+                continue;
+            int err = par_start(&slots[i], tmpl, ntmpl, inputs[next], keep, null_fd,
+                                out_fd, err_fd, &attr, &argv_arena);
+            if (err != 0) {
+                fd_printf(err_fd, "parallel: %s: %s\n", tmpl[0], strerror(err));
+                failed++;
+                if (keep)
+                    outs[next].done = true;
+            } else {
+                slots[i].input = next;
+                running++;
+            }
+            next++;
+        }
+
+        int npfds = 0;
+        for (int i = 0; i < njobs; i++) {
+            if (slots[i].input < 0)
+                continue;
+            if (slots[i].pidfd >= 0) {
+                pfds[npfds] = (struct pollfd){.fd = slots[i].pidfd, .events = POLLIN};
+                pslot[npfds++] = &slots[i];
+            }
+            if (keep && slots[i].out_fd >= 0) {
+                pfds[npfds] = (struct pollfd){.fd = slots[i].out_fd, .events = POLLIN};
+                pslot[npfds++] = &slots[i];
+            }
+        }
+        if (npfds > 0 && poll(pfds, npfds, -1) < 0 && errno != EINTR)
+            break;
+
+        for (int p = 0; p < npfds; p++) {
+            par_slot_t *slot = pslot[p];
+            if (pfds[p].revents == 0)
+                continue;
+            if (pfds[p].fd == slot->pidfd) {
+                siginfo_t info;
+                memset(&info, 0, sizeof(info));
+                if (waitid(P_PIDFD, slot->pidfd, &info, WEXITED) == 0 &&
+                    !(info.si_code == CLD_EXITED && info.si_status == 0))
+                    failed++;
+                close(slot->pidfd);
+                slot->pidfd = -1;
+            } else {
+                char chunk[PAR_READ_SZ];
+                ssize_t n = read(slot->out_fd, chunk, sizeof(chunk));
+                if (n > 0 && par_append(&outs[slot->input], chunk, n) == 0)
+                    continue;
+                if (n < 0 && errno == EINTR)
+                    continue;
+                close(slot->out_fd);
+                slot->out_fd = -1;
+            }
+        }
+
+        for (int i = 0; i < njobs; i++) {
+            if (slots[i].input >= 0 && slots[i].pidfd < 0 && (!keep || slots[i].out_fd < 0)) {
+                int status;
+                if (slots[i].pid > 0 && waitpid(slots[i].pid, &status, 0) == slots[i].pid &&
+                    !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+                    failed++;
+                slots[i].pid = 0;
+                if (keep)
+                    outs[slots[i].input].done = true;
+                slots[i].input = -1;
+                running--;
+            }
+        }
+
+        // -k: write out everything that is complete and next in order
+        while (keep && flushed < next && outs[flushed].done) {
+            write_all(out_fd, outs[flushed].buf, outs[flushed].len);
+            free(outs[flushed].buf);
+            outs[flushed++].buf = NULL;
+        }
+    }
+
+    posix_spawnattr_destroy(&attr);
+    arena_free(&argv_arena);
+    if (null_fd >= 0)
+        close(null_fd);
+    free(outs);
+    free(pslot);
+    free(pfds);
+    free(slots);
+    if (stdin_buf != NULL) {
+        free(inputs);
+        free(stdin_buf);
+    }
+    return (failed > PAR_FAILED_MAX) ? PAR_FAILED_MAX + 1 : failed;
+}
+
+static const struct {
+    const char      *name;
+    builtin_fn_t    fn;
+} fd_builtins[] = {
+    {"echo",   bi_echo},
+    {"pwd",    bi_pwd},
+    {"true",   bi_true},
+    {"false",  bi_false},
+    {"rc",     bi_rc},
+    {"dragon", bi_dragon},
+    {"cat",    bi_cat},
+    {"wc",     bi_wc},
+    {"parallel", bi_parallel},
+};
+
+// returns the fd builtin called name, NULL for anything else
+builtin_fn_t match_fd_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(fd_builtins) / sizeof(fd_builtins[0]); i++) {
+        if (strcmp(fd_builtins[i].name, name) == 0)
+            return fd_builtins[i].fn;
+    }
+    return NULL;
+}
+
+/*
+ * Here-documents and here-strings
+ *
+ *  The text of a << or <<< never goes to the filesystem.  Up to PIPE_BUF
+ *  bytes are written into a pipe, which always has room for them, and the
+ *  read end becomes stdin.  Anything bigger goes into a memfd_create() file
+ *  that is rewound and handed over the same way, so the writer never has
+ *  to wait for the command to read.
+ */
+#define HERE_PIPE_MAX   PIPE_BUF
+
+static int open_here_text(const char *text, size_t len) {
+    int fd, saved;
+
+    if (len <= HERE_PIPE_MAX) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            return -1;
+        if (write_all(fds[1], text, len) != 0) {
+            saved = errno;
+            close(fds[0]);
+            close(fds[1]);
+            errno = saved;
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    fd = memfd_create("dsh-here", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (write_all(fd, text, len) != 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// opens the < and > files of cmd, replacing *in_fd / *out_fd with them;
+// on failure reports on err_fd and returns SPAWN_ERR_REDIR
+static int open_redirects(cmd_buff_t *cmd, int *in_fd, int *out_fd, int err_fd) {
+    int in_file = -1;
+
+    // Here-document or here-string (<< <<<)
+    if (cmd->here_text != NULL) {
+        in_file = open_here_text(cmd->here_text, cmd->here_len);
+        if (in_file < 0) {
+            fd_printf(err_fd, "Cannot create here-document: %s\n", strerror(errno));
+            return SPAWN_ERR_REDIR;
+        }
+    }
+
+    // Input redirection (<)
+    if (cmd->input_file != NULL) {
+        in_file = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (in_file < 0) {
+            fd_printf(err_fd, "Cannot open input file: %s\n", cmd->input_file);
+            return SPAWN_ERR_REDIR;
+        }
+    }
+
+    // Output redirection (> or >>)
+    if (cmd->output_file != NULL) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        flags |= cmd->append_mode ? O_APPEND : O_TRUNC;
+
+        int out_file = open(cmd->output_file, flags, 0644);
+        if (out_file < 0) {
+            fd_printf(err_fd, "Cannot open output file: %s\n", cmd->output_file);
+            if (in_file >= 0)
+                close(in_file);
+            return SPAWN_ERR_REDIR;
+        }
+        *out_fd = out_file;
+    }
+    if (in_file >= 0)
+        *in_fd = in_file;
+    return 0;
+}
+
+static void *builtin_thread(void *arg) {
+    stage_t *st = (stage_t *)arg;
+
+    st->rc = st->builtin(st->cmd, st->fds[0], st->fds[1], st->fds[2]);
+    clock_gettime(CLOCK_MONOTONIC, &st->end);
+    getrusage(RUSAGE_THREAD, &st->ru);
+
+    // closing our copy of the pipe is what gives the next stage its EOF
+    for (int i = 0; i < 3; i++)
+        close(st->fds[i]);
+    return NULL;
+}
+
+// gives a pipeline stage builtin its own copies of its fds and starts it
+static int start_builtin(stage_t *st, int in_fd, int out_fd, int err_fd) {
+    int fds[3] = {in_fd, out_fd, err_fd};
+
+    for (int i = 0; i < 3; i++) {
+        st->fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+        if (st->fds[i] < 0) {
+            int err = errno;
+            while (i-- > 0)
+                close(st->fds[i]);
+            return err;
+        }
+    }
+    // the thread starts with these blocked: a reader that went away makes
+    // write() fail with EPIPE instead of killing the whole shell, and
+    // SIGCHLD is left to the main thread, see Background jobs
+    sigset_t set, old;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    int err = pthread_create(&st->tid, NULL, builtin_thread, st);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err != 0) {
+        for (int i = 0; i < 3; i++)
+            close(st->fds[i]);
+        return EAGAIN;
+    }
+    st->threaded = true;
+    return 0;
+}
+
+/*
+ * Pipe capacity
+ *
+ *  Pipes between stages get the kernel default capacity (64K on Linux)
+ *  unless the pipesize option is set, with `set pipesize=1M` or DSH_PIPESIZE
+ *  in the environment.  Bigger pipes let a bulk data pipeline move more per
+ *  wakeup instead of ping-ponging between stages.  The size is capped at
+ *  /proc/sys/fs/pipe-max-size, which is as far as F_SETPIPE_SZ goes without
+ *  CAP_SYS_RESOURCE.
+ */
+#define PIPE_MAX_SIZE_FILE  "/proc/sys/fs/pipe-max-size"
+#define PIPESIZE_ENV        "DSH_PIPESIZE"
+
+static int pipe_size;                   //0 for the kernel default
+static pthread_once_t pipe_size_once = PTHREAD_ONCE_INIT;
+
+static int parse_pipe_size(const char *spec) {
+    char *end;
+    unsigned long long n;
+    long max = 0;
+    FILE *f;
+
+    if (strcmp(spec, "default") == 0) {
+        pipe_size = 0;
+        return OK;
+    }
+
+    errno = 0;
+    n = strtoull(spec, &end, 10);
+    if (errno != 0 || end == spec)
+        return ERR_CMD_ARGS_BAD;
+    switch (toupper((unsigned char)*end)) {
+    case 'G': n <<= 10;     /* fall through */
+    case 'M': n <<= 10;     /* fall through */
+    case 'K': n <<= 10; end++; break;
+    }
+    if (*end != '\0')
+        return ERR_CMD_ARGS_BAD;
+
+    f = fopen(PIPE_MAX_SIZE_FILE, "re");
+    if (f != NULL) {
+        if (fscanf(f, "%ld", &max) != 1)
+            max = 0;
+        fclose(f);
+    }
+    if (max > 0 && n > (unsigned long long)max)
+        n = max;
+    pipe_size = (n > INT_MAX) ? INT_MAX : (int)n;
+    return OK;
+}
+
+static void pipe_size_from_env(void) {
+    const char *env = getenv(PIPESIZE_ENV);
+
+    if (env != NULL && parse_pipe_size(env) != OK)
+        fprintf(stderr, "%s: bad size '%s'\n", PIPESIZE_ENV, env);
+}
+
+/*
+ * set_pipe_size(spec)
+ *      spec:  bytes, with an optional K, M or G suffix, or 0 or "default"
+ *
+ *  Sets the capacity of the pipes of every pipeline started from now on.
+ *
+ *  Returns OK, or ERR_CMD_ARGS_BAD if spec is not a size.
+ */
+int set_pipe_size(const char *spec) {
+    pthread_once(&pipe_size_once, pipe_size_from_env);
+    return parse_pipe_size(spec);
+}
+
+// pipe capacity for new pipelines, 0 for the kernel default
+int get_pipe_size(void) {
+    pthread_once(&pipe_size_once, pipe_size_from_env);
+    return pipe_size;
+}
+
+/*
+ * spawn_pipeline(clist, in_fd, out_fd, err_fd, stages)
+ *      clist:   parsed pipeline to start
+ *      in_fd:   stdin of the first command
+ *      out_fd:  stdout of the last command
+ *      err_fd:  stderr of the last command, earlier commands keep ours
+ *      stages:  filled with one entry per command, see stage_t
+ *
+ *  Starts every command of the pipeline without forking the shell.  External
+ *  commands are found through the PATH lookup cache above and started with
+ *  posix_spawn(), the pipes and redirection files are opened here with
+ *  O_CLOEXEC and handed over as dup2 file actions, so the children only
+ *  inherit their own stdin/stdout/stderr.  Builtins from match_fd_builtin()
+ *  run on a thread of the shell instead.  A < or > file replaces the pipe on
+ *  that side, the same as the old fork() and dup2() code did.  Redirection
+ *  errors are reported on the stderr the command would have had; exec errors
+ *  are left to the caller.  Use wait_stage() on every stage afterwards.
+ *
+ *  Returns OK, or ERR_EXEC_CMD if the pipes could not be created.
+ */
+static void add_dup(posix_spawn_file_actions_t *fa, int from, int to) {
+    if (from != to)
+        posix_spawn_file_actions_adddup2(fa, from, to);
+}
+
+int spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int err_fd,
+                   stage_t stages[]) {
+    int last = clist->num - 1;
+    int (*pipes)[2] = arena_alloc(clist->arena, (last > 0 ? last : 1) * sizeof(*pipes));
+    int size = get_pipe_size();
+
+    if (pipes == NULL) {
+        return ERR_EXEC_CMD;
+    }
+
+    // Create all necessary pipes
+    for (int i = 0; i < last; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+            perror("pipe");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return ERR_EXEC_CMD;
+        }
+        // best effort, a pipe that can't grow still works
+        if (size > 0)
+            fcntl(pipes[i][1], F_SETPIPE_SZ, size);
+    }
+
+    for (int i = 0; i <= last; i++) {
+        stage_t *st = &stages[i];
+        cmd_buff_t *cmd = &clist->commands[i];
+        int stage_in = (i == 0) ? in_fd : pipes[i-1][0];
+        int stage_out = (i == last) ? out_fd : pipes[i][1];
+        int stage_err = (i == last) ? err_fd : STDERR_FILENO;
+        posix_spawn_file_actions_t fa;
+
+        memset(st, 0, sizeof(*st));
+        st->pid = -1;
+        st->cmd = cmd;
+        clock_gettime(CLOCK_MONOTONIC, &st->start);
+        st->builtin = match_fd_builtin(cmd->argv[0]);
+
+        // only execute_pipeline() starts process substitutions
+        if (cmd->nsubs > 0 && cmd->subs[0].fd < 0) {
+            st->err = ENOTSUP;
+            continue;
+        }
+
+        st->err = open_redirects(cmd, &stage_in, &stage_out, stage_err);
+        if (st->err != 0)
+            continue;
+
+        if (st->builtin != NULL) {
+            st->err = start_builtin(st, stage_in, stage_out, stage_err);
+        } else {
+            posix_spawn_file_actions_init(&fa);
+            add_dup(&fa, stage_in, STDIN_FILENO);
+            add_dup(&fa, stage_out, STDOUT_FILENO);
+            add_dup(&fa, stage_err, STDERR_FILENO);
+            // a dup2 onto itself clears O_CLOEXEC, so only this command
+            // inherits its /dev/fd pipes
+            for (int s = 0; s < cmd->nsubs; s++)
+                posix_spawn_file_actions_adddup2(&fa, cmd->subs[s].fd, cmd->subs[s].fd);
+
+            st->err = spawn_cached(&st->pid, cmd, &fa, NULL);
+            if (st->err != 0)
+                st->pid = -1;
+            posix_spawn_file_actions_destroy(&fa);
+        }
+
+        if (cmd->input_file != NULL || cmd->here_text != NULL)
+            close(stage_in);
+        if (cmd->output_file != NULL)
+            close(stage_out);
+    }
+
+    // Parent process: close all pipe file descriptors
+    for (int i = 0; i < last; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    return OK;
+}
+
+/*
+ * wait_stage(st)
+ *      st:   a stage started by spawn_pipeline() with st->err == 0
+ *
+ *  Waits for the child or joins the builtin thread, and fills in st->end
+ *  and st->ru.
+ *
+ *  Returns the status in waitpid() form, so WIFEXITED()/WEXITSTATUS() work
+ *  for both.
+ */
+int wait_stage(stage_t *st) {
+    int status = 0;
+
+    if (st->threaded) {
+        pthread_join(st->tid, NULL);
+        st->threaded = false;
+        return (st->rc & 0xff) << 8;
+    }
+    if (st->pid > 0) {
+        while (wait4(st->pid, &status, 0, &st->ru) < 0 && errno == EINTR)
+            ;
+        clock_gettime(CLOCK_MONOTONIC, &st->end);
+    }
+    return status;
+}
+
+// reports commands spawn_pipeline() could not start
+static void report_stage_errors(stage_t stages[], int n) {
+    for (int i = 0; i < n; i++) {
+        if (stages[i].err == ENOENT) {
+            fprintf(stderr, "Command not found in PATH\n");
+        } else if (stages[i].err == EACCES) {
+            fprintf(stderr, "Permission denied\n");
+        } else if (stages[i].err == ENOTSUP) {
+            fprintf(stderr, "Process substitution only works in the foreground\n");
+        } else if (stages[i].err > 0) {
+            fprintf(stderr, "dsh: %s: %s\n", stages[i].cmd->argv[0], strerror(stages[i].err));
+        }
+    }
+}
+
+// Same code the child used to exit with: 1 for a bad redirection, errno
+// for a failed exec
+static int stage_err_rc(int err) {
+    return (err == SPAWN_ERR_REDIR) ? 1 : err;
+}
+
+static int status_rc(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// runs a lone fd builtin in the shell process itself
+static int run_builtin_here(cmd_buff_t *cmd, builtin_fn_t fn) {
+    int in_fd = STDIN_FILENO, out_fd = STDOUT_FILENO;
+
+    if (open_redirects(cmd, &in_fd, &out_fd, STDERR_FILENO) != 0) {
+        last_rc = 1;
+        return OK;
+    }
+
+    // stdio output so far has to come out before the builtin's own writes
+    fflush(stdout);
+    last_rc = fn(cmd, in_fd, out_fd, STDERR_FILENO);
+
+    if (in_fd != STDIN_FILENO)
+        close(in_fd);
+    if (out_fd != STDOUT_FILENO)
+        close(out_fd);
+    return OK;
+}
+
+/*
+ * time pipeline
+ *
+ *  execute_pipeline() takes `time` off the front of the line and, once the
+ *  pipeline is done, prints to stderr the wall clock time, user and sys
+ *  time, max RSS and voluntary/involuntary context switches of every stage
+ *  and of the whole pipeline.  Children are reaped with wait4(), builtin
+ *  stages report getrusage(RUSAGE_THREAD) for their thread (max RSS is the
+ *  shell's there), and a lone shell builtin like cd or wait reports the
+ *  shell's RUSAGE_SELF for the time it ran.  Stages are reaped as soon as
+ *  each one exits, through pidfds, so each gets its own real time.
+ */
+static double ts_sec(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double tv_sec(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void print_time_row(const char *label, double real, const struct rusage *ru,
+                           cmd_buff_t *cmd) {
+    fprintf(stderr, "%-6s %8.3fs %8.3fs %8.3fs %8ldK %6ld %6ld", label, real,
+            tv_sec(&ru->ru_utime), tv_sec(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_nvcsw, ru->ru_nivcsw);
+    for (int a = 0; cmd != NULL && a < cmd->argc; a++)
+        fprintf(stderr, (a == 0) ? "  %s" : " %s", cmd->argv[a]);
+    fprintf(stderr, "\n");
+}
+
+static void print_times(stage_t stages[], int n, const struct timespec *t0) {
+    struct timespec t1;
+    struct rusage total;
+    char label[16];
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    memset(&total, 0, sizeof(total));
+
+    fflush(stdout);
+    fprintf(stderr, "%-6s %9s %9s %9s %9s %6s %6s  %s\n",
+            "stage", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+    for (int i = 0; i < n; i++) {
+        stage_t *st = &stages[i];
+        snprintf(label, sizeof(label), "%d", i + 1);
+        if (st->err != 0) {
+            fprintf(stderr, "%-6s %9s %9s %9s %9s %6s %6s  %s\n",
+                    label, "-", "-", "-", "-", "-", "-", st->cmd->argv[0]);
+            continue;
+        }
+        print_time_row(label, ts_sec(&st->start, &st->end), &st->ru, st->cmd);
+
+        timeradd(&total.ru_utime, &st->ru.ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &st->ru.ru_stime, &total.ru_stime);
+        if (st->ru.ru_maxrss > total.ru_maxrss)
+            total.ru_maxrss = st->ru.ru_maxrss;
+        total.ru_nvcsw += st->ru.ru_nvcsw;
+        total.ru_nivcsw += st->ru.ru_nivcsw;
+    }
+    print_time_row("total", ts_sec(t0, &t1), &total, NULL);
+}
+
+// waits for every stage, each process as soon as it exits
+static void wait_stages_timed(stage_t stages[], int n, int status[]) {
+    struct pollfd pfds[n];
+    int idx[n], npfds = 0;
+
+    for (int i = 0; i < n; i++) {
+        status[i] = 0;
+        if (stages[i].err != 0 || stages[i].pid <= 0)
+            continue;
+        int fd = syscall(SYS_pidfd_open, stages[i].pid, 0);
+        if (fd >= 0) {
+            pfds[npfds] = (struct pollfd){.fd = fd, .events = POLLIN};
+            idx[npfds++] = i;
+        }
+    }
+
+    while (npfds > 0) {
+        if (poll(pfds, npfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int p = npfds - 1; p >= 0; p--) {
+            if (pfds[p].revents == 0)
+                continue;
+            status[idx[p]] = wait_stage(&stages[idx[p]]);
+            stages[idx[p]].pid = -1;
+            close(pfds[p].fd);
+            pfds[p] = pfds[--npfds];
+            idx[p] = idx[npfds];
+        }
+    }
+    for (int p = 0; p < npfds; p++)
+        close(pfds[p].fd);
+
+    // builtin threads stamp their own end, and anything without a pidfd
+    for (int i = 0; i < n; i++) {
+        if (stages[i].err == 0 && (stages[i].threaded || stages[i].pid > 0))
+            status[i] = wait_stage(&stages[i]);
+    }
+}
+
+static int run_pipeline(command_list_t *clist) {
+    struct timespec t0;
+    bool timed = false;
+
+    if (clist->num == 0) {
+        return WARN_NO_CMDS;
+    }
+
+    // time: run the rest of the line and report on it
+    if (strcmp(clist->commands[0].argv[0], "time") == 0) {
+        cmd_buff_t *first = &clist->commands[0];
+        if (first->argc == 1) {
+            fprintf(stderr, "usage: time pipeline\n");
+            last_rc = 2;
+            return OK;
+        }
+        first->argv++;
+        first->argc--;
+        first->argv_cap--;
+        timed = true;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+    }
+    
+    // If only one command, check if it's a built-in
+    if (clist->num == 1) {
+        cmd_buff_t *cmd = &clist->commands[0];
+        builtin_fn_t fn = match_fd_builtin(cmd->argv[0]);
+        if (fn != NULL && !timed) {
+            return run_builtin_here(cmd, fn);
+        }
+        Built_In_Cmds bi = match_command(cmd->argv[0]);
+        if (fn == NULL && bi != BI_NOT_BI) {
+            // These change the shell itself and don't support redirection
+            if (cmd->input_file != NULL || cmd->output_file != NULL || cmd->here_text != NULL) {
+                fprintf(stderr, "Redirection not supported for built-in commands\n");
+                return ERR_EXEC_CMD;
+            }
+            if (!timed) {
+                exec_built_in_cmd(cmd);
+                return OK;
+            }
+
+            stage_t self;
+            struct rusage before;
+            memset(&self, 0, sizeof(self));
+            self.cmd = cmd;
+            self.start = t0;
+            getrusage(RUSAGE_SELF, &before);
+
+            exec_built_in_cmd(cmd);
+
+            clock_gettime(CLOCK_MONOTONIC, &self.end);
+            getrusage(RUSAGE_SELF, &self.ru);
+            timersub(&self.ru.ru_utime, &before.ru_utime, &self.ru.ru_utime);
+            timersub(&self.ru.ru_stime, &before.ru_stime, &self.ru.ru_stime);
+            self.ru.ru_nvcsw -= before.ru_nvcsw;
+            self.ru.ru_nivcsw -= before.ru_nivcsw;
+            print_times(&self, 1, &t0);
+            return OK;
+        }
+    }
+    
+    stage_t *stages = arena_alloc(clist->arena, clist->num * sizeof(stage_t));
+    int *timed_status = timed ? arena_alloc(clist->arena, clist->num * sizeof(int)) : NULL;
+
+    if (stages == NULL || (timed && timed_status == NULL) ||
+        spawn_pipeline(clist, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, stages) != OK) {
+        return ERR_EXEC_CMD;
+    }
+
+    report_stage_errors(stages, clist->num);
+    if (timed)
+        wait_stages_timed(stages, clist->num, timed_status);
+    
+    // Wait for all children to complete
+    int status;
+    for (int i = 0; i < clist->num; i++) {
+        if (stages[i].err != 0) {
+            if (i == clist->num - 1)
+                last_rc = stage_err_rc(stages[i].err);
+            continue;
+        }
+        status = timed ? timed_status[i] : wait_stage(&stages[i]);
+        if (i == clist->num - 1) { // Only store exit status of last command in pipeline
+            last_rc = status_rc(status);
+        }
+    }
+
+    if (timed)
+        print_times(stages, clist->num, &t0);
+    
+    return OK;
+}
+
+/*
+ * Process substitution
+ *
+ *  A <(pipeline) argument is replaced by /dev/fd/N, the read end of a pipe
+ *  the inner pipeline writes its stdout to; for >(pipeline) the command gets
+ *  the write end and the inner pipeline reads it as stdin.  Both ends are
+ *  O_CLOEXEC, spawn_pipeline() dup2()s the command's end onto itself so
+ *  only that command inherits it, and a builtin stage opens the path in the
+ *  shell itself.  The inner pipelines are started before the main one and
+ *  waited for after it, once the shell has closed its copy of their pipe,
+ *  so a >(...) sees EOF when the command is done writing.  Substitutions
+ *  can nest.
+ */
+static void finish_proc_subs(command_list_t *clist);
+
+static int start_proc_subs(command_list_t *clist) {
+    for (int c = 0; c < clist->num; c++) {
+        cmd_buff_t *cmd = &clist->commands[c];
+        for (int s = 0; s < cmd->nsubs; s++) {
+            proc_sub_t *sub = &cmd->subs[s];
+            int fds[2], rc;
+
+            if (build_cmd_list(sub->text, &sub->list, clist->arena) != OK ||
+                expand_cmd_subs(&sub->list) != OK) {
+                fprintf(stderr, "error: bad process substitution\n");
+                return ERR_CMD_ARGS_BAD;
+            }
+            sub->stages = arena_alloc(clist->arena, sub->list.num * sizeof(stage_t));
+            if (sub->stages == NULL || pipe2(fds, O_CLOEXEC) < 0)
+                return ERR_EXEC_CMD;
+            if (start_proc_subs(&sub->list) != OK) {
+                close(fds[0]);
+                close(fds[1]);
+                return ERR_EXEC_CMD;
+            }
+
+            if (sub->out)
+                rc = spawn_pipeline(&sub->list, fds[0], STDOUT_FILENO, STDERR_FILENO, sub->stages);
+            else
+                rc = spawn_pipeline(&sub->list, STDIN_FILENO, fds[1], STDERR_FILENO, sub->stages);
+            close(sub->out ? fds[0] : fds[1]);
+            sub->fd = sub->out ? fds[1] : fds[0];
+            if (rc != OK) {
+                sub->list.num = 0;
+                return ERR_EXEC_CMD;
+            }
+            report_stage_errors(sub->stages, sub->list.num);
+            snprintf(sub->path, PROC_SUB_PATH_SZ, "/dev/fd/%d", sub->fd);
+        }
+    }
+    return OK;
+}
+
+// closes the shell's ends and waits for the inner pipelines
+static void finish_proc_subs(command_list_t *clist) {
+    for (int c = 0; c < clist->num; c++) {
+        cmd_buff_t *cmd = &clist->commands[c];
+        for (int s = 0; s < cmd->nsubs && cmd->subs[s].fd >= 0; s++) {
+            proc_sub_t *sub = &cmd->subs[s];
+            close(sub->fd);
+            sub->fd = -1;
+            for (int i = 0; i < sub->list.num; i++) {
+                if (sub->stages[i].err == 0)
+                    wait_stage(&sub->stages[i]);
+            }
+            finish_proc_subs(&sub->list);
+        }
+    }
+}
+
+int execute_pipeline(command_list_t *clist) {
+    if (clist->num == 0) {
+        return WARN_NO_CMDS;
+    }
+
+    int rc = start_proc_subs(clist);
+    if (rc == OK)
+        rc = run_pipeline(clist);
+    else
+        last_rc = 1;
+    finish_proc_subs(clist);
+    return rc;
+}
+
+/*
+ * Command substitution
+ *
+ *  A $(pipeline) argument is replaced by the words the pipeline writes to
+ *  stdout, split on spaces, tabs and newlines, so trailing newlines go
+ *  with the rest of the separators and empty output leaves no argument at
+ *  all.  The substitutions of a line run one at a time, left to right,
+ *  before anything else on the line starts; a background job has its
+ *  arguments expanded in the foreground.
+ *
+ *  The output is read straight into arena blocks of CMD_SUB_BLOCK bytes
+ *  and split where it lands, each word is terminated in place and argv
+ *  points at it.  The only bytes that move are the start of a word that
+ *  runs off the end of a block, it is carried to the front of the next.
+ */
+#define CMD_SUB_BLOCK   (1024*64)
+
+static bool is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// reads fd to EOF, pushing the words in it onto cmd's argv
+static int capture_words(int fd, cmd_buff_t *cmd) {
+    size_t cap = CMD_SUB_BLOCK;
+    char *buf = arena_alloc(cmd->arena, cap + 1);   // +1 for a last terminator
+    char *p = buf, *word = NULL;
+
+    if (buf == NULL)
+        return ERR_MEMORY;
+    for (;;) {
+        if (p == buf + cap) {
+            size_t part = word ? (size_t)(p - word) : 0;
+            if (part > cap / 2)
+                cap *= 2;
+            char *next = arena_alloc(cmd->arena, cap + 1);
+            if (next == NULL)
+                return ERR_MEMORY;
+            memcpy(next, word, part);
+            word = part ? next : NULL;
+            buf = next;
+            p = next + part;
+        }
+
+        ssize_t n = read(fd, p, buf + cap - p);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (char *end = p + n; p < end; p++) {
+            if (!is_ifs(*p)) {
+                if (word == NULL)
+                    word = p;
+            } else if (word != NULL) {
+                *p = '\0';
+                if (push_arg(cmd, word) != OK)
+                    return ERR_MEMORY;
+                word = NULL;
+            }
+        }
+    }
+
+    if (word == NULL)
+        return OK;
+    *p = '\0';
+    return push_arg(cmd, word);
+}
+
+// runs sub's pipeline with its stdout on a pipe, its words go onto cmd
+static int run_cmd_sub(proc_sub_t *sub, cmd_buff_t *cmd, arena_t *arena) {
+    int fds[2], rc;
+
+    rc = build_cmd_list(sub->text, &sub->list, arena);
+    if (rc == OK)
+        rc = expand_cmd_subs(&sub->list);
+    if (rc == WARN_NO_CMDS)
+        return OK;
+    if (rc != OK) {
+        fprintf(stderr, "error: bad command substitution\n");
+        return ERR_CMD_ARGS_BAD;
+    }
+
+    sub->stages = arena_alloc(arena, sub->list.num * sizeof(stage_t));
+    if (sub->stages == NULL || pipe2(fds, O_CLOEXEC) < 0)
+        return ERR_EXEC_CMD;
+    if (start_proc_subs(&sub->list) != OK) {
+        close(fds[0]);
+        close(fds[1]);
+        finish_proc_subs(&sub->list);
+        return ERR_EXEC_CMD;
+    }
+
+    rc = spawn_pipeline(&sub->list, STDIN_FILENO, fds[1], STDERR_FILENO, sub->stages);
+    close(fds[1]);
+    if (rc == OK) {
+        report_stage_errors(sub->stages, sub->list.num);
+        rc = capture_words(fds[0], cmd);
+        for (int i = 0; i < sub->list.num; i++) {
+            if (sub->stages[i].err == 0)
+                wait_stage(&sub->stages[i]);
+        }
+    }
+    close(fds[0]);
+    finish_proc_subs(&sub->list);
+    return rc;
+}
+
+/*
+ * expand_cmd_subs(clist)
+ *
+ *  Runs every $(...) in clist and rebuilds the argv arrays around their
+ *  words.  Commands left with no words are dropped, WARN_NO_CMDS if that
+ *  is all of them.  Only the <(...) and >(...) are left in cmd->subs for
+ *  start_proc_subs().
+ */
+int expand_cmd_subs(command_list_t *clist) {
+    int kept = 0;
+
+    for (int c = 0; c < clist->num; c++) {
+        cmd_buff_t *cmd = &clist->commands[c];
+        char **argv = cmd->argv;
+        int argc = cmd->argc, s = 0, left = 0;
+
+        for (s = 0; s < cmd->nsubs && !cmd->subs[s].capture; s++)
+            ;
+        if (s < cmd->nsubs) {
+            cmd->argv_cap = argc + 1;
+            cmd->argv = arena_alloc(clist->arena, cmd->argv_cap * sizeof(char *));
+            if (cmd->argv == NULL)
+                return ERR_MEMORY;
+            cmd->argc = 0;
+
+            // the $(...) are in argv order, each is its own argv entry
+            for (int i = 0; i < argc; i++) {
+                int rc;
+                while (s < cmd->nsubs && !cmd->subs[s].capture)
+                    s++;
+                if (s < cmd->nsubs && argv[i] == cmd->subs[s].text)
+                    rc = run_cmd_sub(&cmd->subs[s++], cmd, clist->arena);
+                else
+                    rc = push_arg(cmd, argv[i]);
+                if (rc != OK)
+                    return rc;
+            }
+            cmd->argv[cmd->argc] = NULL;
+
+            for (s = 0; s < cmd->nsubs; s++) {
+                if (!cmd->subs[s].capture)
+                    cmd->subs[left++] = cmd->subs[s];
+            }
+            cmd->nsubs = left;
+        }
+
+        if (cmd->argc > 0)
+            clist->commands[kept++] = *cmd;
+    }
+
+    clist->num = kept;
+    return (kept > 0) ? OK : WARN_NO_CMDS;
+}
+
+/*
+ * Background jobs
+ *
+ *  A line ending in & is started by start_job() and the prompt comes back
+ *  at once.  The job takes over the getline() buffer and the arena the line
+ *  was parsed into, so its argv, stages and builtin threads stay valid
+ *  while the loop goes on with fresh ones.  Slot n of the job table is job
+ *  [n+1].
+ *
+ *  Children are reaped from the SIGCHLD handler, which calls waitpid() with
+ *  WNOHANG on the pids in the table only, so it never takes a child that a
+ *  foreground pipeline is waiting for.  The main thread blocks SIGCHLD
+ *  while it changes the table, and builtin threads block it for good, so
+ *  the handler always sees a consistent table.  Builtin stages are joined
+ *  with pthread_tryjoin_np() when the job is looked at.
+ *
+ *  A finished job keeps the status of its last command until jobs, wait
+ *  or fg reports it, or, in an interactive shell, until the next prompt
+ *  prints it as Done.  There is no terminal job control: background jobs
+ *  read /dev/null, and fg just waits in the foreground.
+ */
+typedef struct job {
+    int             id;
+    pid_t           pid;        //last command of the pipeline, as in "[1] pid"
+    arena_t         arena;      //the job's line was parsed into this
+    char            *line;      //getline() buffer its argv point into
+    char            *text;      //command as shown by jobs
+    command_list_t  clist;
+    stage_t         *stages;
+    int             status;     //waitpid() status of the last command
+} job_t;
+
+static job_t **jobs;
+static int jobs_cap;
+static bool jobs_interactive;
+
+static void jobs_block(sigset_t *old) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, old);
+}
+
+static void jobs_unblock(const sigset_t *old) {
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+// reaps what has exited without blocking, SIGCHLD must be blocked or this
+// must be the handler
+static void jobs_reap(void) {
+    for (int j = 0; j < jobs_cap; j++) {
+        job_t *job = jobs[j];
+        if (job == NULL)
+            continue;
+        for (int i = 0; i < job->clist.num; i++) {
+            stage_t *st = &job->stages[i];
+            int status;
+            if (st->pid > 0 && waitpid(st->pid, &status, WNOHANG) == st->pid) {
+                st->pid = -1;
+                if (i == job->clist.num - 1)
+                    job->status = status;
+            }
+        }
+    }
+}
+
+static void jobs_sigchld(int sig) {
+    int saved_errno = errno;
+
+    (void)sig;
+    jobs_reap();
+    errno = saved_errno;
+}
+
+/*
+ * jobs_init(interactive)
+ *
+ *  Installs the SIGCHLD handler, called once by the local command loop.
+ *  Start and Done messages are only printed when interactive is set, for
+ *  a prompting loop reading a terminal.
+ */
+void jobs_init(bool interactive) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = jobs_sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    jobs_interactive = interactive;
+}
+
+// joins finished builtin threads, true when nothing of the job is running
+// anymore, SIGCHLD must be blocked
+static bool job_done(job_t *job) {
+    bool done = true;
+
+    for (int i = 0; i < job->clist.num; i++) {
+        stage_t *st = &job->stages[i];
+        if (st->threaded && pthread_tryjoin_np(st->tid, NULL) == 0) {
+            st->threaded = false;
+            if (i == job->clist.num - 1)
+                job->status = (st->rc & 0xff) << 8;
+        }
+        if (st->threaded || st->pid > 0)
+            done = false;
+    }
+    return done;
+}
+
+// waits for every stage of the job, SIGCHLD must be blocked
+static void job_wait(job_t *job) {
+    for (int i = 0; i < job->clist.num; i++) {
+        stage_t *st = &job->stages[i];
+        if (st->pid <= 0 && !st->threaded)
+            continue;
+        int status = wait_stage(st);
+        st->pid = -1;
+        if (i == job->clist.num - 1)
+            job->status = status;
+    }
+}
+
+// takes the job out of the table and frees it, SIGCHLD must be blocked
+static void job_free(job_t *job) {
+    jobs[job->id - 1] = NULL;
+    arena_free(&job->arena);
+    free(job->line);
+    free(job);
+}
+
+static void job_print(FILE *out, job_t *job, bool done) {
+    char state[32];
+    int rc = status_rc(job->status);
+
+    if (!done)
+        snprintf(state, sizeof(state), "Running");
+    else if (rc == 0)
+        snprintf(state, sizeof(state), "Done");
+    else
+        snprintf(state, sizeof(state), "Exit %d", rc);
+    fprintf(out, "[%d]  %-24s%s &\n", job->id, state, job->text);
+}
+
+// the pipeline as one line for jobs, built in the job's arena
+static char *job_text(job_t *job) {
+    size_t len = 1;
+    char *text, *p;
+
+    for (int i = 0; i < job->clist.num; i++) {
+        cmd_buff_t *cmd = &job->clist.commands[i];
+        for (int a = 0; a < cmd->argc; a++)
+            len += strlen(cmd->argv[a]) + 1;
+        if (cmd->input_file != NULL)
+            len += strlen(cmd->input_file) + 3;
+        if (cmd->output_file != NULL)
+            len += strlen(cmd->output_file) + 4;
+        len += 3;
+    }
+    text = arena_alloc(&job->arena, len);
+    if (text == NULL)
+        return "?";
+
+    p = text;
+    for (int i = 0; i < job->clist.num; i++) {
+        cmd_buff_t *cmd = &job->clist.commands[i];
+        if (i > 0)
+            p += sprintf(p, " | ");
+        for (int a = 0; a < cmd->argc; a++)
+            p += sprintf(p, (a > 0) ? " %s" : "%s", cmd->argv[a]);
+        if (cmd->input_file != NULL)
+            p += sprintf(p, " < %s", cmd->input_file);
+        if (cmd->output_file != NULL)
+            p += sprintf(p, cmd->append_mode ? " >> %s" : " > %s", cmd->output_file);
+    }
+    *p = '\0';
+    return text;
+}
+
+/*
+ * start_job(clist, line)
+ *      clist:   parsed pipeline with clist->background set
+ *      line:    the getline() buffer clist was parsed from
+ *
+ *  Starts the pipeline in the background with stdin from /dev/null and adds
+ *  it to the job table.  On OK the job owns line and the arena clist was
+ *  built in (its chunks, not the arena_t), the caller has to arena_init()
+ *  a new one and must not free line.  Otherwise both are still the
+ *  caller's.
+ *
+ *  Returns OK, ERR_MEMORY, or ERR_EXEC_CMD if the pipeline could not be
+ *  started at all.
+ */
+int start_job(command_list_t *clist, char *line) {
+    job_t *job = calloc(1, sizeof(job_t));
+    sigset_t old;
+    int slot, null_fd, rc;
+
+    if (job == NULL)
+        return ERR_MEMORY;
+
+    // make sure there is a free slot before anything is started
+    jobs_block(&old);
+    for (slot = 0; slot < jobs_cap && jobs[slot] != NULL; slot++)
+        ;
+    if (slot == jobs_cap) {
+        int cap = jobs_cap ? jobs_cap * 2 : CMD_LIST_INIT;
+        job_t **grown = realloc(jobs, cap * sizeof(job_t *));
+        if (grown == NULL) {
+            jobs_unblock(&old);
+            free(job);
+            return ERR_MEMORY;
+        }
+        memset(grown + jobs_cap, 0, (cap - jobs_cap) * sizeof(job_t *));
+        jobs = grown;
+        jobs_cap = cap;
+    }
+    jobs_unblock(&old);
+
+    job->id = slot + 1;
+    job->arena = *clist->arena;
+    job->line = line;
+    job->clist = *clist;
+    job->clist.arena = &job->arena;
+    for (int i = 0; i < job->clist.num; i++)
+        job->clist.commands[i].arena = &job->arena;
+    job->text = job_text(job);
+    job->stages = arena_alloc(&job->arena, job->clist.num * sizeof(stage_t));
+
+    null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    rc = (job->stages == NULL || null_fd < 0) ? ERR_EXEC_CMD
+         : spawn_pipeline(&job->clist, null_fd, STDOUT_FILENO, STDERR_FILENO, job->stages);
+    if (null_fd >= 0)
+        close(null_fd);
+    if (rc != OK) {
+        free(job);
+        return rc;
+    }
+
+    report_stage_errors(job->stages, job->clist.num);
+    stage_t *last = &job->stages[job->clist.num - 1];
+    job->pid = last->pid;
+    if (last->err != 0)
+        job->status = (stage_err_rc(last->err) & 0xff) << 8;
+
+    // a child that exited before it was in the table is reaped here
+    jobs_block(&old);
+    jobs[slot] = job;
+    jobs_reap();
+    jobs_unblock(&old);
+
+    if (jobs_interactive)
+        printf("[%d] %d\n", job->id, (int)job->pid);
+    last_rc = 0;
+    return OK;
+}
+
+/*
+ * jobs_notify()
+ *
+ *  Called before each prompt.  In an interactive shell finished jobs are
+ *  reported as Done and dropped, otherwise they wait for jobs, wait or fg.
+ */
+void jobs_notify(void) {
+    sigset_t old;
+
+    if (!jobs_interactive)
+        return;
+    jobs_block(&old);
+    for (int j = 0; j < jobs_cap; j++) {
+        if (jobs[j] != NULL && job_done(jobs[j])) {
+            job_print(stdout, jobs[j], true);
+            job_free(jobs[j]);
+        }
+    }
+    jobs_unblock(&old);
+}
+
+// the jobs builtin, finished jobs are dropped once they have been listed
+void jobs_print(FILE *out) {
+    sigset_t old;
+
+    jobs_block(&old);
+    for (int j = 0; j < jobs_cap; j++) {
+        if (jobs[j] == NULL)
+            continue;
+        bool done = job_done(jobs[j]);
+        job_print(out, jobs[j], done);
+        if (done)
+            job_free(jobs[j]);
+    }
+    jobs_unblock(&old);
+}
+
+// %n is job n, a plain number is the pid printed when the job started
+static job_t *find_job(const char *spec) {
+    char *end;
+    long n = strtol(spec + (spec[0] == '%'), &end, 10);
+
+    if (*end != '\0' || end == spec + (spec[0] == '%'))
+        return NULL;
+    for (int j = 0; j < jobs_cap; j++) {
+        if (jobs[j] == NULL)
+            continue;
+        if (spec[0] == '%' ? jobs[j]->id == n : jobs[j]->pid == n)
+            return jobs[j];
+    }
+    return NULL;
+}
+
+/*
+ * jobs_wait(cmd)
+ *
+ *  The wait builtin.  `wait` waits for every job and sets rc to 0, `wait
+ *  %n|pid ...` waits for those jobs and sets rc to the exit code of the
+ *  last one, or 127 when it is not a job.
+ */
+int jobs_wait(cmd_buff_t *cmd) {
+    sigset_t old;
+
+    jobs_block(&old);
+    if (cmd->argc == 1) {
+        for (int j = 0; j < jobs_cap; j++) {
+            if (jobs[j] != NULL) {
+                job_wait(jobs[j]);
+                job_done(jobs[j]);
+                job_free(jobs[j]);
+            }
+        }
+        last_rc = 0;
+    }
+    for (int a = 1; a < cmd->argc; a++) {
+        job_t *job = find_job(cmd->argv[a]);
+        if (job == NULL) {
+            fprintf(stderr, "wait: %s: no such job\n", cmd->argv[a]);
+            last_rc = 127;
+            continue;
+        }
+        job_wait(job);
+        job_done(job);
+        last_rc = status_rc(job->status);
+        job_free(job);
+    }
+    jobs_unblock(&old);
+    return OK;
+}
+
+/*
+ * jobs_fg(cmd)
+ *
+ *  The fg builtin.  Prints the command of job %n, or of the newest job,
+ *  waits for it and sets rc to its exit code.
+ */
+int jobs_fg(cmd_buff_t *cmd) {
+    job_t *job = NULL;
+    sigset_t old;
+
+    jobs_block(&old);
+    if (cmd->argc > 1) {
+        job = find_job(cmd->argv[1]);
+    } else {
+        for (int j = 0; j < jobs_cap; j++) {
+            if (jobs[j] != NULL && (job == NULL || jobs[j]->id > job->id))
+                job = jobs[j];
+        }
+    }
+    if (job == NULL) {
+        jobs_unblock(&old);
+        fprintf(stderr, "fg: %s: no such job\n", (cmd->argc > 1) ? cmd->argv[1] : "current");
+        last_rc = 1;
+        return OK;
+    }
+
+    printf("%s\n", job->text);
+    fflush(stdout);
+    job_wait(job);
+    job_done(job);
+    last_rc = status_rc(job->status);
+    job_free(job);
+    jobs_unblock(&old);
+    return OK;
+}
+
+// cd, exit and the other builtins that change the shell always run in it,
+// even with a trailing &
+static bool runs_in_shell(command_list_t *clist) {
+    return clist->num == 1 &&
+           match_fd_builtin(clist->commands[0].argv[0]) == NULL &&
+           match_command(clist->commands[0].argv[0]) != BI_NOT_BI;
+}
+
+/*
+ * read_here_docs(clist, in, line, cap, prompt)
+ *
+ *  Reads the body of every << in clist from the lines of in that follow
+ *  the command line, in order, each up to a line that is just its
+ *  delimiter or EOF.  The bodies are built in the list's arena.
+ *
+ *  Returns OK or ERR_MEMORY.
+ */
+static int read_here_docs(command_list_t *clist, FILE *in, char **line, size_t *cap,
+                          bool prompt) {
+    for (int i = 0; i < clist->num; i++) {
+        cmd_buff_t *cmd = &clist->commands[i];
+        char *text = NULL;
+        size_t len = 0, text_cap = 0;
+        ssize_t n;
+
+        if (cmd->here_delim == NULL)
+            continue;
+        for (;;) {
+            if (prompt) {
+                printf("%s", SH_PROMPT_CONT);
+                fflush(stdout);
+            }
+            n = getline(line, cap, in);
+            if (n < 0)
+                break;
+            if (strcspn(*line, "\n") == strlen(cmd->here_delim) &&
+                strncmp(*line, cmd->here_delim, strlen(cmd->here_delim)) == 0)
+                break;
+
+            // the body doubles in place at the end of the arena
+            if (len + n > text_cap) {
+                size_t grown = text_cap ? text_cap * 2 : ARENA_INIT_SZ;
+                while (grown < len + n)
+                    grown *= 2;
+                text = arena_grow(clist->arena, text, text_cap, grown);
+                if (text == NULL)
+                    return ERR_MEMORY;
+                text_cap = grown;
+            }
+            memcpy(text + len, *line, n);
+            len += n;
+        }
+        if (text != NULL) {
+            cmd->here_text = text;
+            cmd->here_len = len;
+        }
+    }
+    return OK;
+}
+
+/*
+ * cmd_loop(in, prompt)
+ *      in:      where command lines come from
+ *      prompt:  print SH_PROMPT before each line and a newline at EOF
+ *
+ *  Reads, parses and runs lines until EOF.  Lines starting with # are
+ *  comments, so scripts can have a #! line.
+ */
+static int cmd_loop(FILE *in, bool prompt)
+{
+    char *input_line = NULL;    // grown by getline() to the longest line
+    size_t input_cap = 0;
+    char *here_line = NULL;     // here-document lines
+    size_t here_cap = 0;
+    bool interactive = prompt && isatty(fileno(in));
+    command_list_t cmd_list;
+    arena_t arena;
+
+    if (arena_init(&arena, ARENA_INIT_SZ) != OK) {
+        return ERR_MEMORY;
+    }
+    jobs_init(interactive);
+    
+    while (1) {
+        jobs_notify();
+        if (prompt)
+            printf("%s", SH_PROMPT);
+        if (getline(&input_line, &input_cap, in) < 0) {
+            if (prompt)
+                printf("\n");
+            break;
+        }
+        
+        // Remove trailing newline
+        input_line[strcspn(input_line, "\n")] = '\0';
+        
+        // Skip empty lines and comments
+        char *trimmed = trim_whitespace(input_line);
+        if (*trimmed == '\0' || *trimmed == '#') {
+            continue;
+        }
+        
+        // Parse the command line into a command list
+        int rc = build_cmd_list(input_line, &cmd_list, &arena);
+        
+        if (rc == WARN_NO_CMDS) {
+            fprintf(stderr, CMD_WARN_NO_CMD);
+            arena_reset(&arena);
+            continue;
+        } else if (rc == ERR_CMD_ARGS_BAD) {
+            fprintf(stderr, CMD_ERR_SYNTAX);
+            arena_reset(&arena);
+            continue;
+        } else if (rc != OK) {
+            arena_reset(&arena);
+            continue;
+        }
+
+        if (read_here_docs(&cmd_list, in, &here_line, &here_cap, interactive) != OK) {
+            fprintf(stderr, "error: here-document too large\n");
+            free_cmd_list(&cmd_list);
+            arena_reset(&arena);
+            continue;
+        }
+
+        // $(...) runs now, in the shell, even for a background job
+        if (expand_cmd_subs(&cmd_list) != OK) {
+            free_cmd_list(&cmd_list);
+            arena_reset(&arena);
+            continue;
+        }
+
+        // A background job takes the line and the arena with it
+        if (cmd_list.background && !runs_in_shell(&cmd_list)) {
+            if (start_job(&cmd_list, input_line) == OK) {
+                input_line = NULL;
+                input_cap = 0;
+                if (arena_init(&arena, ARENA_INIT_SZ) != OK) {
+                    return ERR_MEMORY;
+                }
+                continue;
+            }
+            fprintf(stderr, "error: could not start background job\n");
+            free_cmd_list(&cmd_list);
+            arena_reset(&arena);
+            continue;
+        }
+        
+        // Execute the command pipeline
+        execute_pipeline(&cmd_list);
+        
+        // Free the command list resources
+        free_cmd_list(&cmd_list);
+        arena_reset(&arena);
+    }
+    
+    arena_free(&arena);
+    free(input_line);
+    free(here_line);
+    return OK;
+}
+
+int exec_local_cmd_loop()
+{
+    // a file or pipe on stdin is read in big blocks, the prompts stay as
+    // they are since callers of the interactive loop expect them
+    if (!isatty(STDIN_FILENO))
+        setvbuf(stdin, NULL, _IOFBF, SCRIPT_BUFF_SZ);
+    return cmd_loop(stdin, true);
+}
+
+/*
+ * exec_script(path)
+ *      path:  script to run, "-" for stdin
+ *
+ *  Runs a script without prompts, reading it SCRIPT_BUFF_SZ at a time, so
+ *  one read() brings in many lines.
+ *
+ *  Returns the exit status for dsh: rc of the last command, or 127 if the
+ *  script could not be opened.
+ */
+int exec_script(const char *path)
+{
+    FILE *in = stdin;
+
+    if (strcmp(path, "-") != 0) {
+        in = fopen(path, "re");
+        if (in == NULL) {
+            fprintf(stderr, "dsh: %s: %s\n", path, strerror(errno));
+            return 127;
+        }
+    }
+    setvbuf(in, NULL, _IOFBF, SCRIPT_BUFF_SZ);
+
+    int rc = cmd_loop(in, false);
+    if (in != stdin)
+        fclose(in);
+    return (rc == OK) ? last_rc & 0xff : 1;
 }
@@ -1,14 +1,20 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <pthread.h>
+
 
 //Constants for command structure sizes
 #define EXE_MAX 64
 #define ARG_MAX 256
-#define CMD_MAX 8
-#define CMD_ARGV_MAX (CMD_MAX + 1)
-// Longest command that can be read from the shell
-#define SH_CMD_MAX EXE_MAX + ARG_MAX
+// Command lists and argv start at these sizes and double as needed, lines of
+// any length are read with getline()
+#define CMD_LIST_INIT 4
+#define CMD_ARGV_INIT 8
 
 typedef struct command
 {
@@ -17,28 +23,77 @@ typedef struct command
 } command_t;
 
 #include <stdbool.h>
+#include <stdio.h>
+
+//bump allocator for everything parsed from one command line, see dshlib.c
+#define ARENA_INIT_SZ   (1024*4)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t cap;
+    size_t used;
+    char data[];
+} arena_chunk_t;
+
+typedef struct arena {
+    arena_chunk_t *head;    // chunk allocations come from, older ones follow
+    void *last;             // newest allocation, arena_grow() extends it in place
+} arena_t;
+
+int arena_init(arena_t *a, size_t initial);
+void arena_free(arena_t *a);
+void arena_reset(arena_t *a);
+void *arena_alloc(arena_t *a, size_t size);
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(arena_t *a, const char *str);
 
 typedef struct cmd_buff
 {
     int  argc;
-    char *argv[CMD_ARGV_MAX];
+    int  argv_cap;      // slots in argv, including the NULL terminator
+    char **argv;
+    arena_t *arena;     // where argv and the strings below live
     char *_cmd_buffer;
     char *input_file;  // extra credit, stores input redirection file (for `<`)
     char *output_file; // extra credit, stores output redirection file (for `>`)
     bool append_mode; // extra credit, sets append mode fomr output_file
+    char *here_delim;  // << word, the lines up to it are read into here_text
+    char *here_text;   // << or <<< input, used instead of input_file
+    size_t here_len;
+    struct proc_sub *subs;  // <(...) >(...) and $(...) arguments, in argv order
+    int nsubs;
 } cmd_buff_t;
 
 typedef struct command_list{
     int num;
-    cmd_buff_t commands[CMD_MAX];
+    int cap;            // slots in commands
+    cmd_buff_t *commands;
+    arena_t *arena;     // owns the commands and the launcher's arrays
+    bool background;    // line ended with &, see start_job()
 }command_list_t;
 
+//a <(pipeline) or >(pipeline) argument, see start_proc_subs(), or a
+//$(pipeline) one, see expand_cmd_subs()
+#define PROC_SUB_PATH_SZ 24
+
+typedef struct proc_sub {
+    char *text;         // the pipeline between the parentheses
+    bool out;           // >(...), the command writes to it
+    bool capture;       // $(...), replaced by the words of its output
+    char *path;         // the argv entry, /dev/fd/N once started
+    int fd;             // the command's end of the pipe, -1 until started
+    command_list_t list;
+    struct stage *stages;
+} proc_sub_t;
+
 //Special character #defines
 #define SPACE_CHAR  ' '
 #define PIPE_CHAR   '|'
 #define PIPE_STRING "|"
 
 #define SH_PROMPT       "dsh4> "
+#define SH_PROMPT_CONT  "> "        //while reading a << here-document
+#define SCRIPT_BUFF_SZ  (1024*64)   //stdio buffer for scripts and piped input
 #define EXIT_CMD        "exit"
 #define RC_SC           99
 #define EXIT_SC         100
@@ -46,22 +101,24 @@ typedef struct command_list{
 //Standard Return Codes
 #define OK                       0
 #define WARN_NO_CMDS            -1
-#define ERR_TOO_MANY_COMMANDS   -2
 #define ERR_CMD_OR_ARGS_TOO_BIG -3
 #define ERR_CMD_ARGS_BAD        -4      //for extra credit
 #define ERR_MEMORY              -5
 #define ERR_EXEC_CMD            -6
 #define OK_EXIT                 -7
 
+//stage_t.err from spawn_pipeline() for a command whose < or > file failed
+#define SPAWN_ERR_REDIR         -1
+
 
 
 //prototypes
-int alloc_cmd_buff(cmd_buff_t *cmd_buff);
+int alloc_cmd_buff(cmd_buff_t *cmd_buff, arena_t *arena);
 int free_cmd_buff(cmd_buff_t *cmd_buff);
 int clear_cmd_buff(cmd_buff_t *cmd_buff);
 int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff);
 int close_cmd_buff(cmd_buff_t *cmd_buff);
-int build_cmd_list(char *cmd_line, command_list_t *clist);
+int build_cmd_list(char *cmd_line, command_list_t *clist, arena_t *arena);
 int free_cmd_list(command_list_t *cmd_lst);
 
 //built in command stuff
@@ -72,6 +129,11 @@ typedef enum {
     BI_RC,
     BI_CMD_RC,              //extra credit command
     BI_CMD_STOP_SVR,        //new command "stop-server"
+    BI_CMD_HASH,            //PATH lookup cache
+    BI_CMD_JOBS,            //background jobs: jobs, wait, fg
+    BI_CMD_WAIT,
+    BI_CMD_FG,
+    BI_CMD_SET,             //shell options, see set_pipe_size()
     BI_NOT_BI,
     BI_EXECUTED,
 } Built_In_Cmds;
@@ -80,14 +142,56 @@ Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd);
 
 //main execution context
 int exec_local_cmd_loop();
+int exec_script(const char *path);
 int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
+int expand_cmd_subs(command_list_t *clist);
+
+//builtins that run without a fork, see match_fd_builtin()
+#define BI_IO_BUFF_SZ   (1024*64)
+typedef int (*builtin_fn_t)(cmd_buff_t *cmd, int in_fd, int out_fd, int err_fd);
+builtin_fn_t match_fd_builtin(const char *name);
+
+//one command of a running pipeline, see spawn_pipeline()
+typedef struct stage {
+    pid_t           pid;        //child process, -1 if none
+    int             err;        //0 if started, else errno or SPAWN_ERR_REDIR
+    cmd_buff_t      *cmd;
+    builtin_fn_t    builtin;    //set when the stage runs on a thread
+    bool            threaded;
+    pthread_t       tid;
+    int             fds[3];     //stdin/stdout/stderr owned by the thread
+    int             rc;         //exit code of the builtin
+    struct timespec start;      //CLOCK_MONOTONIC when it was started
+    struct timespec end;        //when it was reaped or the builtin returned
+    struct rusage   ru;         //from wait4(), RUSAGE_THREAD for a builtin
+} stage_t;
+
+int set_pipe_size(const char *spec);
+int get_pipe_size(void);
+int spawn_pipeline(command_list_t *clist, int in_fd, int out_fd, int err_fd,
+                   stage_t stages[]);
+int wait_stage(stage_t *st);
+
+//background jobs started with a trailing &
+void jobs_init(bool interactive);
+int start_job(command_list_t *clist, char *line);
+void jobs_notify(void);
+void jobs_print(FILE *out);
+int jobs_wait(cmd_buff_t *cmd);
+int jobs_fg(cmd_buff_t *cmd);
+
+//PATH lookup cache behind the hash builtin
+int path_hash_lookup(const char *name, char *out, size_t out_len, bool count_hit);
+void path_hash_forget(const char *name);
+void path_hash_clear(void);
+void path_hash_print(FILE *out);
 
 
 //output constants
 #define CMD_OK_HEADER       "PARSED COMMAND LINE - TOTAL COMMANDS %d\n"
 #define CMD_WARN_NO_CMD     "warning: no commands provided\n"
-#define CMD_ERR_PIPE_LIMIT  "error: piping limited to %d commands\n"
+#define CMD_ERR_SYNTAX      "error: syntax error, & must end the line and ( ) must match\n"
 #define BI_NOT_IMPLEMENTED "not implemented"
 
 #endif
\ No newline at end of file
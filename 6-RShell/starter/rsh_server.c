@@ -359,7 +359,7 @@ int exec_client_requests(int cli_socket) {
     int rc;
     int cmd_rc;
     char *io_buff;
-    char *cmd_copy;
+    arena_t arena;
     int total_bytes = 0;
     int recv_bytes;
 
@@ -368,7 +368,15 @@ int exec_client_requests(int cli_socket) {
         return ERR_RDSH_SERVER;
     }
 
+    // everything parsed for one request comes from here, see arena_t
+    if (arena_init(&arena, ARENA_INIT_SZ) != OK) {
+        free(io_buff);
+        return ERR_RDSH_SERVER;
+    }
+
     while(1) {
+        arena_reset(&arena);
+
         // Clear buffer for new command
         memset(io_buff, 0, RDSH_COMM_BUFF_SZ);
         total_bytes = 0;
@@ -380,6 +388,7 @@ int exec_client_requests(int cli_socket) {
             
             if (recv_bytes <= 0) {
                 // Connection closed or error
+                arena_free(&arena);
                 free(io_buff);
                 return (recv_bytes == 0) ? OK : ERR_RDSH_COMMUNICATION;
             }
@@ -401,6 +410,7 @@ int exec_client_requests(int cli_socket) {
         if (strcmp(io_buff, "exit") == 0) {
             send_message_string(cli_socket, "Exiting client session\n");
             send_message_eof(cli_socket);
+            arena_free(&arena);
             free(io_buff);
             return OK;
         }
@@ -409,26 +419,20 @@ int exec_client_requests(int cli_socket) {
         if (strcmp(io_buff, "stop-server") == 0) {
             send_message_string(cli_socket, "Stopping server\n");
             send_message_eof(cli_socket);
+            arena_free(&arena);
             free(io_buff);
             return OK_EXIT;
         }
         
-        // Create command list from input
-        cmd_copy = strdup(io_buff);
-        if (cmd_copy == NULL) {
-            send_message_string(cli_socket, "Memory allocation error\n");
-            send_message_eof(cli_socket);
-            continue;
-        }
-        
         printf(RCMD_MSG_SVR_EXEC_REQ, io_buff);
         
-        // Build command list
+        // Build command list, it is parsed in place in io_buff
         memset(&cmd_list, 0, sizeof(command_list_t));
-        rc = build_cmd_list(cmd_copy, &cmd_list);
+        rc = build_cmd_list(io_buff, &cmd_list, &arena);
+        if (rc == OK)
+            rc = expand_cmd_subs(&cmd_list);
         
         if (rc != OK || cmd_list.num == 0) {
-            free(cmd_copy);
             send_message_string(cli_socket, "Error parsing command\n");
             send_message_eof(cli_socket);
             continue;
@@ -438,21 +442,25 @@ int exec_client_requests(int cli_socket) {
         Built_In_Cmds bi_cmd = rsh_built_in_cmd(&cmd_list.commands[0]);
         
         if (bi_cmd == BI_CMD_STOP_SVR) {
-            free(cmd_copy);
+            free_cmd_list(&cmd_list);
             send_message_string(cli_socket, "Stopping server\n");
             send_message_eof(cli_socket);
+            arena_free(&arena);
+            free(io_buff);
             return OK_EXIT;
         }
         
         if (bi_cmd == BI_CMD_EXIT) {
-            free(cmd_copy);
+            free_cmd_list(&cmd_list);
             send_message_string(cli_socket, "Exiting client session\n");
             send_message_eof(cli_socket);
+            arena_free(&arena);
+            free(io_buff);
             return OK;
         }
         
         if (bi_cmd == BI_EXECUTED) {
-            free(cmd_copy);
+            free_cmd_list(&cmd_list);
             send_message_string(cli_socket, "Command executed\n");
             send_message_eof(cli_socket);
             continue;
@@ -463,12 +471,13 @@ int exec_client_requests(int cli_socket) {
         
         printf(RCMD_MSG_SVR_RC_CMD, cmd_rc);
         
-        free(cmd_copy);
+        free_cmd_list(&cmd_list);
         
         // Send EOF to signal end of output
         send_message_eof(cli_socket);
     }
 
+    arena_free(&arena);
     free(io_buff);
     return OK;
 }
@@ -569,87 +578,27 @@ int send_message_string(int cli_socket, char *buff) {
  *                  get this value. 
  */
 int rsh_execute_pipeline(int cli_sock, command_list_t *clist) {
-    int pipes[clist->num - 1][2];  // Array of pipes
-    pid_t pids[clist->num];
+    stage_t stages[clist->num];
     int  pids_st[clist->num];         // Array to store process IDs
     int exit_code;
 
-    // Create all necessary pipes
-    for (int i = 0; i < clist->num - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("pipe");
-            exit(EXIT_FAILURE);
-        }
+    // Socket is stdin of the first command and stdout/stderr of the last
+    if (spawn_pipeline(clist, cli_sock, cli_sock, cli_sock, stages) != OK) {
+        exit(EXIT_FAILURE);
     }
 
     for (int i = 0; i < clist->num; i++) {
-        // Fork to create a new process
-        pids[i] = fork();
-        
-        if (pids[i] < 0) {
-            // Error forking
-            perror("fork");
-            exit(EXIT_FAILURE);
-        } 
-        else if (pids[i] == 0) {
-            // Child process
-            
-            // Setup pipes for this process
-            if (i == 0) {
-                // First process gets stdin from socket
-                dup2(cli_sock, STDIN_FILENO);
-                
-                // Stdout goes to the pipe if not the last command
-                if (clist->num > 1) {
-                    dup2(pipes[0][1], STDOUT_FILENO);
-                } else {
-                    // Single command case: stdout goes to socket
-                    dup2(cli_sock, STDOUT_FILENO);
-                    dup2(cli_sock, STDERR_FILENO);
-                }
-            } 
-            else if (i == clist->num - 1) {
-                // Last process
-                // Stdin comes from previous pipe
-                dup2(pipes[i-1][0], STDIN_FILENO);
-                
-                // Stdout & stderr go to socket
-                dup2(cli_sock, STDOUT_FILENO);
-                dup2(cli_sock, STDERR_FILENO);
-            } 
-            else {
-                // Middle process
-                // Stdin from previous pipe
-                dup2(pipes[i-1][0], STDIN_FILENO);
-                
-                // Stdout to next pipe
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
-            
-            // Close all pipe fds as they've been duplicated
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+        if (stages[i].err != 0) {
+            // Did not start, report it where the child's perror() used to go
+            // and count it as the EXIT_FAILURE the child would have exited with
+            if (stages[i].err > 0) {
+                dprintf(i == clist->num - 1 ? cli_sock : STDERR_FILENO,
+                        "exec failed: %s\n", strerror(stages[i].err));
             }
-            
-            // Execute command
-            execvp(clist->commands[i].argv[0], clist->commands[i].argv);
-            
-            // If exec fails
-            perror("exec failed");
-            exit(EXIT_FAILURE);
+            pids_st[i] = EXIT_FAILURE << 8;
+            continue;
         }
-    }
-
-    // Parent process: close all pipe ends
-    for (int i = 0; i < clist->num - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
-    }
-
-    // Wait for all children
-    for (int i = 0; i < clist->num; i++) {
-        waitpid(pids[i], &pids_st[i], 0);
+        pids_st[i] = wait_stage(&stages[i]);
     }
 
     // Get exit code of last process